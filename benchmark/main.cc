@@ -0,0 +1,330 @@
+/*
+ * Copyright 2020-2022 Bruno Ribeiro <https://github.com/brunexgeek>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <protop/protop.hh>
+#include "tokenizer.hh"
+#include "parser.hh"
+#include "synthetic.hh"
+#include <protop/writer.hh>
+#include <fstream>
+#include <sstream>
+#include <chrono>
+#include <cstdlib>
+#include <new>
+
+using namespace protop;
+
+// count heap allocations made while parsing with statistics
+void *operator new( size_t size )
+{
+    trackAllocation(size);
+    void *ptr = malloc(size == 0 ? 1 : size);
+    if (ptr == nullptr) throw std::bad_alloc();
+    return ptr;
+}
+
+void operator delete( void *ptr ) noexcept
+{
+    free(ptr);
+}
+
+typedef std::chrono::steady_clock Clock;
+
+struct Timing
+{
+    double lex;
+    double parse;
+    double resolve;
+    double sort;
+    double total;
+    double events;
+    double lazy;
+    double ostream;
+    double writer;
+};
+
+static const char *TYPES[] =
+{
+    "double", "float", "int32_t", "int64_t", "uint32_t", "uint64_t", "int32_t", "int64_t",
+    "uint32_t", "uint64_t", "int32_t", "int64_t", "bool", "std::string", "std::string",
+};
+
+static double elapsed( Clock::time_point start )
+{
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+// tokenize the whole input and return the number of tokens
+static size_t lex( const std::string &content )
+{
+    IteratorInputStream<const char*> is(content.data(), content.data() + content.size());
+    Tokenizer tok(is);
+    size_t count = 0;
+    while (tok.next().code != TOKEN_EOF) ++count;
+    return count;
+}
+
+// what an index builder needs: message names and field numbers, without a tree
+struct FieldCounter : public ParseHandler
+{
+    size_t messages = 0;
+    size_t fields = 0;
+
+    void onMessageBegin( Message & ) override { ++messages; }
+    void onField( Field & ) override { ++fields; }
+};
+
+/*
+ * Emits code similar to what the generators produce, with many small writes.
+ * Used to compare 'std::ostream' with 'CodeWriter'.
+ */
+template<typename T>
+static void emit( T &out, const Proto &tree )
+{
+    for (auto message : tree.messages)
+    {
+        out << "struct " << message->name << "\n{\n";
+        for (auto field : message->fields)
+        {
+            out << '\t';
+            if (field->type.repeated) out << "std::vector<";
+            if (field->type.id >= TYPE_DOUBLE && field->type.id <= TYPE_BYTES)
+                out << TYPES[field->type.id - TYPE_DOUBLE];
+            else
+                out << field->type.name;
+            if (field->type.repeated) out << '>';
+            out << ' ' << field->name << "; // " << field->index << '\n';
+        }
+        out << "\tsize_t byte_size() const;\n";
+        out << "\tvoid serialize( std::string& ) const;\n";
+        out << "\tbool parse( const char*, size_t );\n";
+        out << "};\n";
+    }
+}
+
+static void run( const std::string &content, Timing &timing, size_t &tokens, size_t &emitted )
+{
+    auto start = Clock::now();
+    tokens = lex(content);
+    timing.lex += elapsed(start);
+
+    Proto tree;
+    IteratorInputStream<const char*> is(content.data(), content.data() + content.size());
+    start = Clock::now();
+    parseTree(tree, is);
+    timing.parse += elapsed(start);
+    size_t declared = tree.messages.size();
+    start = Clock::now();
+    resolveTypes(tree);
+    timing.resolve += elapsed(start);
+    start = Clock::now();
+    sortMessages(tree);
+    timing.sort += elapsed(start);
+
+    start = Clock::now();
+    std::ostringstream stream;
+    emit(stream, tree);
+    emitted = stream.str().size();
+    timing.ostream += elapsed(start);
+    start = Clock::now();
+    CodeWriter writer;
+    emit(writer, tree);
+    timing.writer += elapsed(start);
+    if (writer.size() != emitted) throw exception("CodeWriter output mismatch");
+
+    // the public entry point, including the 'std::istream' overhead
+    Proto other;
+    std::istringstream input(content);
+    start = Clock::now();
+    Proto::parse(other, input);
+    timing.total += elapsed(start);
+
+    // event API on the same input
+    FieldCounter counter;
+    std::istringstream events(content);
+    start = Clock::now();
+    Proto::parse(counter, events);
+    timing.events += elapsed(start);
+    if (counter.messages != declared) throw exception("Event API mismatch");
+
+    // lazy parse touching a single message (and what it references)
+    Proto lazy;
+    std::istringstream partial(content);
+    start = Clock::now();
+    Proto::parse(lazy, partial, "", nullptr, PARSE_LAZY);
+    if (!lazy.messages.empty() && lazy.message(lazy.messages.front()->qname) == nullptr)
+        throw exception("Lazy lookup failed");
+    timing.lazy += elapsed(start);
+}
+
+static void report( const char *name, double seconds, int iterations, size_t bytes, size_t tokens )
+{
+    double mean = seconds / iterations;
+    std::cout << "  " << name << ": " << mean * 1000.0 << " ms";
+    if (bytes > 0)
+        std::cout << ", " << (double) bytes / (1024.0 * 1024.0) / mean << " MB/s";
+    if (tokens > 0)
+        std::cout << ", " << (double) tokens / mean << " tokens/s";
+    std::cout << '\n';
+}
+
+static void print_stats( const ParseStats &stats )
+{
+    std::cout << "Statistics:\n"
+        << "  bytes: " << stats.bytes << "\n"
+        << "  tokens: " << stats.tokens << "\n"
+        << "  nodes: " << stats.nodes << "\n"
+        << "  allocations: " << stats.allocations << " (" << stats.allocatedBytes << " bytes)\n"
+        << "  tokenize: " << stats.tokenizeTime * 1000.0 << " ms\n"
+        << "  parse: " << stats.parseTime * 1000.0 << " ms\n"
+        << "  resolve: " << stats.resolveTime * 1000.0 << " ms\n"
+        << "  sort: " << stats.sortTime * 1000.0 << " ms\n"
+        << "Tokens per kind:\n";
+    for (int i = 0; i < PROTOP_TOKEN_KINDS; ++i)
+    {
+        if (stats.tokenKinds[i] == 0) continue;
+        std::cout << "  " << ParseStats::tokenName(i) << ": " << stats.tokenKinds[i] << '\n';
+    }
+}
+
+static void usage()
+{
+    std::cerr << "Usage: protop_bench [options] [proto file]\n"
+        << "Options:\n"
+        << "  --messages N    Number of synthetic messages (default 500)\n"
+        << "  --fields N      Fields per synthetic message (default 20)\n"
+        << "  --nesting N     Depth of message references (default 4)\n"
+        << "  --services N    Number of synthetic services (default 4)\n"
+        << "  --options       Add options to the synthetic schema\n"
+        << "  --comments      Add comments to the synthetic schema\n"
+        << "  --seed N        Seed for the synthetic schema (default 1)\n"
+        << "  --iterations N  Number of measured runs (default 20)\n"
+        << "  --output FILE   Write the synthetic schema to FILE and exit\n"
+        << "If a proto file is given, it is used instead of the synthetic schema.\n";
+}
+
+int main( int argc, char **argv )
+{
+    SchemaOptions options{500, 20, 4, 4, false, false, 1};
+    int iterations = 20;
+    std::string output;
+    std::string fileName;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (arg == "--options")
+            options.options = true;
+        else
+        if (arg == "--comments")
+            options.comments = true;
+        else
+        if (arg == "--messages" && has_value)
+            options.messages = atoi(argv[++i]);
+        else
+        if (arg == "--fields" && has_value)
+            options.fields = atoi(argv[++i]);
+        else
+        if (arg == "--nesting" && has_value)
+            options.nesting = atoi(argv[++i]);
+        else
+        if (arg == "--services" && has_value)
+            options.services = atoi(argv[++i]);
+        else
+        if (arg == "--seed" && has_value)
+            options.seed = strtoull(argv[++i], nullptr, 10);
+        else
+        if (arg == "--iterations" && has_value)
+            iterations = atoi(argv[++i]);
+        else
+        if (arg == "--output" && has_value)
+            output = argv[++i];
+        else
+        if (arg.compare(0, 2, "--") != 0 && fileName.empty())
+            fileName = arg;
+        else
+        {
+            usage();
+            return 1;
+        }
+    }
+    if (options.messages <= 0 || options.fields <= 0 || options.nesting < 0 ||
+        options.services < 0 || iterations <= 0)
+    {
+        usage();
+        return 1;
+    }
+
+    std::string content;
+    if (fileName.empty())
+        content = generate_schema(options);
+    else
+    {
+        std::ifstream input(fileName);
+        if (!input.good())
+        {
+            std::cerr << "Unable to open '" << fileName << "'\n";
+            return 1;
+        }
+        std::stringstream ss;
+        ss << input.rdbuf();
+        content = ss.str();
+    }
+
+    if (!output.empty())
+    {
+        std::ofstream out(output);
+        out << content;
+        return out.good() ? 0 : 1;
+    }
+
+    Timing timing{};
+    size_t tokens = 0;
+    size_t emitted = 0;
+    ParseStats stats;
+    try
+    {
+        // warm up
+        run(content, timing, tokens, emitted);
+        timing = Timing{};
+        for (int i = 0; i < iterations; ++i)
+            run(content, timing, tokens, emitted);
+
+        Proto tree;
+        std::istringstream input(content);
+        Proto::parse(tree, input, fileName, &stats);
+    } catch (exception &ex)
+    {
+        std::cerr << "Error: " << ex.what() << " at " << ex.line << ':' << ex.column << '\n';
+        return 1;
+    }
+
+    std::cout << "Input: " << (fileName.empty() ? "synthetic" : fileName) << " (" << content.size()
+        << " bytes, " << tokens << " tokens, " << iterations << " iterations)\n";
+    report("lex", timing.lex, iterations, content.size(), tokens);
+    report("parse", timing.parse, iterations, content.size(), 0);
+    report("resolve", timing.resolve, iterations, 0, 0);
+    report("sort_messages", timing.sort, iterations, 0, 0);
+    report("total", timing.total, iterations, content.size(), 0);
+    report("events", timing.events, iterations, content.size(), 0);
+    report("lazy (one message)", timing.lazy, iterations, content.size(), 0);
+    std::cout << "Code emission (" << emitted << " bytes):\n";
+    report("std::ostream", timing.ostream, iterations, emitted, 0);
+    report("CodeWriter", timing.writer, iterations, emitted, 0);
+    print_stats(stats);
+    return 0;
+}
@@ -0,0 +1,124 @@
+/*
+ * Copyright 2020-2022 Bruno Ribeiro <https://github.com/brunexgeek>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "synthetic.hh"
+#include <sstream>
+
+static const char *SCALARS[] =
+{
+    "double", "float", "int32", "int64", "uint32", "uint64", "sint32", "sint64",
+    "fixed32", "fixed64", "sfixed32", "sfixed64", "bool", "string", "bytes",
+};
+
+#define SCALAR_COUNT  (int) (sizeof(SCALARS) / sizeof(SCALARS[0]))
+#define ENUM_COUNT    4
+
+static uint32_t next( uint64_t &seed )
+{
+    seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+    return (uint32_t) (seed >> 33);
+}
+
+// level of each message in the reference chain (level zero has no message fields)
+static int level( const SchemaOptions &options, int index )
+{
+    return (int) ((int64_t) index * (options.nesting + 1) / options.messages);
+}
+
+// pick a message from the level below 'index'
+static int referenced( const SchemaOptions &options, int index, uint64_t &seed )
+{
+    int target = level(options, index) - 1;
+    int first = index;
+    while (first > 0 && level(options, first - 1) >= target) --first;
+    int last = first;
+    while (last < index && level(options, last) == target) ++last;
+    if (last == first) return -1;
+    return first + (int) (next(seed) % (uint32_t) (last - first));
+}
+
+std::string generate_schema( const SchemaOptions &options )
+{
+    std::stringstream out;
+    uint64_t seed = options.seed;
+
+    if (options.comments)
+        out << "/*\n * Synthetic schema with " << options.messages << " messages and "
+            << options.fields << " fields per message.\n */\n\n";
+    out << "syntax = \"proto3\";\n\npackage bench.synthetic;\n\n";
+    if (options.options)
+        out << "option optimize_for = SPEED;\noption java_package = \"bench.synthetic\";\n\n";
+
+    for (int i = 0; i < ENUM_COUNT; ++i)
+    {
+        if (options.comments) out << "// enumeration " << i << "\n";
+        out << "enum Enum" << i << "\n{\n";
+        for (int j = 0; j < 8; ++j)
+            out << "    ENUM" << i << "_VALUE" << j << " = " << j << ";\n";
+        out << "}\n\n";
+    }
+
+    for (int i = options.messages - 1; i >= 0; --i)
+    {
+        if (options.comments)
+            out << "// message " << i << " (level " << level(options, i) << ")\n";
+        out << "message Message" << i << "\n{\n";
+        if (options.options && i % 4 == 0)
+            out << "    option deprecated = false;\n";
+        for (int j = 0; j < options.fields; ++j)
+        {
+            uint32_t kind = next(seed) % 16;
+            out << "    ";
+            if (kind % 5 == 0) out << "repeated ";
+
+            int target = (kind < 3) ? referenced(options, i, seed) : -1;
+            if (target >= 0)
+                out << "Message" << target;
+            else
+            if (kind == 3)
+                out << "Enum" << next(seed) % ENUM_COUNT;
+            else
+                out << SCALARS[next(seed) % SCALAR_COUNT];
+            out << " field" << j << " = " << j + 1;
+
+            if (options.options && kind == 4)
+                out << " [deprecated = true, (bench.hot) = true]";
+            out << ';';
+            if (options.comments && kind == 5)
+                out << " // field " << j;
+            else
+            if (options.comments && kind == 6)
+                out << " /* field " << j << " */";
+            out << '\n';
+        }
+        out << "}\n\n";
+    }
+
+    for (int i = 0; i < options.services; ++i)
+    {
+        if (options.comments) out << "// service " << i << "\n";
+        out << "service Service" << i << "\n{\n";
+        for (int j = 0; j < options.fields; ++j)
+        {
+            out << "    rpc Call" << j << "(Message" << next(seed) % (uint32_t) options.messages
+                << ") returns (Message" << next(seed) % (uint32_t) options.messages << ")";
+            out << ((j % 2 == 0) ? ";\n" : " {}\n");
+        }
+        out << "}\n\n";
+    }
+
+    return out.str();
+}
@@ -0,0 +1,47 @@
+/*
+ * Copyright 2020-2022 Bruno Ribeiro <https://github.com/brunexgeek>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef PROTOP_SYNTHETIC
+#define PROTOP_SYNTHETIC
+
+#include <string>
+#include <stdint.h>
+
+struct SchemaOptions
+{
+    // number of messages
+    int messages;
+    // number of fields in each message
+    int fields;
+    // length of the longest chain of messages referencing other messages
+    int nesting;
+    // number of services (each one with 'fields' procedures)
+    int services;
+    // add options to fields and messages
+    bool options;
+    // add line and block comments
+    bool comments;
+    uint64_t seed;
+};
+
+/*
+ * Generates a valid proto3 schema. The output depends only on the options, so
+ * the same schema can be reproduced from the command line. Messages are
+ * declared in reverse dependency order to exercise the message sorting.
+ */
+std::string generate_schema( const SchemaOptions &options );
+
+#endif // PROTOP_SYNTHETIC
@@ -0,0 +1,194 @@
+/*
+ * Copyright 2020-2022 Bruno Ribeiro <https://github.com/brunexgeek>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <protop/protop.hh>
+#include <protop/codec.hh>
+#include <protop/json.hh>
+#include <protop/text.hh>
+#include <fstream>
+#include <chrono>
+#include <cstdlib>
+#include <algorithm>
+
+using namespace protop;
+
+// number of items generated for each repeated field
+#define REPEATED_ITEMS  4
+// maximum depth of generated nested messages
+#define MAX_DEPTH       4
+
+static void fill( DynamicMessage &message, int depth, uint64_t &seed )
+{
+    for (auto &fc : message.codec().fields)
+    {
+        size_t count = fc.repeated ? REPEATED_ITEMS : 1;
+        for (size_t i = 0; i < count; ++i)
+        {
+            seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+            DynamicField &df = message.fields[fc.slot];
+            if (fc.message != nullptr)
+            {
+                if (depth >= MAX_DEPTH) break;
+                fill(message.addMessage(fc), depth + 1, seed);
+            }
+            else
+            if (fc.type == TYPE_STRING || fc.type == TYPE_BYTES)
+                df.strings.push_back(std::string(8 + (seed >> 60), (char) ('a' + (seed >> 59) % 26)));
+            else
+            if (fc.type == TYPE_DOUBLE)
+                df.addDouble((double) (seed >> 11) / 1000.0);
+            else
+            if (fc.type == TYPE_FLOAT)
+                df.addFloat((float) (seed >> 40) / 100.0f);
+            else
+            if (fc.type == TYPE_BOOL)
+                df.addBool((seed >> 63) != 0);
+            else
+            if (fc.eref != nullptr)
+                df.addInt(fc.eref->constants.empty() ? 0 : fc.eref->constants.back()->value);
+            else
+            if (fc.type == TYPE_INT32 || fc.type == TYPE_SINT32 || fc.type == TYPE_SFIXED32)
+                df.addInt((int32_t) (seed >> 32));
+            else
+            if (fc.type == TYPE_UINT32 || fc.type == TYPE_FIXED32)
+                df.addUInt((uint32_t) (seed >> 32));
+            else
+                df.addUInt(seed >> (seed >> 58));
+        }
+    }
+}
+
+int main( int argc, char **argv )
+{
+    if (argc != 3 && argc != 4)
+    {
+        std::cerr << "Usage: example_codec <proto file> <message> [iterations]\n";
+        return 1;
+    }
+    int iterations = (argc == 4) ? atoi(argv[3]) : 100000;
+    if (iterations <= 0) return 1;
+
+    std::ifstream input(argv[1]);
+    if (!input.good()) return 1;
+
+    Proto tree;
+    Proto::parse(tree, input, argv[1]);
+    Codec codec(tree);
+
+    const MessageCodec *mc = codec.find(argv[2]);
+    if (mc == nullptr) mc = codec.find(tree.package + "." + argv[2]);
+    if (mc == nullptr)
+    {
+        std::cerr << "Unable to find message '" << argv[2] << "'\n";
+        return 1;
+    }
+
+    uint64_t seed = 1;
+    DynamicMessage message(*mc);
+    fill(message, 0, seed);
+    std::string payload;
+    message.encode(payload);
+
+    // round trip check
+    DynamicMessage decoded(*mc);
+    decoded.decode(payload);
+    std::string encoded;
+    decoded.encode(encoded);
+    if (encoded != payload)
+    {
+        std::cerr << "Round trip mismatch\n";
+        return 1;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; ++i)
+    {
+        decoded.clear();
+        decoded.decode(payload);
+    }
+    auto middle = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; ++i)
+    {
+        encoded.clear();
+        decoded.encode(encoded);
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    // JSON transcoding
+    JsonTranscoder transcoder(codec);
+    std::vector<char> json(payload.size() * 4 + 64);
+    size_t jsize = transcoder.toJson(*mc, (const uint8_t*) payload.data(), payload.size(), json.data(), json.size());
+    if (jsize > json.size())
+    {
+        json.resize(jsize);
+        transcoder.toJson(*mc, (const uint8_t*) payload.data(), payload.size(), json.data(), json.size());
+    }
+    // default values are omitted in JSON, so compare the JSON representations
+    std::vector<uint8_t> binary(payload.size());
+    size_t bsize = transcoder.toBinary(*mc, json.data(), jsize, binary.data(), binary.size());
+    std::vector<char> check(jsize);
+    if (bsize > binary.size() ||
+        transcoder.toJson(*mc, binary.data(), bsize, check.data(), check.size()) != jsize ||
+        !std::equal(check.begin(), check.end(), json.begin()))
+    {
+        std::cerr << "JSON round trip mismatch\n";
+        return 1;
+    }
+    auto jstart = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; ++i)
+        transcoder.toJson(*mc, (const uint8_t*) payload.data(), payload.size(), json.data(), json.size());
+    auto jmiddle = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; ++i)
+        transcoder.toBinary(*mc, json.data(), jsize, binary.data(), binary.size());
+    auto jend = std::chrono::steady_clock::now();
+
+    // text format
+    std::string text;
+    TextFormat::print(decoded, text);
+    DynamicMessage parsed(*mc);
+    TextFormat::parse(parsed, text.data(), text.size());
+    encoded.clear();
+    parsed.encode(encoded);
+    if (encoded != payload)
+    {
+        std::cerr << "Text format round trip mismatch\n";
+        return 1;
+    }
+    auto tstart = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; ++i)
+    {
+        parsed.clear();
+        TextFormat::parse(parsed, text.data(), text.size());
+    }
+    auto tend = std::chrono::steady_clock::now();
+
+    double total = (double) payload.size() * iterations / (1024.0 * 1024.0);
+    double dtime = std::chrono::duration<double>(middle - start).count();
+    double etime = std::chrono::duration<double>(end - middle).count();
+    double ttime = std::chrono::duration<double>(tend - tstart).count();
+
+    std::cout << "Message: " << mc->message->qname << " (" << payload.size() << " bytes)\n";
+    std::cout << " Decode: " << total / dtime << " MB/s, " << iterations / dtime << " msg/s\n";
+    std::cout << " Encode: " << total / etime << " MB/s, " << iterations / etime << " msg/s\n";
+    std::cout << "   JSON: " << jsize << " bytes\n";
+    std::cout << " ToJson: " << std::chrono::duration<double, std::micro>(jmiddle - jstart).count() / iterations << " us/msg\n";
+    std::cout << " ToBinary: " << std::chrono::duration<double, std::micro>(jend - jmiddle).count() / iterations << " us/msg\n";
+    std::cout << "   Text: " << text.size() << " bytes\n";
+    std::cout << " ParseText: " << (double) text.size() * iterations / (1024.0 * 1024.0) / ttime << " MB/s, "
+        << iterations / ttime << " msg/s (" << ttime / dtime << "x the binary decode time)\n";
+
+    return 0;
+}
@@ -0,0 +1,61 @@
+/*
+ * Copyright 2020-2022 Bruno Ribeiro <https://github.com/brunexgeek>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <protop/protop.hh>
+#include <protop/diff.hh>
+#include <fstream>
+
+using namespace protop;
+
+static bool load( Proto &tree, const char *fileName )
+{
+    std::ifstream input(fileName);
+    if (!input.good())
+    {
+        std::cerr << "Unable to open '" << fileName << "'\n";
+        return false;
+    }
+    Proto::parse(tree, input, fileName);
+    return true;
+}
+
+int main( int argc, char **argv )
+{
+    if (argc != 3)
+    {
+        std::cerr << "Usage: example_diff <old proto> <new proto>\n";
+        return 1;
+    }
+
+    Proto before, after;
+    if (!load(before, argv[1]) || !load(after, argv[2])) return 1;
+
+    auto changes = diff(before, after);
+    for (auto &it : changes)
+    {
+        std::cout << changeName(it.type) << ": " << it.entity;
+        if (!it.member.empty()) std::cout << '.' << it.member;
+        if (!it.before.empty() && !it.after.empty())
+            std::cout << " (" << it.before << " -> " << it.after << ")";
+        else
+        if (!it.before.empty() || !it.after.empty())
+            std::cout << " (" << it.before << it.after << ")";
+        std::cout << '\n';
+    }
+
+    // non-zero exit code if the schemas are different
+    return changes.empty() ? 0 : 2;
+}
@@ -15,6 +15,7 @@
  */
 
 #include <protop/protop.hh>
+#include <protop/writer.hh>
 #include <fstream>
 
 using namespace protop;
@@ -39,59 +40,97 @@ static const char *TYPES[] =
     nullptr,
 };
 
-static void print( std::ostream &out, std::shared_ptr<Field> field )
+static void leading( CodeWriter &out, const Proto &proto, const Comments &comments )
 {
-    out << "    ";
+    std::string text = proto.comment(comments.leading);
+    if (text.empty()) return;
+    size_t start = 0;
+    while (start <= text.size())
+    {
+        size_t end = text.find('\n', start);
+        if (end == std::string::npos) end = text.size();
+        out << "//";
+        if (end > start) out << ' ' << text.substr(start, end - start);
+        out << '\n';
+        start = end + 1;
+    }
+}
+
+// prints the trailing comment (if any) and the line break
+static void trailing( CodeWriter &out, const Proto &proto, const Comments &comments )
+{
+    std::string text = proto.comment(comments.trailing);
+    if (!text.empty() && text.find('\n') == std::string::npos)
+        out << " // " << text;
+    out << '\n';
+}
+
+static void print( CodeWriter &out, const Proto &proto, std::shared_ptr<Field> field )
+{
+    leading(out, proto, field->comments);
     if (field->type.repeated)
         out << "repeated ";
     if (field->type.id >= TYPE_DOUBLE && field->type.id <= TYPE_BYTES)
         out << TYPES[field->type.id - TYPE_DOUBLE];
     else
         out << field->type.name;
-    out << ' ' << field->name << " = " << field->index << ";\n";
+    out << ' ' << field->name << " = " << field->index << ';';
+    trailing(out, proto, field->comments);
 }
 
-static void print( std::ostream &out, std::shared_ptr<Constant> entity )
+static void print( CodeWriter &out, std::shared_ptr<Constant> entity )
 {
-    out << "    " << entity->name << " = " << entity->value << ";\n";
+    out << entity->name << " = " << entity->value << ";\n";
 }
 
-static void print( std::ostream &out, std::shared_ptr<Enum> entity )
+static void print( CodeWriter &out, const Proto &proto, std::shared_ptr<Enum> entity )
 {
-    out << "enum " << entity->name << "\n{" << '\n';
-
+    leading(out, proto, entity->comments);
+    out << "enum " << entity->name << "\n{";
+    trailing(out, proto, entity->comments);
+    out.indent();
     for (auto it : entity->constants)
         print(out, it);
+    out.dedent();
     out << '}' << '\n';
 }
 
-static void print( std::ostream &out, std::shared_ptr<Message> message )
+static void print( CodeWriter &out, const Proto &proto, std::shared_ptr<Message> message )
 {
-    out << "message " << message->name << "\n{" << '\n';
-    for (auto it : message->fields) print(out, it);
+    leading(out, proto, message->comments);
+    out << "message " << message->name << "\n{";
+    trailing(out, proto, message->comments);
+    out.indent();
+    for (auto it : message->fields) print(out, proto, it);
+    out.dedent();
     out << '}' << '\n';
 }
 
-static void print( std::ostream &out, std::shared_ptr<Procedure> entity )
+static void print( CodeWriter &out, const Proto &proto, std::shared_ptr<Procedure> entity )
 {
-    out << "    rpc " << entity->name << "(" << entity->request.name << ")"
-        << " returns (" << entity->response.name << ");\n";
+    leading(out, proto, entity->comments);
+    out << "rpc " << entity->name << "(" << (entity->requestStream ? "stream " : "") << entity->request.name << ")"
+        << " returns (" << (entity->responseStream ? "stream " : "") << entity->response.name << ");";
+    trailing(out, proto, entity->comments);
 }
 
-static void print( std::ostream &out,  std::shared_ptr<Service> entity )
+static void print( CodeWriter &out, const Proto &proto, std::shared_ptr<Service> entity )
 {
     out << "service " << entity->name << "\n{" << '\n';
-    for (auto it : entity->procs) print(out, it);
+    out.indent();
+    for (auto it : entity->procs) print(out, proto, it);
+    out.dedent();
     out << '}' << '\n';
 }
 
-static void print( std::ostream &out, Proto &proto )
+static void print( CodeWriter &out, Proto &proto )
 {
     out << "syntax = \"proto3\";\n";
     out << "package " << proto.package << ";\n";
-    for (auto it : proto.messages) print(out, it);
-    for (auto it : proto.enums) print(out, it);
-    for (auto it : proto.services) print(out, it);
+    for (auto &it : proto.imports) out << "import \"" << it << "\";\n";
+    for (auto it : proto.messages) print(out, proto, it);
+    for (auto it : proto.enums) print(out, proto, it);
+    for (auto it : proto.services) print(out, proto, it);
 }
 
 int main( int argc, char **argv )
@@ -102,8 +141,9 @@ int main( int argc, char **argv )
     if (!input.good()) return 1;
 
     Proto tree;
-    Proto::parse(tree, input, argv[1]);
-    print(std::cout, tree);
+    Proto::parse(tree, input, argv[1], nullptr, PARSE_COMMENTS);
+    CodeWriter out;
+    print(out, tree);
 
-    return 0;
+    return out.writeTo(1) ? 0 : 1;
 }
\ No newline at end of file
@@ -15,35 +15,315 @@
  */
 
 #include <protop/protop.hh>
+#include <protop/diff.hh>
+#include <protop/writer.hh>
 #include <fstream>
+#include <sstream>
+#include <cstdio>
 #include <vector>
+#include <algorithm>
+#include <unordered_map>
+#include <thread>
+#include <atomic>
+#include <exception>
+#include <cstdlib>
+#include <set>
+#include <stdexcept>
+
+// largest method dispatch table (slots are stored as 'int16_t')
+#define MAX_DISPATCH_SLOTS  32768
+// part of the generation key; increment it whenever the generated code changes
+#define GENERATOR_VERSION   2
 
 using namespace protop;
 
+struct Options
+{
+    // reorder struct members to minimize padding
+    bool pack_fields;
+    // keep the hash value in the message until 'invalidate_hash' is called
+    bool cached_hash;
+    // generate read-only views over serialized messages (requires C++17)
+    bool views;
+    // generate constexpr field tables for each message
+    bool meta;
+    // use 'std::pmr' strings and containers (requires C++17)
+    bool pmr;
+    // generate method dispatch tables for each service
+    bool dispatch;
+    // write the code of each message in its own source file
+    bool split;
+    // number of threads used to generate code
+    int jobs;
+};
+
+// estimated size and alignment of a type
+struct Layout
+{
+    size_t size;
+    size_t align;
+};
+
 struct Context
 {
-    std::ostream &header;
-    std::ostream &source;
+    CodeWriter &header;
+    CodeWriter &source;
     std::string ifname;
     std::string phname;
     std::string grpcns;
     std::vector<std::string> nspace;
+    Options options;
+    // estimated layout of each message as declared and as generated
+    std::unordered_map<std::string, Layout> original_layouts;
+    std::unordered_map<std::string, Layout> layouts;
+    // members of each message in declaration order
+    std::unordered_map<std::string, std::vector<std::shared_ptr<Field>>> members;
 };
 
+// repeated fields reuse the elements they already have, keeping their buffers
 static const char *TEMPLATES = "\
-template<class T, class V> void complex_from_grpc(T&a, V&b, size_t s) \n\
+template<class T, class V> void complex_from_grpc( T &a, const V &b )\n\
+{\n\
+\tif (a.size() > (size_t) b.size()) a.resize((size_t) b.size());\n\
+\ta.reserve((size_t) b.size());\n\
+\tauto it = b.begin();\n\
+\tfor (auto &item : a) item.from_grpc(*it++);\n\
+\tfor (; it != b.end(); ++it) { a.emplace_back(); a.back().from_grpc(*it); }\n\
+}\n\
+template<class T, class V> void complex_move_from_grpc( T &a, V &b )\n\
+{\n\
+\tif (a.size() > (size_t) b.size()) a.resize((size_t) b.size());\n\
+\ta.reserve((size_t) b.size());\n\
+\tauto it = b.begin();\n\
+\tfor (auto &item : a) item.from_grpc(std::move(*it++));\n\
+\tfor (; it != b.end(); ++it) { a.emplace_back(); a.back().from_grpc(std::move(*it)); }\n\
+}\n\
+template<class T, class V> void primitive_from_grpc( T &a, const V &b )\n\
 {\n\
-\ta.resize(s);\n\
-\tauto it = a.begin();\n\
-\tfor (auto item : b) { it->from_grpc(item); ++it; };\n\
+\ta.assign(b.begin(), b.end());\n\
 }\n\
-template<class T, class V> void primitive_from_grpc(T&a, V&b, size_t s) \n\
+template<class T, class V> void primitive_move_from_grpc( T &a, V &b )\n\
+{\n\
+\tif (a.size() > (size_t) b.size()) a.resize((size_t) b.size());\n\
+\ta.reserve((size_t) b.size());\n\
+\tauto it = b.begin();\n\
+\tfor (auto &item : a) item = std::move(*it++);\n\
+\tfor (; it != b.end(); ++it) a.emplace_back(std::move(*it));\n\
+}\n";
+
+static const char *HASH_HELPERS = "\
+namespace protop_hash {\n\
+static inline size_t combine( size_t h, size_t v ) { return h ^ (v + (size_t) 0x9e3779b97f4a7c15ULL + (h << 6) + (h >> 2)); }\n\
+template<class T> size_t of( const T &v ) { return std::hash<T>()(v); }\n\
+static inline size_t of( const std::vector<bool> &v ) { return std::hash<std::vector<bool>>()(v); }\n\
+template<class T, class A> size_t of( const std::vector<T, A> &v )\n\
 {\n\
-\ta.resize(s);\n\
-\tauto it = a.begin();\n\
-\tfor (auto item : b) { *it = item; ++it; };\n\
+\tsize_t h = v.size();\n\
+\tfor (const auto &item : v) h = combine(h, of(item));\n\
+\treturn h;\n\
+}\n\
 }\n";
 
+static const char *WIRE_HELPERS = "\
+namespace protop_wire {\n\
+static inline size_t varint_size( uint64_t v ) { size_t s = 1; while (v >= 0x80) { v >>= 7; ++s; } return s; }\n\
+static inline uint8_t *write_varint( uint8_t *p, uint64_t v ) { while (v >= 0x80) { *p++ = (uint8_t) (v | 0x80); v >>= 7; } *p++ = (uint8_t) v; return p; }\n\
+static inline uint8_t *write_fixed32( uint8_t *p, uint32_t v ) { for (int i = 0; i < 4; ++i, v >>= 8) *p++ = (uint8_t) v; return p; }\n\
+static inline uint8_t *write_fixed64( uint8_t *p, uint64_t v ) { for (int i = 0; i < 8; ++i, v >>= 8) *p++ = (uint8_t) v; return p; }\n\
+static inline uint8_t *write_float( uint8_t *p, float v ) { uint32_t b; std::memcpy(&b, &v, 4); return write_fixed32(p, b); }\n\
+static inline uint8_t *write_double( uint8_t *p, double v ) { uint64_t b; std::memcpy(&b, &v, 8); return write_fixed64(p, b); }\n\
+template<class S> uint8_t *write_bytes( uint8_t *p, const S &v ) { p = write_varint(p, v.size()); std::memcpy(p, v.data(), v.size()); return p + v.size(); }\n\
+static inline bool is_set( float v ) { uint32_t b; std::memcpy(&b, &v, 4); return b != 0; }\n\
+static inline bool is_set( double v ) { uint64_t b; std::memcpy(&b, &v, 8); return b != 0; }\n\
+static inline uint64_t zigzag32( int32_t v ) { return (uint32_t) (((uint32_t) v << 1) ^ (uint32_t) (v >> 31)); }\n\
+static inline uint64_t zigzag64( int64_t v ) { return ((uint64_t) v << 1) ^ (uint64_t) (v >> 63); }\n\
+static inline int32_t unzigzag32( uint64_t v ) { return (int32_t) ((uint32_t) (v >> 1) ^ (uint32_t) -(int32_t) (v & 1)); }\n\
+static inline int64_t unzigzag64( uint64_t v ) { return (int64_t) ((v >> 1) ^ (uint64_t) -(int64_t) (v & 1)); }\n\
+static inline bool read_varint( const uint8_t *&p, const uint8_t *e, uint64_t &v )\n\
+{\n\
+\tif (p < e && *p < 0x80) { v = *p++; return true; }\n\
+\tv = 0;\n\
+\tfor (int s = 0; s < 64 && p < e; s += 7) { uint64_t b = *p++; v |= (b & 0x7F) << s; if (b < 0x80) return true; }\n\
+\treturn false;\n\
+}\n\
+static inline bool read_fixed32( const uint8_t *&p, const uint8_t *e, uint32_t &v )\n\
+{\n\
+\tif (e - p < 4) return false;\n\
+\tv = (uint32_t) p[0] | ((uint32_t) p[1] << 8) | ((uint32_t) p[2] << 16) | ((uint32_t) p[3] << 24);\n\
+\tp += 4;\n\
+\treturn true;\n\
+}\n\
+static inline bool read_fixed64( const uint8_t *&p, const uint8_t *e, uint64_t &v )\n\
+{\n\
+\tuint32_t l, h;\n\
+\tif (!read_fixed32(p, e, l) || !read_fixed32(p, e, h)) return false;\n\
+\tv = (uint64_t) l | ((uint64_t) h << 32);\n\
+\treturn true;\n\
+}\n\
+static inline bool read_float( const uint8_t *&p, const uint8_t *e, float &v ) { uint32_t b; if (!read_fixed32(p, e, b)) return false; std::memcpy(&v, &b, 4); return true; }\n\
+static inline bool read_double( const uint8_t *&p, const uint8_t *e, double &v ) { uint64_t b; if (!read_fixed64(p, e, b)) return false; std::memcpy(&v, &b, 8); return true; }\n\
+static inline bool read_length( const uint8_t *&p, const uint8_t *e, size_t &n )\n\
+{\n\
+\tuint64_t v;\n\
+\tif (!read_varint(p, e, v) || v > (uint64_t) (e - p)) return false;\n\
+\tn = (size_t) v;\n\
+\treturn true;\n\
+}\n\
+static inline bool skip( const uint8_t *&p, const uint8_t *e, int wire )\n\
+{\n\
+\tuint64_t v;\n\
+\tsize_t n;\n\
+\tswitch (wire)\n\
+\t{\n\
+\t\tcase 0: return read_varint(p, e, v);\n\
+\t\tcase 1: return read_fixed64(p, e, v);\n\
+\t\tcase 2: if (!read_length(p, e, n)) return false; p += n; return true;\n\
+\t\tcase 5: { uint32_t b; return read_fixed32(p, e, b); }\n\
+\t\tdefault: return false;\n\
+\t}\n\
+}\n\
+} // namespace protop_wire\n";
+
+static const char *META_HELPERS = "\
+#ifndef PROTOP_META\n\
+#define PROTOP_META\n\
+namespace protop_meta {\n\
+enum class field_type { DOUBLE, FLOAT, INT32, INT64, UINT32, UINT64, SINT32, SINT64, FIXED32, FIXED64,\n\
+\tSFIXED32, SFIXED64, BOOL, STRING, BYTES, MESSAGE, ENUM };\n\
+struct field_info\n\
+{\n\
+\tconst char *name;\n\
+\tint number;\n\
+\tfield_type type;\n\
+\tbool repeated;\n\
+\t// qualified name of the message or enumeration type (if any)\n\
+\tconst char *type_name;\n\
+};\n\
+// field of 'C' stored in a member of type 'M'\n\
+template<class C, class M> struct field\n\
+{\n\
+\tconst field_info &info;\n\
+\tM C::*member;\n\
+};\n\
+// the second parameter lets the tables be defined in headers before C++17\n\
+template<class T, int = 0> struct message_info;\n\
+} // namespace protop_meta\n\
+#endif // PROTOP_META\n";
+
+static const char *STREAM_HELPERS = "\
+#ifndef PROTOP_STREAM\n\
+#define PROTOP_STREAM\n\
+#include <algorithm>\n\
+namespace protop_stream {\n\
+// Reads messages of type 'G' from a gRPC stream and converts them to 'F' in\n\
+// batches. The wire message and the converted messages are reused.\n\
+template<class F, class G> class reader\n\
+{\n\
+\tpublic:\n\
+\t\texplicit reader( size_t capacity = 64 ) : capacity_(capacity > 0 ? capacity : 1) {}\n\
+\t\t// read up to 'capacity' messages from 'stream' (anything with 'bool Read(G*)');\n\
+\t\t// returns false if no message was read\n\
+\t\ttemplate<class S> bool next( S &stream )\n\
+\t\t{\n\
+\t\t\tsize_ = 0;\n\
+\t\t\twhile (size_ < capacity_ && stream.Read(&wire_))\n\
+\t\t\t{\n\
+\t\t\t\tif (size_ == items_.size()) items_.emplace_back();\n\
+\t\t\t\titems_[size_++].from_grpc(wire_);\n\
+\t\t\t}\n\
+\t\t\treturn size_ > 0;\n\
+\t\t}\n\
+\t\tsize_t size() const { return size_; }\n\
+\t\tconst F &operator[]( size_t index ) const { return items_[index]; }\n\
+\t\tconst F *begin() const { return items_.data(); }\n\
+\t\tconst F *end() const { return items_.data() + size_; }\n\
+\tprivate:\n\
+\t\tstd::vector<F> items_;\n\
+\t\tG wire_;\n\
+\t\tsize_t size_ = 0;\n\
+\t\tsize_t capacity_;\n\
+};\n\
+// Collects messages of type 'F' and writes them to a gRPC stream as 'G' in\n\
+// batches. Messages returned by 'add' are recycled from previous batches. If a\n\
+// write fails, the messages not written (starting with the one that failed)\n\
+// stay pending, so they can be sent again.\n\
+template<class F, class G> class writer\n\
+{\n\
+\tpublic:\n\
+\t\texplicit writer( size_t capacity = 64 ) : capacity_(capacity > 0 ? capacity : 1) {}\n\
+\t\t// empty message to be filled by the caller\n\
+\t\tF &add()\n\
+\t\t{\n\
+\t\t\tif (size_ == items_.size()) items_.emplace_back(); else items_[size_].clear();\n\
+\t\t\treturn items_[size_++];\n\
+\t\t}\n\
+\t\tvoid add( const F &value ) { add() = value; }\n\
+\t\tbool full() const { return size_ >= capacity_; }\n\
+\t\tsize_t size() const { return size_; }\n\
+\t\tconst F &operator[]( size_t index ) const { return items_[index]; }\n\
+\t\t// write the pending messages to 'stream' (anything with 'bool Write(const G&)');\n\
+\t\t// returns false if a write failed\n\
+\t\ttemplate<class S> bool flush( S &stream )\n\
+\t\t{\n\
+\t\t\tfor (size_t i = 0; i < size_; ++i)\n\
+\t\t\t\tif (!stream.Write(convert(i))) return keep(i);\n\
+\t\t\tsize_ = 0;\n\
+\t\t\treturn true;\n\
+\t\t}\n\
+\t\t// same as above, but every message except the last one is written with\n\
+\t\t// the buffer hint of 'options' (e.g. 'grpc::WriteOptions') set\n\
+\t\ttemplate<class S, class O> bool flush( S &stream, const O &options )\n\
+\t\t{\n\
+\t\t\tO hinted = options;\n\
+\t\t\thinted.set_buffer_hint();\n\
+\t\t\tfor (size_t i = 0; i < size_; ++i)\n\
+\t\t\t\tif (!stream.Write(convert(i), i + 1 < size_ ? hinted : options)) return keep(i);\n\
+\t\t\tsize_ = 0;\n\
+\t\t\treturn true;\n\
+\t\t}\n\
+\tprivate:\n\
+\t\tstd::vector<F> items_;\n\
+\t\tG wire_;\n\
+\t\tsize_t size_ = 0;\n\
+\t\tsize_t capacity_;\n\
+\n\
+\t\tconst G &convert( size_t index )\n\
+\t\t{\n\
+\t\t\twire_.Clear();\n\
+\t\t\titems_[index].to_grpc(wire_);\n\
+\t\t\treturn wire_;\n\
+\t\t}\n\
+\t\t// moves the messages from 'first' on to the front (the ones already\n\
+\t\t// written are recycled after them)\n\
+\t\tbool keep( size_t first )\n\
+\t\t{\n\
+\t\t\tstd::rotate(items_.begin(), items_.begin() + (std::ptrdiff_t) first, items_.begin() + (std::ptrdiff_t) size_);\n\
+\t\t\tsize_ -= first;\n\
+\t\t\treturn false;\n\
+\t\t}\n\
+};\n\
+} // namespace protop_stream\n\
+#endif // PROTOP_STREAM\n";
+
+static const char *META_TYPES[] =
+{
+    "DOUBLE",
+    "FLOAT",
+    "INT32",
+    "INT64",
+    "UINT32",
+    "UINT64",
+    "SINT32",
+    "SINT64",
+    "FIXED32",
+    "FIXED64",
+    "SFIXED32",
+    "SFIXED64",
+    "BOOL",
+    "STRING",
+    "BYTES",
+};
+
 static const char *TYPES[] =
 {
     "double",
@@ -52,12 +332,12 @@ static const char *TYPES[] =
     "int64_t",
     "uint32_t",
     "uint64_t",
-    "sint32_t",
-    "sint64_t",
+    "int32_t",
+    "int64_t",
     "uint32_t",
     "uint64_t",
-    "sint32_t",
-    "sint64_t",
+    "int32_t",
+    "int64_t",
     "bool",
     "std::string",
     "std::string",
@@ -88,12 +368,16 @@ static std::vector<std::string> split_package( const std::string &package )
     return out;
 }
 
-static std::string get_native_type( int type, const std::string &name, bool is_enum, bool is_repeated, bool is_ptr )
+static std::string get_native_type( int type, const std::string &name, bool is_enum, bool is_repeated, bool is_ptr,
+    bool is_pmr = false )
 {
     std::string result;
     if (is_repeated)
-        result = "std::list<";
+        result = is_pmr ? "std::pmr::vector<" : "std::vector<";
 
+    if (!is_enum && is_pmr && (type == TYPE_STRING || type == TYPE_BYTES))
+        result += "std::pmr::string";
+    else
     if (!is_enum && type >= TYPE_DOUBLE && type <= TYPE_BYTES)
         result += TYPES[type - TYPE_DOUBLE];
     else
@@ -115,27 +399,15 @@ static std::string get_native_type( int type, const std::string &name, bool is_e
 
 static void generate_field( Context &ctx, std::shared_ptr<Field> field )
 {
-    ctx.header << "    ";
-    if (field->type.repeated)
-        ctx.header << "std::list<";
-
-    if (field->type.id >= TYPE_DOUBLE && field->type.id <= TYPE_BYTES)
-        ctx.header << TYPES[field->type.id - TYPE_DOUBLE];
-    else
-    if (field->type.eref != nullptr)
-        ctx.header << "int32_t";
-    else
-        ctx.header << field->type.name;
-
-    if (field->type.repeated)
-        ctx.header << ">";
+    ctx.header << "    " << get_native_type(field->type.id, field->type.name, field->type.eref != nullptr,
+        field->type.repeated, false, ctx.options.pmr);
     ctx.header << ' ' << field->name;
 
     if (!field->type.repeated)
     {
-        if (field->type.id >= TYPE_DOUBLE && field->type.id <= TYPE_SINT64)
+        if ((field->type.id >= TYPE_DOUBLE && field->type.id <= TYPE_SFIXED64) || field->type.eref != nullptr)
             ctx.header << " = 0;\n";
-            else
+        else
         if (field->type.id == TYPE_BOOL)
             ctx.header << " = false;\n";
         else
@@ -172,11 +444,17 @@ static void generate_to_grpc( Context &ctx, std::shared_ptr<Message> message )
     {
         if (it->type.repeated)
         {
-            ctx.source << "\tfor (auto item : " << it->name << ")";
-            if (it->type.id == TYPE_COMPLEX)
-                ctx.source << " item.to_grpc(*that.add_" << it->name << "());\n";
+            ctx.source << "\tthat.mutable_" << it->name << "()->Reserve((int) " << it->name << ".size());\n";
+            if (it->type.mref != nullptr)
+                ctx.source << "\tfor (const auto &item : " << it->name << ") item.to_grpc(*that.add_" << it->name << "());\n";
+            else
+            if ((it->type.id == TYPE_STRING || it->type.id == TYPE_BYTES) && ctx.options.pmr)
+                ctx.source << "\tfor (const auto &item : " << it->name << ") that.add_" << it->name << "(item.data(), item.size());\n";
             else
-                ctx.source << " that.add_" << it->name << "(item);\n";
+            if (it->type.id == TYPE_STRING || it->type.id == TYPE_BYTES)
+                ctx.source << "\tfor (const auto &item : " << it->name << ") that.add_" << it->name << "(item);\n";
+            else
+                ctx.source << "\tthat.mutable_" << it->name << "()->Add(" << it->name << ".begin(), " << it->name << ".end());\n";
         }
         else
         if (it->type.id == TYPE_COMPLEX)
@@ -186,6 +464,9 @@ static void generate_to_grpc( Context &ctx, std::shared_ptr<Message> message )
             else
                 ctx.source << "\tthat.set_" << it->name << "( static_cast<" << ctx.grpcns << "::" << it->type.name << ">(" << it->name << "));\n";
         }
+        else
+        if ((it->type.id == TYPE_STRING || it->type.id == TYPE_BYTES) && ctx.options.pmr)
+            ctx.source << "\tthat.mutable_" << it->name << "()->assign(" << it->name << ".data(), " << it->name << ".size());\n";
         else
             ctx.source << "\tthat.set_" << it->name << "(" << it->name << ");\n";
     }
@@ -193,6 +474,21 @@ static void generate_to_grpc( Context &ctx, std::shared_ptr<Message> message )
     ctx.source << "}\n";
 }
 
+/*
+ * Comparison cost of a member, used to sort 'operator==' so cheap fields are
+ * compared first. Integral scalars come first since adjacent ones can be
+ * compared with a single 'memcmp'.
+ */
+static int compare_cost( std::shared_ptr<Field> field )
+{
+    bool repeated = field->type.repeated;
+    if (field->type.mref != nullptr) return repeated ? 6 : 5;
+    if (field->type.id == TYPE_STRING || field->type.id == TYPE_BYTES) return repeated ? 4 : 2;
+    if (repeated) return 3;
+    if (field->type.id == TYPE_DOUBLE || field->type.id == TYPE_FLOAT) return 1;
+    return 0;
+}
+
 static void generate_operators( Context &ctx, std::shared_ptr<Message> message )
 {
     // not equal
@@ -201,42 +497,132 @@ static void generate_operators( Context &ctx, std::shared_ptr<Message> message )
     // equal
     ctx.source << "bool " << message->name << "::operator==( const " << message->name << "&that ) const\n{\n";
     if (message->fields.size() == 0) ctx.source << "\t(void) that;\n";
+
+    // runs of adjacent integral members (floating point values cannot be compared
+    // bitwise); each run is compared with 'memcmp' if there is no padding inside it
+    auto &members = ctx.members[message->name];
+    std::vector<std::vector<std::shared_ptr<Field>>> blocks;
+    std::vector<std::shared_ptr<Field>> others;
+    for (size_t i = 0; i < members.size(); ++i)
+    {
+        if (compare_cost(members[i]) != 0)
+        {
+            others.push_back(members[i]);
+            continue;
+        }
+        if (i == 0 || compare_cost(members[i-1]) != 0) blocks.emplace_back();
+        blocks.back().push_back(members[i]);
+    }
+    std::stable_sort(others.begin(), others.end(),
+        [](const std::shared_ptr<Field> &a, const std::shared_ptr<Field> &b)
+        {
+            return compare_cost(a) < compare_cost(b);
+        });
+
+    for (size_t i = 0; i < blocks.size(); ++i)
+    {
+        auto &block = blocks[i];
+        if (block.size() == 1) continue;
+        const std::string &first = block.front()->name;
+        const std::string &last = block.back()->name;
+        ctx.source << "\tconst size_t block" << i << " = (size_t) ((const char*) &" << last
+            << " - (const char*) &" << first << ") + sizeof(" << last << ");\n";
+    }
     ctx.source << "\treturn\n";
-    for (auto it : message->fields)
+    for (size_t i = 0; i < blocks.size(); ++i)
+    {
+        auto &block = blocks[i];
+        if (block.size() == 1)
+        {
+            ctx.source << "\t\t" << block[0]->name << " == that." << block[0]->name << " &&\n";
+            continue;
+        }
+        ctx.source << "\t\t(block" << i << " == ";
+        for (size_t j = 0; j < block.size(); ++j)
+            ctx.source << (j > 0 ? " + " : "") << "sizeof(" << block[j]->name << ")";
+        ctx.source << "\n\t\t\t? std::memcmp(&" << block[0]->name << ", &that." << block[0]->name << ", block" << i << ") == 0\n\t\t\t: (";
+        for (size_t j = 0; j < block.size(); ++j)
+            ctx.source << (j > 0 ? " && " : "") << block[j]->name << " == that." << block[j]->name;
+        ctx.source << ")) &&\n";
+    }
+    for (auto it : others)
         ctx.source << "\t\t" << it->name << " == that." << it->name << " &&\n";
     ctx.source << "\t\ttrue;\n";
     ctx.source << "}\n";
 }
 
-static void generate_from_grpc( Context &ctx, std::shared_ptr<Message> message )
+static void generate_hash( Context &ctx, std::shared_ptr<Message> message )
+{
+    ctx.source << "size_t " << message->name << "::hash() const\n{\n";
+    if (ctx.options.cached_hash)
+        ctx.source << "\tif (cached_hash_ != 0) return cached_hash_;\n";
+    ctx.source << "\tsize_t h = " << message->fields.size() << ";\n";
+    for (auto it : ctx.members[message->name])
+        ctx.source << "\th = protop_hash::combine(h, protop_hash::of(" << it->name << "));\n";
+    if (ctx.options.cached_hash)
+        ctx.source << "\tif (h == 0) h = 1;\n\tcached_hash_ = h;\n";
+    ctx.source << "\treturn h;\n}\n";
+}
+
+// reset every field without releasing the memory held by strings and containers
+static void generate_clear( Context &ctx, std::shared_ptr<Message> message )
+{
+    ctx.source << "void " << message->name << "::clear()\n{\n";
+    for (auto it : ctx.members[message->name])
+    {
+        if (it->type.repeated || it->type.mref != nullptr || it->type.id == TYPE_STRING || it->type.id == TYPE_BYTES)
+            ctx.source << "\t" << it->name << ".clear();\n";
+        else
+        if (it->type.id == TYPE_BOOL)
+            ctx.source << "\t" << it->name << " = false;\n";
+        else
+            ctx.source << "\t" << it->name << " = 0;\n";
+    }
+    ctx.source << "\tcached_size_ = 0;\n";
+    if (ctx.options.cached_hash) ctx.source << "\tcached_hash_ = 0;\n";
+    ctx.source << "}\n";
+}
+
+static void generate_from_grpc( Context &ctx, std::shared_ptr<Message> message, bool move )
 {
-    ctx.source << "void " << message->name << "::from_grpc( const " << ctx.grpcns << "::" << message->name << "& that )\n{\n";
+    if (move)
+        ctx.source << "void " << message->name << "::from_grpc( " << ctx.grpcns << "::" << message->name << "&& that )\n{\n";
+    else
+        ctx.source << "void " << message->name << "::from_grpc( const " << ctx.grpcns << "::" << message->name << "& that )\n{\n";
+    if (ctx.options.cached_hash) ctx.source << "\tcached_hash_ = 0;\n";
     for (auto it : message->fields)
     {
+        bool is_string = it->type.id == TYPE_STRING || it->type.id == TYPE_BYTES;
         if (it->type.repeated)
         {
-            /*ctx.source << "\t{\n\t\t" << it->name << ".resize(that." << it->name << "_size());\n\t\tauto it = " << it->name << ".begin();\n";
-            ctx.source << "\t\tfor (auto item : that." << it->name << "())";
-            if (it->type.id == TYPE_COMPLEX)
-                ctx.source << " { it->from_grpc(item); ++it; };\n\t}\n";
+            if (move && it->type.mref != nullptr)
+                ctx.source << "\tcomplex_move_from_grpc(" << it->name << ", *that.mutable_" << it->name << "());\n";
             else
-                ctx.source << " { *it = item; ++it; };\n\t}\n";*/
-            const char *tmpl = "complex_from_grpc";
-            if (it->type.id != TYPE_COMPLEX) tmpl = "primitive_from_grpc";
-            ctx.source << "\t"<< tmpl << "(" << it->name << ", that." << it->name << "(), that." << it->name << "_size());\n";
-
+            if (move && is_string)
+                ctx.source << "\tprimitive_move_from_grpc(" << it->name << ", *that.mutable_" << it->name << "());\n";
+            else
+            if (it->type.mref != nullptr)
+                ctx.source << "\tcomplex_from_grpc(" << it->name << ", that." << it->name << "());\n";
+            else
+                ctx.source << "\tprimitive_from_grpc(" << it->name << ", that." << it->name << "());\n";
         }
         else
         if (it->type.id == TYPE_COMPLEX)
         {
             if (it->type.mref != nullptr)
             {
-                auto native_type = get_native_type(it->type.id, it->type.name, it->type.eref != nullptr, false, false);
-                ctx.source << "\t"<< it->name << ".from_grpc( that." << it->name << "() );\n";
+                if (move)
+                    ctx.source << "\tif (that.has_" << it->name << "()) " << it->name << ".from_grpc(std::move(*that.mutable_"
+                        << it->name << "()));\n\telse " << it->name << ".from_grpc(that." << it->name << "());\n";
+                else
+                    ctx.source << "\t" << it->name << ".from_grpc(that." << it->name << "());\n";
             }
             else
                 ctx.source << "\t" << it->name << " = static_cast<int32_t>(that." << it->name << "());\n";
         }
+        else
+        if (move && is_string)
+            ctx.source << "\t" << it->name << " = std::move(*that.mutable_" << it->name << "());\n";
         else
             ctx.source << "\t" << it->name << " = that." << it->name << "();\n";
     }
@@ -244,48 +630,1050 @@ static void generate_from_grpc( Context &ctx, std::shared_ptr<Message> message )
     ctx.source << "}\n";
 }
 
+// wire type of the field values (before packing)
+static int wire_type( std::shared_ptr<Field> field )
+{
+    switch (field->type.id)
+    {
+        case TYPE_DOUBLE:
+        case TYPE_FIXED64:
+        case TYPE_SFIXED64:
+            return 1;
+        case TYPE_FLOAT:
+        case TYPE_FIXED32:
+        case TYPE_SFIXED32:
+            return 5;
+        case TYPE_STRING:
+        case TYPE_BYTES:
+            return 2;
+        case TYPE_COMPLEX:
+            return (field->type.eref != nullptr) ? 0 : 2;
+        default:
+            return 0;
+    }
+}
+
+static bool is_packed( std::shared_ptr<Field> field )
+{
+    return field->type.repeated && wire_type(field) != 2;
+}
+
+static int field_key( std::shared_ptr<Field> field )
+{
+    return (field->index << 3) | (is_packed(field) ? 2 : wire_type(field));
+}
+
+// varint encoding of the field key
+static std::vector<int> tag_bytes( int key )
+{
+    std::vector<int> out;
+    while (key >= 0x80)
+    {
+        out.push_back((key & 0x7F) | 0x80);
+        key >>= 7;
+    }
+    out.push_back(key);
+    return out;
+}
+
+static std::string write_tag( std::shared_ptr<Field> field )
+{
+    std::string out;
+    for (auto byte : tag_bytes(field_key(field)))
+        out += "*ptr++ = " + std::to_string(byte) + "; ";
+    return out;
+}
+
+// integer written in the wire format for a varint or fixed value
+static std::string wire_value( std::shared_ptr<Field> field, const std::string &value )
+{
+    switch (field->type.id)
+    {
+        case TYPE_SINT32:
+            return "protop_wire::zigzag32(" + value + ")";
+        case TYPE_SINT64:
+            return "protop_wire::zigzag64(" + value + ")";
+        case TYPE_INT32:
+        case TYPE_COMPLEX:
+            return "(uint64_t) (int64_t) " + value;
+        case TYPE_FIXED32:
+        case TYPE_SFIXED32:
+            return "(uint32_t) " + value;
+        default:
+            return "(uint64_t) " + value;
+    }
+}
+
+static std::string value_size( std::shared_ptr<Field> field, const std::string &value )
+{
+    int wire = wire_type(field);
+    if (wire == 1) return "8";
+    if (wire == 5) return "4";
+    if (field->type.id == TYPE_BOOL) return "1";
+    return "protop_wire::varint_size(" + wire_value(field, value) + ")";
+}
+
+static std::string write_value( std::shared_ptr<Field> field, const std::string &value )
+{
+    switch (field->type.id)
+    {
+        case TYPE_DOUBLE:
+            return "ptr = protop_wire::write_double(ptr, " + value + ");";
+        case TYPE_FLOAT:
+            return "ptr = protop_wire::write_float(ptr, " + value + ");";
+        case TYPE_BOOL:
+            return "*ptr++ = " + value + " ? 1 : 0;";
+        default:
+            break;
+    }
+    int wire = wire_type(field);
+    if (wire == 1) return "ptr = protop_wire::write_fixed64(ptr, " + wire_value(field, value) + ");";
+    if (wire == 5) return "ptr = protop_wire::write_fixed32(ptr, " + wire_value(field, value) + ");";
+    return "ptr = protop_wire::write_varint(ptr, " + wire_value(field, value) + ");";
+}
+
+// condition for serializing a singular field (proto3 omits default values)
+static std::string is_set( std::shared_ptr<Field> field, const std::string &value )
+{
+    if (field->type.id == TYPE_DOUBLE || field->type.id == TYPE_FLOAT)
+        return "protop_wire::is_set(" + value + ")";
+    if (field->type.id == TYPE_BOOL)
+        return value;
+    return value + " != 0";
+}
+
+// statement reading a scalar value and storing it with 'store' (e.g. "x = " or "x.push_back(")
+static std::string read_value( std::shared_ptr<Field> field, const std::string &store, const std::string &close,
+    const std::string &fail = "return false" )
+{
+    std::string type = "uint64_t";
+    std::string reader = "read_varint";
+    std::string value = "v";
+    switch (field->type.id)
+    {
+        case TYPE_DOUBLE: type = "double"; reader = "read_double"; break;
+        case TYPE_FLOAT: type = "float"; reader = "read_float"; break;
+        case TYPE_FIXED64: reader = "read_fixed64"; break;
+        case TYPE_SFIXED64: reader = "read_fixed64"; value = "(int64_t) v"; break;
+        case TYPE_FIXED32: type = "uint32_t"; reader = "read_fixed32"; break;
+        case TYPE_SFIXED32: type = "uint32_t"; reader = "read_fixed32"; value = "(int32_t) v"; break;
+        case TYPE_INT64: value = "(int64_t) v"; break;
+        case TYPE_UINT32: value = "(uint32_t) v"; break;
+        case TYPE_SINT32: value = "protop_wire::unzigzag32(v)"; break;
+        case TYPE_SINT64: value = "protop_wire::unzigzag64(v)"; break;
+        case TYPE_BOOL: value = "v != 0"; break;
+        case TYPE_UINT64: break;
+        default: value = "(int32_t) v"; break;
+    }
+    return type + " v; if (!protop_wire::" + reader + "(ptr, end, v)) " + fail + "; " + store + value + close + ";";
+}
+
+static std::vector<std::shared_ptr<Field>> sort_by_number( std::shared_ptr<Message> message )
+{
+    std::vector<std::shared_ptr<Field>> fields(message->fields.begin(), message->fields.end());
+    std::stable_sort(fields.begin(), fields.end(),
+        [](const std::shared_ptr<Field> &a, const std::shared_ptr<Field> &b) { return a->index < b->index; });
+    return fields;
+}
+
+static void generate_byte_size( Context &ctx, std::shared_ptr<Message> message )
+{
+    ctx.source << "size_t " << message->name << "::byte_size() const\n{\n\tsize_t size = 0;\n";
+    for (auto it : message->fields)
+    {
+        auto tsize = tag_bytes(field_key(it)).size();
+        if (it->type.mref != nullptr)
+        {
+            if (it->type.repeated)
+                ctx.source << "\tfor (const auto &item : " << it->name << ") { size_t n = item.byte_size(); size += "
+                    << tsize << " + protop_wire::varint_size(n) + n; }\n";
+            else
+                // an empty message is not written, like an unset field in libprotobuf
+                ctx.source << "\t{ size_t n = " << it->name << ".byte_size(); if (n > 0) size += "
+                    << tsize << " + protop_wire::varint_size(n) + n; }\n";
+        }
+        else
+        if (wire_type(it) == 2)
+        {
+            if (it->type.repeated)
+                ctx.source << "\tfor (const auto &item : " << it->name << ") size += "
+                    << tsize << " + protop_wire::varint_size(item.size()) + item.size();\n";
+            else
+                ctx.source << "\tif (!" << it->name << ".empty()) size += "
+                    << tsize << " + protop_wire::varint_size(" << it->name << ".size()) + " << it->name << ".size();\n";
+        }
+        else
+        if (it->type.repeated)
+        {
+            ctx.source << "\tif (!" << it->name << ".empty())\n\t{\n";
+            if (wire_type(it) != 0)
+                ctx.source << "\t\tsize_t n = " << it->name << ".size() * " << value_size(it, "") << ";\n";
+            else
+            if (it->type.id == TYPE_BOOL)
+                ctx.source << "\t\tsize_t n = " << it->name << ".size();\n";
+            else
+                ctx.source << "\t\tsize_t n = 0;\n\t\tfor (auto item : " << it->name << ") n += " << value_size(it, "item") << ";\n";
+            ctx.source << "\t\tsize += " << tsize << " + protop_wire::varint_size(n) + n;\n\t}\n";
+        }
+        else
+            ctx.source << "\tif (" << is_set(it, it->name) << ") size += " << tsize << " + " << value_size(it, it->name) << ";\n";
+    }
+    ctx.source << "\tcached_size_ = size;\n\treturn size;\n}\n";
+}
+
+static void generate_serialize( Context &ctx, std::shared_ptr<Message> message )
+{
+    // fields are written in field number order, like libprotobuf does
+    ctx.source << "uint8_t *" << message->name << "::serialize_to( uint8_t *ptr ) const\n{\n";
+    for (auto it : sort_by_number(message))
+    {
+        if (it->type.mref != nullptr)
+        {
+            if (it->type.repeated)
+                ctx.source << "\tfor (const auto &item : " << it->name << ") { " << write_tag(it)
+                    << "ptr = protop_wire::write_varint(ptr, item.cached_size_); ptr = item.serialize_to(ptr); }\n";
+            else
+                ctx.source << "\tif (" << it->name << ".cached_size_ > 0) { " << write_tag(it)
+                    << "ptr = protop_wire::write_varint(ptr, " << it->name << ".cached_size_); ptr = "
+                    << it->name << ".serialize_to(ptr); }\n";
+        }
+        else
+        if (wire_type(it) == 2)
+        {
+            if (it->type.repeated)
+                ctx.source << "\tfor (const auto &item : " << it->name << ") { " << write_tag(it)
+                    << "ptr = protop_wire::write_bytes(ptr, item); }\n";
+            else
+                ctx.source << "\tif (!" << it->name << ".empty()) { " << write_tag(it)
+                    << "ptr = protop_wire::write_bytes(ptr, " << it->name << "); }\n";
+        }
+        else
+        if (it->type.repeated)
+        {
+            ctx.source << "\tif (!" << it->name << ".empty())\n\t{\n";
+            if (wire_type(it) != 0)
+                ctx.source << "\t\tsize_t n = " << it->name << ".size() * " << value_size(it, "") << ";\n";
+            else
+            if (it->type.id == TYPE_BOOL)
+                ctx.source << "\t\tsize_t n = " << it->name << ".size();\n";
+            else
+                ctx.source << "\t\tsize_t n = 0;\n\t\tfor (auto item : " << it->name << ") n += " << value_size(it, "item") << ";\n";
+            ctx.source << "\t\t" << write_tag(it) << "ptr = protop_wire::write_varint(ptr, n);\n";
+            ctx.source << "\t\tfor (auto item : " << it->name << ") " << write_value(it, "item") << "\n\t}\n";
+        }
+        else
+            ctx.source << "\tif (" << is_set(it, it->name) << ") { " << write_tag(it) << write_value(it, it->name) << " }\n";
+    }
+    ctx.source << "\treturn ptr;\n}\n";
+
+    ctx.source << "void " << message->name << "::serialize( std::string &out ) const\n{\n"
+        << "\tsize_t size = byte_size();\n"
+        << "\tout.resize(size);\n"
+        << "\tif (size > 0) serialize_to((uint8_t*) &out[0]);\n}\n";
+}
+
+// whether the items of a repeated field are reused in place by 'parse'
+static bool is_reused( std::shared_ptr<Field> field )
+{
+    return field->type.repeated && (field->type.mref != nullptr || wire_type(field) == 2);
+}
+
+/*
+ * With 'merge', values are appended to the current content. Otherwise the
+ * content is replaced: the items of repeated messages and strings and singular
+ * messages are overwritten in place (keeping their buffers) and the items left
+ * over are removed at the end, so parsing a message of the same shape again
+ * does not allocate.
+ */
+static void generate_parse( Context &ctx, std::shared_ptr<Message> message )
+{
+    ctx.source << "bool " << message->name << "::read_from( const uint8_t *ptr, const uint8_t *end, bool merge )\n{\n";
+    if (ctx.options.cached_hash) ctx.source << "\tcached_hash_ = 0;\n";
+    if (message->fields.empty()) ctx.source << "\t(void) merge;\n";
+    for (auto it : message->fields)
+    {
+        if (is_reused(it))
+            ctx.source << "\tsize_t " << it->name << "_count = merge ? " << it->name << ".size() : 0;\n";
+        else
+        if (it->type.mref != nullptr)
+            ctx.source << "\tbool " << it->name << "_merge = merge;\n";
+    }
+    ctx.source << "\tif (!merge)\n\t{\n";
+    for (auto it : message->fields)
+    {
+        if (is_reused(it) || it->type.mref != nullptr) continue;
+        if (it->type.repeated || wire_type(it) == 2)
+            ctx.source << "\t\t" << it->name << ".clear();\n";
+        else
+        if (it->type.id == TYPE_BOOL)
+            ctx.source << "\t\t" << it->name << " = false;\n";
+        else
+            ctx.source << "\t\t" << it->name << " = 0;\n";
+    }
+    ctx.source << "\t}\n";
+    ctx.source << "\twhile (ptr < end)\n\t{\n"
+        << "\t\tuint64_t key;\n"
+        << "\t\tif (!protop_wire::read_varint(ptr, end, key)) return false;\n"
+        << "\t\tswitch (key)\n\t\t{\n";
+    for (auto it : message->fields)
+    {
+        ctx.source << "\t\t\tcase " << field_key(it) << ": ";
+        std::string item;
+        if (is_reused(it))
+        {
+            std::string count = it->name + "_count";
+            item = "(" + count + " < " + it->name + ".size() ? " + it->name + "[" + count + "++] : (++" + count
+                + ", " + it->name + ".emplace_back(), " + it->name + ".back()))";
+        }
+        if (it->type.mref != nullptr)
+        {
+            ctx.source << "{ size_t n; if (!protop_wire::read_length(ptr, end, n)) return false; ";
+            if (it->type.repeated)
+                ctx.source << "auto &item = " << item << "; if (!item.read_from(ptr, ptr + n, false)) return false; ";
+            else
+                ctx.source << "if (!" << it->name << ".read_from(ptr, ptr + n, " << it->name << "_merge)) return false; "
+                    << it->name << "_merge = true; ";
+            ctx.source << "ptr += n; break; }\n";
+        }
+        else
+        if (wire_type(it) == 2)
+        {
+            ctx.source << "{ size_t n; if (!protop_wire::read_length(ptr, end, n)) return false; ";
+            if (it->type.repeated)
+                ctx.source << item << ".assign((const char*) ptr, n);";
+            else
+                ctx.source << it->name << ".assign((const char*) ptr, n);";
+            ctx.source << " ptr += n; break; }\n";
+        }
+        else
+        if (it->type.repeated)
+        {
+            // packed block
+            ctx.source << "\n\t\t\t{\n"
+                << "\t\t\t\tsize_t n;\n"
+                << "\t\t\t\tif (!protop_wire::read_length(ptr, end, n)) return false;\n"
+                << "\t\t\t\tconst uint8_t *last = ptr + n;\n"
+                << "\t\t\t\twhile (ptr < last) { const uint8_t *end = last; "
+                << read_value(it, it->name + ".push_back(", ")") << " }\n"
+                << "\t\t\t\tbreak;\n\t\t\t}\n";
+            // unpacked values are also accepted
+            ctx.source << "\t\t\tcase " << ((it->index << 3) | wire_type(it)) << ": { "
+                << read_value(it, it->name + ".push_back(", ")") << " break; }\n";
+        }
+        else
+            ctx.source << "{ " << read_value(it, it->name + " = ", "") << " break; }\n";
+    }
+    ctx.source << "\t\t\tdefault: if (!protop_wire::skip(ptr, end, (int) (key & 7))) return false;\n"
+        << "\t\t}\n\t}\n";
+    // items and messages not present in the input
+    for (auto it : message->fields)
+    {
+        if (is_reused(it))
+            ctx.source << "\tif (" << it->name << "_count < " << it->name << ".size()) " << it->name << ".erase("
+                << it->name << ".begin() + (std::ptrdiff_t) " << it->name << "_count, " << it->name << ".end());\n";
+        else
+        if (it->type.mref != nullptr)
+            ctx.source << "\tif (!" << it->name << "_merge) " << it->name << ".clear();\n";
+    }
+    ctx.source << "\treturn ptr == end;\n}\n";
+
+    ctx.source << "bool " << message->name << "::merge_from( const uint8_t *ptr, const uint8_t *end )\n{\n"
+        << "\treturn read_from(ptr, end, true);\n}\n";
+    ctx.source << "bool " << message->name << "::parse( const char *data, size_t size )\n{\n"
+        << "\tconst uint8_t *ptr = (const uint8_t*) data;\n"
+        << "\treturn read_from(ptr, ptr + size, false);\n}\n";
+}
+
+// C++ type returned by a view accessor
+static std::string view_type( std::shared_ptr<Field> field )
+{
+    if (field->type.mref != nullptr) return field->type.mref->name + "View";
+    if (field->type.id == TYPE_STRING || field->type.id == TYPE_BYTES) return "std::string_view";
+    return get_native_type(field->type.id, field->type.name, field->type.eref != nullptr, false, false);
+}
+
+// expression creating a string or nested view from the length-delimited value at 'ptr'
+static std::string view_value( std::shared_ptr<Field> field )
+{
+    return view_type(field) + "((const char*) ptr, n)";
+}
+
+/*
+ * Read-only view over a serialized message. The first access builds an index
+ * with the position of each field in a single pass over the buffer, so nothing
+ * is copied or allocated. For singular fields the last occurrence wins (nested
+ * messages are not merged) and repeated fields are visited with '<name>_each'.
+ */
+static void generate_view_decl( Context &ctx, std::shared_ptr<Message> message )
+{
+    size_t repeated = 0;
+    for (auto it : message->fields)
+        if (it->type.repeated) ++repeated;
+
+    ctx.header << "class " << message->name << "View\n{\n"
+        << "\tpublic:\n"
+        << "\t\t" << message->name << "View() = default;\n"
+        << "\t\t" << message->name << "View( const char *data, size_t size ) : data_(data), size_(size) {}\n"
+        << "\t\t// the helpers end with '_' so they cannot clash with field accessors\n"
+        << "\t\tconst char *view_data_() const { return data_; }\n"
+        << "\t\tsize_t view_size_() const { return size_; }\n"
+        << "\t\t// whether the buffer is a well-formed message\n"
+        << "\t\tbool view_valid_() const { if (state_ == 0) view_index_(); return state_ > 0; }\n";
+
+    size_t slot = 0, counter = 0;
+    for (auto it : message->fields)
+    {
+        std::string type = view_type(it);
+        if (!it->type.repeated)
+        {
+            if (it->type.mref != nullptr)
+                ctx.header << "\t\tbool has_" << it->name << "() const { if (state_ == 0) view_index_(); return pos_["
+                    << slot << "] != 0; }\n";
+            ctx.header << "\t\t" << type << ' ' << it->name << "() const;\n";
+            ++slot;
+            continue;
+        }
+        ctx.header << "\t\tsize_t " << it->name << "_size() const { if (state_ == 0) view_index_(); return count_["
+            << counter++ << "]; }\n";
+        ctx.header << "\t\ttemplate<class F> void " << it->name << "_each( F fn ) const\n\t\t{\n"
+            << "\t\t\tif (state_ == 0) view_index_();\n"
+            << "\t\t\tif (pos_[" << slot << "] == 0) return;\n"
+            << "\t\t\tconst uint8_t *ptr = (const uint8_t*) data_ + pos_[" << slot << "] - 1;\n"
+            << "\t\t\tconst uint8_t *end = (const uint8_t*) data_ + size_;\n"
+            << "\t\t\twhile (ptr < end)\n\t\t\t{\n"
+            << "\t\t\t\tuint64_t key;\n"
+            << "\t\t\t\tif (!protop_wire::read_varint(ptr, end, key)) return;\n"
+            << "\t\t\t\tswitch (key)\n\t\t\t\t{\n"
+            << "\t\t\t\t\tcase " << field_key(it) << ": ";
+        if (wire_type(it) == 2)
+            ctx.header << "{ size_t n; if (!protop_wire::read_length(ptr, end, n)) return; fn("
+                << view_value(it) << "); ptr += n; break; }\n";
+        else
+        {
+            ctx.header << "\n\t\t\t\t\t{\n"
+                << "\t\t\t\t\t\tsize_t n;\n"
+                << "\t\t\t\t\t\tif (!protop_wire::read_length(ptr, end, n)) return;\n"
+                << "\t\t\t\t\t\tconst uint8_t *last = ptr + n;\n"
+                << "\t\t\t\t\t\twhile (ptr < last) { const uint8_t *end = last; "
+                << read_value(it, "fn(", ")", "return") << " }\n"
+                << "\t\t\t\t\t\tbreak;\n\t\t\t\t\t}\n"
+                << "\t\t\t\t\tcase " << ((it->index << 3) | wire_type(it)) << ": { "
+                << read_value(it, "fn(", ")", "return") << " break; }\n";
+        }
+        ctx.header << "\t\t\t\t\tdefault: if (!protop_wire::skip(ptr, end, (int) (key & 7))) return;\n"
+            << "\t\t\t\t}\n\t\t\t}\n\t\t}\n";
+        ++slot;
+    }
+
+    ctx.header << "\n\tprivate:\n"
+        << "\t\tconst char *data_ = nullptr;\n"
+        << "\t\tsize_t size_ = 0;\n"
+        << "\t\t// zero if not indexed yet, negative if malformed\n"
+        << "\t\tmutable int state_ = 0;\n"
+        << "\t\t// offset + 1 of the last value (singular) or first key (repeated) of each field\n"
+        << "\t\tmutable uint32_t pos_[" << std::max<size_t>(slot, 1) << "] = {};\n";
+    if (repeated > 0)
+        ctx.header << "\t\tmutable uint32_t count_[" << repeated << "] = {};\n";
+    ctx.header << "\n\t\tvoid view_index_() const;\n";
+    ctx.header << "};\n";
+}
+
+static void generate_view( Context &ctx, std::shared_ptr<Message> message )
+{
+    std::string name = message->name + "View";
+
+    ctx.source << "void " << name << "::view_index_() const\n{\n"
+        << "\tstate_ = 1;\n"
+        << "\tif (size_ > 0xFFFFFFFFU) { state_ = -1; return; }\n"
+        << "\tconst uint8_t *begin = (const uint8_t*) data_;\n"
+        << "\tconst uint8_t *ptr = begin;\n"
+        << "\tconst uint8_t *end = begin + size_;\n"
+        << "\twhile (ptr < end)\n\t{\n";
+    for (auto it : message->fields)
+    {
+        if (!it->type.repeated) continue;
+        ctx.source << "\t\tconst uint8_t *start = ptr;\n";
+        break;
+    }
+    ctx.source << "\t\tuint64_t key;\n"
+        << "\t\tif (!protop_wire::read_varint(ptr, end, key)) { state_ = -1; return; }\n"
+        << "\t\tswitch (key)\n\t\t{\n";
+    size_t slot = 0, counter = 0;
+    for (auto it : message->fields)
+    {
+        if (!it->type.repeated)
+        {
+            ctx.source << "\t\t\tcase " << field_key(it) << ": pos_[" << slot << "] = (uint32_t) (ptr - begin) + 1; break;\n";
+            ++slot;
+            continue;
+        }
+        std::string first = "if (pos_[" + std::to_string(slot) + "] == 0) pos_[" + std::to_string(slot)
+            + "] = (uint32_t) (start - begin) + 1; ";
+        std::string count = "count_[" + std::to_string(counter) + "]";
+        ctx.source << "\t\t\tcase " << field_key(it) << ": " << first;
+        if (wire_type(it) == 2)
+            ctx.source << "++" << count << "; break;\n";
+        else
+        {
+            // packed block
+            ctx.source << "\n\t\t\t{\n"
+                << "\t\t\t\tconst uint8_t *p = ptr;\n"
+                << "\t\t\t\tsize_t n;\n"
+                << "\t\t\t\tif (!protop_wire::read_length(p, end, n)) { state_ = -1; return; }\n";
+            if (wire_type(it) == 0)
+                ctx.source << "\t\t\t\tfor (size_t i = 0; i < n; ++i) if (p[i] < 0x80) ++" << count << ";\n";
+            else
+                ctx.source << "\t\t\t\t" << count << " += (uint32_t) (n / " << (wire_type(it) == 1 ? 8 : 4) << ");\n";
+            ctx.source << "\t\t\t\tbreak;\n\t\t\t}\n";
+            ctx.source << "\t\t\tcase " << ((it->index << 3) | wire_type(it)) << ": " << first
+                << "++" << count << "; break;\n";
+        }
+        ++slot;
+        ++counter;
+    }
+    ctx.source << "\t\t\tdefault: break;\n"
+        << "\t\t}\n"
+        << "\t\tif (!protop_wire::skip(ptr, end, (int) (key & 7))) { state_ = -1; return; }\n"
+        << "\t}\n}\n";
+
+    slot = 0;
+    for (auto it : message->fields)
+    {
+        if (it->type.repeated)
+        {
+            ++slot;
+            continue;
+        }
+        std::string type = view_type(it);
+        ctx.source << type << ' ' << name << "::" << it->name << "() const\n{\n"
+            << "\tif (state_ == 0) view_index_();\n"
+            << "\tif (pos_[" << slot << "] == 0) return " << type << "();\n"
+            << "\tconst uint8_t *ptr = (const uint8_t*) data_ + pos_[" << slot << "] - 1;\n"
+            << "\tconst uint8_t *end = (const uint8_t*) data_ + size_;\n";
+        if (wire_type(it) == 2)
+            ctx.source << "\tsize_t n;\n"
+                << "\tif (!protop_wire::read_length(ptr, end, n)) return " << type << "();\n"
+                << "\treturn " << view_value(it) << ";\n";
+        else
+            ctx.source << '\t' << read_value(it, "return ", "", "return " + type + "()") << '\n';
+        ctx.source << "}\n";
+        ++slot;
+    }
+}
+
+// estimated layout of a member (LP64 with libstdc++)
+static Layout member_layout( Context &ctx, std::shared_ptr<Field> field, bool original )
+{
+    // 'std::pmr' containers also keep the allocator
+    size_t extra = ctx.options.pmr ? 8 : 0;
+    if (field->type.repeated) return Layout{24 + extra, 8};
+    if (field->type.mref != nullptr)
+    {
+        auto &layouts = original ? ctx.original_layouts : ctx.layouts;
+        auto it = layouts.find(field->type.mref->name);
+        if (it != layouts.end()) return it->second;
+        return Layout{8, 8};
+    }
+    if (field->type.eref != nullptr) return Layout{4, 4};
+    switch (field->type.id)
+    {
+        case TYPE_BOOL:
+            return Layout{1, 1};
+        case TYPE_FLOAT:
+        case TYPE_INT32:
+        case TYPE_UINT32:
+        case TYPE_SINT32:
+        case TYPE_FIXED32:
+        case TYPE_SFIXED32:
+            return Layout{4, 4};
+        case TYPE_STRING:
+        case TYPE_BYTES:
+            return Layout{32 + extra, 8};
+        default:
+            return Layout{8, 8};
+    }
+}
+
+static Layout struct_layout( Context &ctx, const std::vector<std::shared_ptr<Field>> &fields, bool original )
+{
+    Layout result{0, 1};
+    std::vector<Layout> members;
+    for (auto it : fields) members.push_back(member_layout(ctx, it, original));
+    // 'cached_size_' and 'cached_hash_'
+    members.push_back(Layout{8, 8});
+    if (ctx.options.cached_hash) members.push_back(Layout{8, 8});
+    for (auto &item : members)
+    {
+        result.size = (result.size + item.align - 1) / item.align * item.align + item.size;
+        result.align = std::max(result.align, item.align);
+    }
+    result.size = (result.size + result.align - 1) / result.align * result.align;
+    return result;
+}
+
+static bool is_hot( std::shared_ptr<Field> field )
+{
+    auto it = field->options.find("(protop.hot)");
+    return it != field->options.end() && it->second.value == "true";
+}
+
+/*
+ * Order in which members are declared. With 'pack_fields', fields flagged with
+ * '(protop.hot) = true' come first and the rest are sorted by alignment and size
+ * to minimize padding. The wire format and conversion code are not affected.
+ */
+static std::vector<std::shared_ptr<Field>> member_order( Context &ctx, std::shared_ptr<Message> message )
+{
+    std::vector<std::shared_ptr<Field>> fields(message->fields.begin(), message->fields.end());
+    Layout original = struct_layout(ctx, fields, true);
+    ctx.original_layouts[message->name] = original;
+    ctx.layouts[message->name] = original;
+    if (!ctx.options.pack_fields) return fields;
+
+    std::stable_sort(fields.begin(), fields.end(),
+        [&ctx](const std::shared_ptr<Field> &a, const std::shared_ptr<Field> &b)
+        {
+            if (is_hot(a) != is_hot(b)) return is_hot(a);
+            Layout la = member_layout(ctx, a, false);
+            Layout lb = member_layout(ctx, b, false);
+            if (la.align != lb.align) return la.align > lb.align;
+            return la.size > lb.size;
+        });
+    Layout packed = struct_layout(ctx, fields, false);
+    ctx.layouts[message->name] = packed;
+
+    std::cout << "Layout: " << message->name << " " << original.size << " -> " << packed.size << " bytes";
+    if (packed.size < original.size)
+        std::cout << " (saves " << original.size - packed.size << ")";
+    std::cout << '\n';
+    return fields;
+}
+
+// whether the member is constructed with the allocator
+static bool uses_allocator( std::shared_ptr<Field> field )
+{
+    return field->type.repeated || field->type.mref != nullptr || field->type.id == TYPE_STRING ||
+        field->type.id == TYPE_BYTES;
+}
+
+/*
+ * Allocator-aware constructors. Containers of messages construct their items
+ * with their own allocator through these, so the whole object graph uses the
+ * memory resource given to the outermost message.
+ */
+static void generate_pmr_constructors( Context &ctx, std::shared_ptr<Message> message )
+{
+    const std::string &name = message->name;
+    const auto &members = ctx.members[name];
+    bool any = std::any_of(members.begin(), members.end(), uses_allocator);
+
+    ctx.header << "\ttypedef std::pmr::polymorphic_allocator<char> allocator_type;\n";
+    for (int kind = 0; kind < 3; ++kind)
+    {
+        if (kind == 0)
+            ctx.header << "\texplicit " << name << "( const allocator_type &alloc )";
+        else
+        if (kind == 1)
+            ctx.header << "\t" << name << "( const " << name << " &that, const allocator_type &alloc )";
+        else
+            ctx.header << "\t" << name << "( " << name << " &&that, const allocator_type &alloc )";
+        const char *separator = " : ";
+        for (auto it : members)
+        {
+            if (kind == 0 && !uses_allocator(it)) continue;
+            ctx.header << separator << it->name << '(';
+            separator = ", ";
+            if (kind == 0)
+                ctx.header << "alloc)";
+            else
+            if (!uses_allocator(it))
+                ctx.header << "that." << it->name << ')';
+            else
+            if (kind == 1)
+                ctx.header << "that." << it->name << ", alloc)";
+            else
+                ctx.header << "std::move(that." << it->name << "), alloc)";
+        }
+        if (kind > 0 && members.empty()) ctx.header << " { (void) that; (void) alloc; }\n";
+        else
+        if (!any)
+            ctx.header << " { (void) alloc; }\n";
+        else
+            ctx.header << " {}\n";
+    }
+    ctx.header << "\t" << name << "( const " << ctx.grpcns << "::" << name
+        << " &that, const allocator_type &alloc ) : " << name << "(alloc) { this->from_grpc(that); }\n";
+}
+
 static void generate_message_decl( Context &ctx, std::shared_ptr<Message> message )
 {
     ctx.header << "struct " << message->name << "\n{" << '\n';
 
     // fields
-    for (auto it : message->fields) generate_field(ctx, it);
+    for (auto it : ctx.members[message->name]) generate_field(ctx, it);
     // functions
     ctx.header << "\n\t" << message->name << "() = default;\n";
     ctx.header << "\t" << message->name << "( " << message->name << "&& ) = default;\n";
     ctx.header << "\t" << message->name << "( const " << message->name << "& ) = default;\n";
     ctx.header << "\t" << message->name << "( const " << ctx.grpcns << "::" << message->name << "& that ) { this->from_grpc(that); };\n";
+    ctx.header << "\t" << message->name << "( " << ctx.grpcns << "::" << message->name << "&& that ) { this->from_grpc(std::move(that)); };\n";
+    if (ctx.options.pmr) generate_pmr_constructors(ctx, message);
     ctx.header << "\tbool operator!=( const " << message->name << "& ) const;\n";
     ctx.header << "\tbool operator==( const " << message->name << "& ) const;\n";
     ctx.header << "\t" << message->name << " &operator=( const " << message->name << "& ) = default;\n";
+    ctx.header << "\t" << message->name << " &operator=( " << message->name << "&& ) = default;\n";
     ctx.header << "\t" << message->name << " &operator=( const " << ctx.grpcns << "::" << message->name << "& that ) { this->from_grpc(that); return *this; };\n";
+    ctx.header << "\t" << message->name << " &operator=( " << ctx.grpcns << "::" << message->name << "&& that ) { this->from_grpc(std::move(that)); return *this; };\n";
     ctx.header << "\tvoid to_grpc( " << ctx.grpcns << "::" << message->name << "& ) const;\n";
     ctx.header << "\tvoid from_grpc( const " << ctx.grpcns << "::" << message->name << "& );\n";
+    ctx.header << "\tvoid from_grpc( " << ctx.grpcns << "::" << message->name << "&& );\n";
+    ctx.header << "\t// keeps the capacity of strings and containers ('parse' also keeps the items)\n";
+    ctx.header << "\tvoid clear();\n";
+    ctx.header << "\tsize_t byte_size() const;\n";
+    ctx.header << "\tvoid serialize( std::string& ) const;\n";
+    ctx.header << "\tbool parse( const char*, size_t );\n";
+    // wire format internals
+    ctx.header << "\tuint8_t *serialize_to( uint8_t* ) const;\n";
+    ctx.header << "\tbool merge_from( const uint8_t*, const uint8_t* );\n";
+    ctx.header << "\tbool read_from( const uint8_t*, const uint8_t*, bool merge );\n";
+    ctx.header << "\tmutable size_t cached_size_ = 0;\n";
+    // hashing
+    ctx.header << "\tsize_t hash() const;\n";
+    if (ctx.options.cached_hash)
+    {
+        ctx.header << "\t// must be called after changing fields directly\n";
+        ctx.header << "\tvoid invalidate_hash() { cached_hash_ = 0; }\n";
+        ctx.header << "\tmutable size_t cached_hash_ = 0;\n";
+    }
 
     ctx.header << "};" << '\n';
 }
 
-static void generate_source( Context &ctx, Proto &proto )
+/*
+ * Field table of a message as a 'protop_meta::message_info' specialization. The
+ * table has an entry for each field in declaration order and 'for_each_field'
+ * calls the visitor with the member pointer of each one.
+ */
+static void generate_meta( Context &ctx, std::shared_ptr<Message> message )
+{
+    std::string type;
+    for (auto item : ctx.nspace) type += "::" + item;
+    type += "::" + message->name;
+    size_t count = message->fields.size();
+
+    ctx.header << "template<int N> struct message_info<" << type << ", N>\n{\n";
+    ctx.header << "\ttypedef " << type << " type;\n";
+    ctx.header << "\tstatic constexpr const char *name() { return \"" << message->qname << "\"; }\n";
+    ctx.header << "\tstatic constexpr size_t field_count = " << count << ";\n";
+    // arrays cannot be empty, so messages without fields have a placeholder entry
+    ctx.header << "\tstatic constexpr field_info fields[" << std::max(count, (size_t) 1) << "] =\n\t{\n";
+    for (auto it : message->fields)
+    {
+        const char *name = "MESSAGE";
+        std::string link = "nullptr";
+        if (it->type.id >= TYPE_DOUBLE && it->type.id <= TYPE_BYTES)
+            name = META_TYPES[it->type.id - TYPE_DOUBLE];
+        else
+        if (it->type.eref != nullptr)
+        {
+            name = "ENUM";
+            link = '"' + it->type.eref->qname + '"';
+        }
+        else
+        if (it->type.mref != nullptr)
+            link = '"' + it->type.mref->qname + '"';
+        ctx.header << "\t\t{ \"" << it->name << "\", " << it->index << ", field_type::" << name << ", "
+            << (it->type.repeated ? "true" : "false") << ", " << link << " },\n";
+    }
+    if (count == 0) ctx.header << "\t\t{ nullptr, 0, field_type::INT32, false, nullptr },\n";
+    ctx.header << "\t};\n";
+    ctx.header << "\ttemplate<class F> static void for_each_field( F &&visitor )\n\t{\n";
+    if (count == 0) ctx.header << "\t\t(void) visitor;\n";
+    size_t index = 0;
+    for (auto it : message->fields)
+    {
+        ctx.header << "\t\tvisitor(field<type, decltype(type::" << it->name << ")>{fields[" << index++ << "], &type::"
+            << it->name << "});\n";
+    }
+    ctx.header << "\t}\n};\n";
+    ctx.header << "#if __cplusplus < 201703L\n";
+    ctx.header << "template<int N> constexpr field_info message_info<" << type << ", N>::fields[];\n";
+    ctx.header << "template<int N> constexpr size_t message_info<" << type << ", N>::field_count;\n";
+    ctx.header << "#endif\n";
+}
+
+/*
+ * Calls 'generate' for each message and appends the output to the header or the
+ * source in the order of 'proto.messages'. With more than one job, messages are
+ * rendered by a pool of threads, each one with its own copy of the context and
+ * its own buffers, and the result is identical to the serial output.
+ */
+template<typename F>
+static void generate_messages( Context &ctx, Proto &proto, bool header, F generate )
+{
+    std::vector<std::shared_ptr<Message>> messages(proto.messages.begin(), proto.messages.end());
+    size_t jobs = std::min((size_t) std::max(ctx.options.jobs, 1), messages.size());
+    if (jobs <= 1)
+    {
+        for (auto it : messages) generate(ctx, it);
+        return;
+    }
+
+    std::vector<CodeWriter> results(messages.size());
+    std::vector<std::exception_ptr> errors(jobs);
+    std::atomic<size_t> next(0);
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < jobs; ++i)
+    {
+        threads.emplace_back([&, i]()
+        {
+            try
+            {
+                CodeWriter hbuffer, sbuffer;
+                Context local{hbuffer, sbuffer, ctx.ifname, ctx.phname, ctx.grpcns, ctx.nspace, ctx.options,
+                    ctx.original_layouts, ctx.layouts, ctx.members};
+                CodeWriter &buffer = header ? hbuffer : sbuffer;
+                size_t index;
+                while ((index = next++) < messages.size())
+                {
+                    generate(local, messages[index]);
+                    results[index].swap(buffer);
+                }
+            } catch (...)
+            {
+                errors[i] = std::current_exception();
+            }
+        });
+    }
+    for (auto &it : threads) it.join();
+    for (auto &it : errors)
+        if (it) std::rethrow_exception(it);
+
+    CodeWriter &out = header ? ctx.header : ctx.source;
+    for (auto &it : results) out.write(it.data(), it.size());
+}
+
+static void generate_source_begin( Context &ctx )
 {
     ctx.source << "#include \"" << ctx.ifname << "\"\n";
+    ctx.source << "#include <cstring>\n";
 
     // begin prettify namespace
     for (auto item : ctx.nspace)
         ctx.source << "namespace " << item << "{\n";
     // templates
     ctx.source << TEMPLATES << '\n';
-    // functions
-    for (auto it : proto.messages)
-    {
-        generate_operators(ctx, it);
-        generate_from_grpc(ctx, it);
-        generate_to_grpc(ctx, it);
-    }
+    ctx.source << HASH_HELPERS << '\n';
+    if (!ctx.options.views) ctx.source << WIRE_HELPERS << '\n';
+}
+
+static void generate_source_end( Context &ctx )
+{
     // end prettify namespace
     for (auto item : ctx.nspace)
         ctx.source << "} // namespace " << item << "\n";
 }
 
+static void generate_message_source( Context &ctx, std::shared_ptr<Message> message )
+{
+    generate_operators(ctx, message);
+    generate_hash(ctx, message);
+    generate_clear(ctx, message);
+    generate_from_grpc(ctx, message, false);
+    generate_from_grpc(ctx, message, true);
+    generate_to_grpc(ctx, message);
+    generate_byte_size(ctx, message);
+    generate_serialize(ctx, message);
+    generate_parse(ctx, message);
+    if (ctx.options.views) generate_view(ctx, message);
+}
+
+static void generate_source( Context &ctx, Proto &proto )
+{
+    generate_source_begin(ctx);
+    generate_messages(ctx, proto, false, generate_message_source);
+    generate_source_end(ctx);
+}
+
+// message of this file used as the request or response of a procedure
+static std::shared_ptr<Message> find_message( Proto &proto, const TypeInfo &type )
+{
+    for (auto it : proto.messages)
+        if (it->qname == type.name || it->qname == type.package + '.' + type.name) return it;
+    return nullptr;
+}
+
+// adapters need the facade of the message, so only messages of this file can be streamed
+static std::shared_ptr<Message> find_streamed( Proto &proto, const Service &service, const Procedure &proc,
+    const TypeInfo &type )
+{
+    auto message = find_message(proto, type);
+    if (message == nullptr)
+        throw std::runtime_error("Streamed type '" + type.name + "' of '" + service.qname + "." + proc.name +
+            "' is not a message of this file");
+    return message;
+}
+
+static void generate_stream_types( Context &ctx, const std::string &prefix, std::shared_ptr<Message> message )
+{
+    std::string args = message->name + ", " + ctx.grpcns + "::" + message->name;
+    ctx.header << "typedef protop_stream::reader<" << args << "> " << prefix << "Reader;\n";
+    ctx.header << "typedef protop_stream::writer<" << args << "> " << prefix << "Writer;\n";
+}
+
+/*
+ * Batching adapters for the streamed side of each procedure. For a procedure
+ * 'Upload' of the service 'Store' with a streamed request, the adapters are
+ * 'StoreUploadRequestReader' and 'StoreUploadRequestWriter'.
+ */
+static void generate_streams( Context &ctx, Proto &proto )
+{
+    for (auto service : proto.services)
+    {
+        for (auto proc : service->procs)
+        {
+            auto request = proc->requestStream ? find_streamed(proto, *service, *proc, proc->request) : nullptr;
+            auto response = proc->responseStream ? find_streamed(proto, *service, *proc, proc->response) : nullptr;
+            if (request == nullptr && response == nullptr) continue;
+            ctx.header << "// rpc " << proc->name << "(" << (proc->requestStream ? "stream " : "") << proc->request.name
+                << ") returns (" << (proc->responseStream ? "stream " : "") << proc->response.name << ")\n";
+            if (request != nullptr) generate_stream_types(ctx, service->name + proc->name + "Request", request);
+            if (response != nullptr) generate_stream_types(ctx, service->name + proc->name + "Response", response);
+        }
+    }
+}
+
+static uint32_t path_hash( uint32_t seed, const std::string &path )
+{
+    uint32_t hash = seed;
+    for (char c : path) hash = (hash ^ (uint8_t) c) * 16777619U;
+    return hash;
+}
+
+/*
+ * Finds a seed for 'path_hash' that maps every path to a distinct slot of a
+ * table with a power of two size. The table grows if no seed is found, up to
+ * 'MAX_DISPATCH_SLOTS'. Paths must be unique.
+ */
+static bool perfect_hash( const std::vector<std::string> &paths, uint32_t &result, size_t &size )
+{
+    size = 1;
+    while (size < paths.size()) size <<= 1;
+    for (; size <= MAX_DISPATCH_SLOTS; size <<= 1)
+    {
+        std::vector<bool> used(size);
+        for (uint32_t seed = 2166136261U, tries = 0; tries < 0x10000; ++seed, ++tries)
+        {
+            std::fill(used.begin(), used.end(), false);
+            size_t i = 0;
+            for (; i < paths.size(); ++i)
+            {
+                size_t slot = path_hash(seed, paths[i]) & (size - 1);
+                if (used[slot]) break;
+                used[slot] = true;
+            }
+            if (i == paths.size())
+            {
+                result = seed;
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+/*
+ * Routing table of a service. Method paths ('/package.Service/Method') are
+ * mapped to a dense index by a perfect hash computed here, so 'find' costs one
+ * hash and one comparison. Unary methods whose types are messages of this file
+ * get a handler slot that 'call' uses with the serialized request.
+ */
+static void generate_dispatch( Context &ctx, Proto &proto, std::shared_ptr<Service> service )
+{
+    std::vector<std::shared_ptr<Procedure>> procs(service->procs.begin(), service->procs.end());
+    std::vector<std::string> paths;
+    std::set<std::string> unique;
+    for (auto it : procs)
+    {
+        paths.push_back("/" + service->qname + "/" + it->name);
+        if (!unique.insert(it->name).second)
+            throw std::runtime_error("Duplicate method '" + it->name + "' in service '" + service->qname + "'");
+    }
+    size_t size;
+    uint32_t seed;
+    if (!perfect_hash(paths, seed, size))
+        throw std::runtime_error("Unable to build the dispatch table of service '" + service->qname + "'");
+    std::vector<int> slots(size, -1);
+    for (size_t i = 0; i < paths.size(); ++i) slots[path_hash(seed, paths[i]) & (size - 1)] = (int) i;
+
+    std::string name = service->name + "Dispatch";
+    // message types are qualified since method names may hide them
+    std::string prefix;
+    for (auto item : ctx.nspace) prefix += "::" + item;
+    prefix += "::";
+    ctx.header << "struct " << name << "\n{\n";
+    ctx.header << "\tenum method {";
+    for (size_t i = 0; i < procs.size(); ++i)
+        ctx.header << (i == 0 ? " " : ", ") << procs[i]->name;
+    ctx.header << (procs.empty() ? "" : " ") << "};\n";
+    ctx.header << "\tstatic const int method_count = " << procs.size() << ";\n";
+    // paths
+    ctx.header << "\tstatic const char *path( int index )\n\t{\n"
+        << "\t\tstatic const char *const paths[] = {";
+    for (size_t i = 0; i < paths.size(); ++i)
+        ctx.header << (i == 0 ? " \"" : ", \"") << paths[i] << '"';
+    ctx.header << (paths.empty() ? " nullptr };\n" : " };\n")
+        << "\t\treturn index >= 0 && index < method_count ? paths[index] : nullptr;\n\t}\n";
+    // lookup
+    ctx.header << "\t// index of the method with the given path or -1\n";
+    ctx.header << "\tstatic int find( const char *path, size_t size )\n\t{\n";
+    ctx.header << "\t\tstatic const int16_t slots[" << size << "] = {";
+    for (size_t i = 0; i < size; ++i) ctx.header << (i == 0 ? " " : ", ") << slots[i];
+    ctx.header << " };\n\t\tstatic const uint16_t sizes[] = {";
+    for (size_t i = 0; i < paths.size(); ++i) ctx.header << (i == 0 ? " " : ", ") << paths[i].size();
+    ctx.header << (paths.empty() ? " 0 };\n" : " };\n");
+    ctx.header << "\t\tuint32_t h = " << seed << "U;\n"
+        << "\t\tfor (size_t i = 0; i < size; ++i) h = (h ^ (uint8_t) path[i]) * 16777619U;\n"
+        << "\t\tint index = slots[h & " << size - 1 << "U];\n"
+        << "\t\tif (index < 0 || sizes[index] != size || std::memcmp(" << name << "::path(index), path, size) != 0) return -1;\n"
+        << "\t\treturn index;\n\t}\n";
+    // handlers
+    std::vector<std::pair<std::shared_ptr<Message>, std::shared_ptr<Message>>> types;
+    for (auto it : procs)
+    {
+        std::shared_ptr<Message> request, response;
+        if (!it->requestStream && !it->responseStream)
+        {
+            request = find_message(proto, it->request);
+            response = find_message(proto, it->response);
+        }
+        if (request == nullptr || response == nullptr) request = response = nullptr;
+        types.emplace_back(request, response);
+        if (request != nullptr)
+            ctx.header << "\tstd::function<bool( const " << prefix << request->name << "&, " << prefix << response->name << "& )> on_"
+                << it->name << ";\n";
+    }
+    ctx.header << "\t// parse the request, call the handler and serialize the response into 'out'; returns\n"
+        << "\t// false for unknown methods, methods without a handler and malformed requests\n"
+        << "\tbool call( int index, const char *data, size_t size, std::string &out ) const\n\t{\n"
+        << "\t\tswitch (index)\n\t\t{\n";
+    for (size_t i = 0; i < procs.size(); ++i)
+    {
+        if (types[i].first == nullptr) continue;
+        std::string slot = "on_" + procs[i]->name;
+        ctx.header << "\t\t\tcase " << procs[i]->name << ":\n\t\t\t{\n"
+            << "\t\t\t\t" << prefix << types[i].first->name << " request;\n"
+            << "\t\t\t\t" << prefix << types[i].second->name << " response;\n"
+            << "\t\t\t\tif (!" << slot << " || !request.parse(data, size) || !" << slot << "(request, response)) return false;\n"
+            << "\t\t\t\tresponse.serialize(out);\n"
+            << "\t\t\t\treturn true;\n\t\t\t}\n";
+    }
+    ctx.header << "\t\t\tdefault:\n\t\t\t\t(void) data;\n\t\t\t\t(void) size;\n\t\t\t\t(void) out;\n\t\t\t\treturn false;\n\t\t}\n\t}\n"
+        << "\tbool call( const std::string &path, const char *data, size_t size, std::string &out ) const\n\t{\n"
+        << "\t\treturn call(find(path.data(), path.size()), data, size, out);\n\t}\n";
+    ctx.header << "};\n";
+}
+
 static void generate_header( Context &ctx, Proto &proto )
 {
     auto sentinel = proto.package;
@@ -296,8 +1684,16 @@ static void generate_header( Context &ctx, Proto &proto )
 
     ctx.header << "#include <stdint.h>\n";
     ctx.header << "#include <string>\n";
-    ctx.header << "#include <list>\n";
+    ctx.header << "#include <vector>\n";
+    ctx.header << "#include <utility>\n";
     ctx.header << "#include <memory>\n";
+    ctx.header << "#include <functional>\n";
+    if (ctx.options.pmr)
+        ctx.header << "#include <memory_resource>\n";
+    if (ctx.options.views)
+        ctx.header << "#include <string_view>\n";
+    if (ctx.options.views || ctx.options.dispatch)
+        ctx.header << "#include <cstring>\n";
     ctx.header << "#include \"" << ctx.phname << "\"\n";
 
     ctx.nspace = split_package(proto.package);
@@ -313,17 +1709,53 @@ static void generate_header( Context &ctx, Proto &proto )
     for (auto item : ctx.nspace)
         ctx.header << "} // namespace " << item << "\n";
 #endif
+    // stream adapters
+    bool streams = false;
+    for (auto service : proto.services)
+        for (auto proc : service->procs) streams |= proc->requestStream || proc->responseStream;
+    if (streams) ctx.header << STREAM_HELPERS;
     // begin prettify namespace
     ctx.nspace.back().append("_");
     for (auto item : ctx.nspace)
         ctx.header << "namespace " << item << "{\n";
     // forward declarations
     for (auto it : proto.messages) print_forward(ctx, it);
+    // member order (the layout of each message depends on the messages it contains)
+    for (auto it : proto.messages) ctx.members[it->name] = member_order(ctx, it);
     // messages
-    for (auto it : proto.messages) generate_message_decl(ctx, it);
+    generate_messages(ctx, proto, true, generate_message_decl);
+    // views (the wire helpers are needed by inline functions)
+    if (ctx.options.views)
+    {
+        ctx.header << WIRE_HELPERS;
+        generate_messages(ctx, proto, true, generate_view_decl);
+    }
+    if (streams) generate_streams(ctx, proto);
+    if (ctx.options.dispatch)
+    {
+        for (auto it : proto.services) generate_dispatch(ctx, proto, it);
+    }
     // end prettify namespace
     for (auto item : ctx.nspace)
         ctx.header << "} // namespace " << item << "\n";
+    // hash specializations
+    std::string prettyns;
+    for (auto item : ctx.nspace) prettyns += "::" + item;
+    ctx.header << "namespace std {\n";
+    for (auto it : proto.messages)
+    {
+        ctx.header << "template<> struct hash<" << prettyns << "::" << it->name << ">\n{\n"
+            << "\tsize_t operator()( const " << prettyns << "::" << it->name << " &value ) const { return value.hash(); }\n};\n";
+    }
+    ctx.header << "} // namespace std\n";
+    // field tables
+    if (ctx.options.meta)
+    {
+        ctx.header << META_HELPERS;
+        ctx.header << "namespace protop_meta {\n";
+        generate_messages(ctx, proto, true, generate_meta);
+        ctx.header << "} // namespace protop_meta\n";
+    }
 
     ctx.header << "#endif // " << sentinel << "_header\n";
 }
@@ -352,39 +1784,250 @@ static std::string filename( const std::string &name, bool ext = true )
     return out;
 }
 
+// field names in declaration order and in member order
+static void append_order( Context &ctx, std::shared_ptr<Message> message, std::string &text )
+{
+    text += '|' + message->qname + ':';
+    for (auto it : message->fields) text += it->name + ',';
+    text += ':';
+    for (auto it : ctx.members[message->name]) text += it->name + ',';
+}
+
+/*
+ * First line of a generated source file. It identifies the generator version
+ * and options, the structural fingerprint of the entities and the order of the
+ * fields and members (the fingerprint ignores declaration order, but the views
+ * and the layout depend on it), so the file is only regenerated when one of them
+ * changes. Unchanged files are still not rewritten.
+ */
+static std::string generation_key( Context &ctx, uint64_t fingerprint, Proto &proto,
+    std::shared_ptr<Message> message )
+{
+    std::string text = std::to_string(GENERATOR_VERSION) + '|' + ctx.ifname + '|' + ctx.phname + '|'
+        + (ctx.options.pack_fields ? 'p' : '-') + (ctx.options.cached_hash ? 'h' : '-')
+        + (ctx.options.views ? 'v' : '-') + (ctx.options.pmr ? 'r' : '-') + (ctx.options.meta ? 'm' : '-')
+        + (ctx.options.dispatch ? 'd' : '-') + '|' + std::to_string(fingerprint);
+    if (message != nullptr)
+        append_order(ctx, message, text);
+    else
+        for (auto it : proto.messages) append_order(ctx, it, text);
+    uint64_t hash = 14695981039346656037ULL;
+    for (char c : text)
+    {
+        hash ^= (uint8_t) c;
+        hash *= 1099511628211ULL;
+    }
+    char buffer[64];
+    snprintf(buffer, sizeof(buffer), "// fingerprint: %016llx\n", (unsigned long long) hash);
+    return buffer;
+}
+
+static std::string first_line( const std::string &path )
+{
+    std::ifstream input(path);
+    std::string line;
+    if (!input.good() || !std::getline(input, line)) return "";
+    return line + '\n';
+}
+
+// content after the first line
+static std::string body( const char *data, size_t size )
+{
+    auto end = data + size;
+    auto pos = std::find(data, end, '\n');
+    return (pos == end) ? "" : std::string(pos + 1, end);
+}
+
+/*
+ * Writes 'content' only if the file does not have the same bytes, so its
+ * modification time is preserved. The file is replaced with an atomic rename.
+ * With 'keyed', the first line (the generation key) is not compared: a new key
+ * alone does not change the code, so it is not worth triggering a rebuild.
+ */
+static bool write_if_changed( const std::string &path, const CodeWriter &content, bool keyed = false )
+{
+    std::ifstream input(path, std::ios::binary);
+    if (input.good())
+    {
+        std::stringstream ss;
+        ss << input.rdbuf();
+        std::string current = ss.str();
+        if ((current.size() == content.size() && std::equal(current.begin(), current.end(), content.data())) ||
+            (keyed && body(current.data(), current.size()) == body(content.data(), content.size())))
+            return true;
+    }
+    input.close();
+
+    std::string temp = path + ".tmp";
+    if (!content.writeFile(temp) || rename(temp.c_str(), path.c_str()) != 0)
+    {
+        remove(temp.c_str());
+        std::cerr << "Unable to write '" << path << "'\n";
+        return false;
+    }
+    std::cout << "Updated: " << path << '\n';
+    return true;
+}
+
+// generate a source file unless it is up to date
+static bool update_source( Context &ctx, const std::string &path, uint64_t fingerprint, Proto &proto,
+    std::shared_ptr<Message> message )
+{
+    std::string key = generation_key(ctx, fingerprint, proto, message);
+    if (first_line(path) == key) return true;
+
+    CodeWriter content;
+    ctx.source.swap(content);
+    ctx.source << key;
+    if (message == nullptr)
+        generate_source(ctx, proto);
+    else
+    {
+        generate_source_begin(ctx);
+        generate_message_source(ctx, message);
+        generate_source_end(ctx);
+    }
+    ctx.source.swap(content);
+    return write_if_changed(path, content, true);
+}
+
+/*
+ * The manifest lists the names of the sources written by the last run, one per
+ * line, and is kept next to the header. Sources listed there that are no longer
+ * generated (e.g. of a removed message, or after '--split' is dropped) are
+ * deleted. Only names without a directory are deleted, and only from the
+ * directory of the manifest.
+ */
+static bool update_manifest( const std::string &path, const std::vector<std::string> &sources )
+{
+    std::string directory = path.substr(0, path.size() - filename(path).size());
+    std::set<std::string> current;
+    for (auto &it : sources) current.insert(filename(it));
+
+    std::ifstream input(path);
+    std::string line;
+    while (std::getline(input, line))
+    {
+        if (line.empty() || line.find('/') != std::string::npos || current.count(line) > 0) continue;
+        std::string stale = directory + line;
+        if (remove(stale.c_str()) == 0) std::cout << "Removed: " << stale << '\n';
+    }
+    input.close();
+
+    CodeWriter content;
+    for (auto &it : current) content << it << '\n';
+    return write_if_changed(path, content);
+}
+
 int main( int argc, char **argv )
 {
-    if (argc != 4)
+    Options options{};
+    std::vector<std::string> args;
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (arg == "--pack-fields")
+            options.pack_fields = true;
+        else
+        if (arg == "--cached-hash")
+            options.cached_hash = true;
+        else
+        if (arg == "--views")
+            options.views = true;
+        else
+        if (arg == "--split")
+            options.split = true;
+        else
+        if (arg == "--meta")
+            options.meta = true;
+        else
+        if (arg == "--pmr")
+            options.pmr = true;
+        else
+        if (arg == "--dispatch")
+            options.dispatch = true;
+        else
+        if (arg.compare(0, 7, "--jobs=") == 0)
+        {
+            options.jobs = atoi(arg.c_str() + 7);
+            if (options.jobs <= 0) options.jobs = (int) std::thread::hardware_concurrency();
+        }
+        else
+        if (arg.compare(0, 2, "--") == 0)
+        {
+            std::cerr << "Unknown option '" << arg << "'\n";
+            return 1;
+        }
+        else
+            args.push_back(arg);
+    }
+
+    if (args.size() != 3)
     {
-        std::cerr << "Usage: example_grpc_facade <proto file> <header> <source>\n";
+        std::cerr << "Usage: example_grpc_facade [options] <proto file> <header> <source>\n"
+            << "Options:\n"
+            << "  --pack-fields  Reorder struct members to minimize padding\n"
+            << "  --cached-hash  Keep the hash value in each message\n"
+            << "  --views        Generate zero-copy views over serialized messages (C++17)\n"
+            << "  --split        Write the code of each message in its own source file\n"
+            << "  --meta         Generate constexpr field tables for each message\n"
+            << "  --pmr          Use std::pmr containers with allocator-aware constructors (C++17)\n"
+            << "  --dispatch     Generate perfect hash method dispatch tables for each service\n"
+            << "  --jobs=N       Generate code with N threads (0 means one per CPU)\n"
+            << "Files are only written if their content changed. The sources written are listed in\n"
+            << "'<header>.manifest' and sources no longer generated are deleted.\n";
         return 1;
     }
 
-    std::string hfname = argv[2];
+    std::string hfname = args[1];
     std::string sfname = hfname;
     if (hfname.empty() || hfname.back() == '/') hfname += "out.hh";
     std::string ifname = filename(hfname);
     sfname = replace_ext(hfname, ".cc");
-    std::string phname = filename(argv[1], false) + ".pb.h";
+    std::string phname = filename(args[0], false) + ".pb.h";
 
-    std::cout << " Proto: " << argv[1] << " (" << phname << ")\n";
+    std::cout << " Proto: " << args[0] << " (" << phname << ")\n";
     std::cout << "Header: " << hfname << " (" << ifname << ")\n";
-    std::cout << "Source: " << sfname << '\n';
+    if (options.split)
+        std::cout << "Source: " << replace_ext(hfname, "_<message>.cc") << '\n';
+    else
+        std::cout << "Source: " << sfname << '\n';
 
-    std::ifstream input(argv[1]);
+    std::ifstream input(args[0]);
     if (!input.good()) return 1;
 
-    std::ofstream header(hfname);
-    if (!header.good()) return 1;
-    std::ofstream source(sfname);
-    if (!source.good()) return 1;
-
-    Context context{header, source, ifname, phname, "", {} };
+    CodeWriter header;
+    CodeWriter source;
+    Context context{header, source, ifname, phname, "", {}, options, {}, {}, {} };
 
-    Proto tree;
-    Proto::parse(tree, input, argv[1]);
-    generate_header(context, tree);
-    generate_source(context, tree);
+    try
+    {
+        Proto tree;
+        Proto::parse(tree, input, args[0]);
+        computeFingerprints(tree);
+        // the header is always generated since the sources depend on its layout pass
+        generate_header(context, tree);
+        if (!write_if_changed(hfname, header)) return 1;
 
+        std::vector<std::string> sources;
+        if (!options.split)
+        {
+            if (!update_source(context, sfname, tree.fingerprint, tree, nullptr)) return 1;
+            sources.push_back(sfname);
+        }
+        else
+        {
+            for (auto it : tree.messages)
+            {
+                sources.push_back(replace_ext(hfname, "_" + it->name + ".cc"));
+                if (!update_source(context, sources.back(), it->fingerprint, tree, it)) return 1;
+            }
+        }
+        if (!update_manifest(replace_ext(hfname, ".manifest"), sources)) return 1;
+    } catch (std::exception &ex)
+    {
+        std::cerr << "Error: " << ex.what() << '\n';
+        return 1;
+    }
     return 0;
 }
\ No newline at end of file
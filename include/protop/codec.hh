@@ -0,0 +1,162 @@
+/*
+ * Copyright 2020-2022 Bruno Ribeiro <https://github.com/brunexgeek>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef PROTOP_CODEC_API
+#define PROTOP_CODEC_API
+
+#include <protop/protop.hh>
+#include <stdint.h>
+#include <vector>
+
+namespace protop {
+
+enum WireType
+{
+    WIRE_VARINT  = 0,
+    WIRE_FIXED64 = 1,
+    WIRE_LENGTH  = 2,
+    WIRE_FIXED32 = 5,
+};
+
+class MessageCodec;
+class DynamicMessage;
+
+/*
+ * Precompiled information about a message field. Everything the codec needs
+ * at runtime is resolved here, so decoding never looks at the parse tree.
+ */
+struct FieldCodec
+{
+    std::shared_ptr<Field> field;
+    int number = 0;
+    FieldType type = TYPE_INT32;
+    WireType wire = WIRE_VARINT;
+    bool repeated = false;
+    // repeated scalars are encoded as a single length-delimited block
+    bool packed = false;
+    // varint encoding of the field key (number and wire type)
+    uint8_t tag[5];
+    size_t tagSize = 0;
+    // nested message (if any)
+    const MessageCodec *message = nullptr;
+    // enumeration (if any)
+    std::shared_ptr<Enum> eref;
+    // index of the field in 'DynamicMessage::fields'
+    size_t slot = 0;
+};
+
+class MessageCodec
+{
+    public:
+        std::shared_ptr<Message> message;
+        std::vector<FieldCodec> fields;
+        // position in 'Codec::messages'
+        size_t index = 0;
+
+        MessageCodec( std::shared_ptr<Message> message );
+        const FieldCodec *find( int number ) const;
+        const FieldCodec *find( const std::string &name ) const;
+
+    private:
+        // field number to slot + 1 (zero means unknown field)
+        std::vector<uint16_t> dispatch_;
+        // used instead of 'dispatch_' when field numbers are too sparse
+        std::unordered_map<int, size_t> sparse_;
+
+        friend class Codec;
+};
+
+/*
+ * Compiles every message of a 'Proto' into a field number dispatch table. The
+ * 'Proto' must stay alive while the codec is in use.
+ */
+class Codec
+{
+    public:
+        Codec( const Proto &proto );
+        const MessageCodec *find( const std::string &qname ) const;
+        const std::list<std::shared_ptr<MessageCodec>> &messages() const { return messages_; }
+
+    private:
+        std::list<std::shared_ptr<MessageCodec>> messages_;
+        std::unordered_map<std::string, std::shared_ptr<MessageCodec>> names_;
+};
+
+/*
+ * Values of a single field. Numbers are kept as 64-bit words: signed integers
+ * are sign-extended, 'sint' values are already zigzag-decoded and floating
+ * point values are stored as their raw IEEE-754 bits.
+ */
+struct DynamicField
+{
+    std::vector<uint64_t> values;
+    std::vector<std::string> strings;
+    std::vector<std::shared_ptr<DynamicMessage>> messages;
+
+    size_t size() const { return values.size() + strings.size() + messages.size(); }
+    void clear();
+
+    int64_t getInt( size_t index = 0 ) const { return (int64_t) values[index]; }
+    uint64_t getUInt( size_t index = 0 ) const { return values[index]; }
+    bool getBool( size_t index = 0 ) const { return values[index] != 0; }
+    double getDouble( size_t index = 0 ) const;
+    float getFloat( size_t index = 0 ) const;
+
+    void addInt( int64_t value ) { values.push_back((uint64_t) value); }
+    void addUInt( uint64_t value ) { values.push_back(value); }
+    void addBool( bool value ) { values.push_back(value ? 1 : 0); }
+    void addDouble( double value );
+    void addFloat( float value );
+};
+
+class DynamicMessage
+{
+    public:
+        // one entry for each field in 'codec().fields'
+        std::vector<DynamicField> fields;
+        // unknown fields, kept verbatim so they are not lost when re-encoding
+        std::string unknown;
+
+        DynamicMessage( const MessageCodec &codec );
+        const MessageCodec &codec() const { return *codec_; }
+        DynamicField *field( int number );
+        DynamicField *field( const std::string &name );
+        const DynamicField *field( int number ) const;
+        const DynamicField *field( const std::string &name ) const;
+        // create a nested message and append it to the given field
+        DynamicMessage &addMessage( const FieldCodec &field );
+        void clear();
+
+        // merge the wire format content into the message (throws when nested
+        // messages are more than 100 levels deep)
+        void decode( const uint8_t *data, size_t size );
+        void decode( const std::string &data );
+        // append the wire format content to 'out'
+        void encode( std::string &out ) const;
+        size_t byteSize() const;
+
+    private:
+        const MessageCodec *codec_;
+
+        void decode( const uint8_t *data, size_t size, int depth );
+        // computes the size, appending the sizes of the nested messages (pre-order)
+        size_t measure( std::vector<size_t> &sizes ) const;
+        uint8_t *write( uint8_t *ptr, const size_t *&sizes ) const;
+};
+
+} // protop
+
+#endif // PROTOP_CODEC_API
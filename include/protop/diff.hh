@@ -0,0 +1,82 @@
+/*
+ * Copyright 2020-2022 Bruno Ribeiro <https://github.com/brunexgeek>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef PROTOP_DIFF_API
+#define PROTOP_DIFF_API
+
+#include <protop/protop.hh>
+#include <vector>
+
+namespace protop {
+
+enum class ChangeType
+{
+    MESSAGE_ADDED,
+    MESSAGE_REMOVED,
+    FIELD_ADDED,
+    FIELD_REMOVED,
+    // same field name with a different number
+    FIELD_RENUMBERED,
+    // same field name with a different type or cardinality
+    FIELD_RETYPED,
+    ENUM_ADDED,
+    ENUM_REMOVED,
+    CONSTANT_ADDED,
+    CONSTANT_REMOVED,
+    CONSTANT_CHANGED,
+    SERVICE_ADDED,
+    SERVICE_REMOVED,
+    PROCEDURE_ADDED,
+    PROCEDURE_REMOVED,
+    // same procedure name with a different request or response type
+    PROCEDURE_CHANGED,
+};
+
+struct Change
+{
+    ChangeType type;
+    // qualified name of the message, enumeration or service
+    std::string entity;
+    // name of the field, constant or procedure (empty for entity changes)
+    std::string member;
+    // description of the member before and after the change (e.g. "int32 = 2")
+    std::string before;
+    std::string after;
+};
+
+/*
+ * Computes the structural fingerprint of every message, enumeration and service
+ * and of the whole tree. Fingerprints are computed bottom-up: a message includes
+ * the fingerprints of the messages and enumerations its fields reference, so two
+ * entities with the same fingerprint have the same structure all the way down.
+ * Declaration order, comments and formatting do not affect fingerprints.
+ *
+ * The tree must be resolved (i.e. returned by 'Proto::parse').
+ */
+void computeFingerprints( Proto &tree );
+
+/*
+ * Lists the structural changes from 'before' to 'after'. Fingerprints are
+ * computed if needed and entities with equal fingerprints are not compared.
+ * Fields, constants and procedures are matched by name.
+ */
+std::vector<Change> diff( Proto &before, Proto &after );
+
+const char *changeName( ChangeType type );
+
+} // protop
+
+#endif // PROTOP_DIFF_API
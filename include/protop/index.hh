@@ -0,0 +1,107 @@
+/*
+ * Copyright 2020-2022 Bruno Ribeiro <https://github.com/brunexgeek>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef PROTOP_INDEX_API
+#define PROTOP_INDEX_API
+
+#include <protop/protop.hh>
+#include <vector>
+#include <stdint.h>
+
+namespace protop {
+
+enum class SymbolKind
+{
+    MESSAGE = 1,
+    ENUM = 2,
+    SERVICE = 3,
+};
+
+struct IndexedSymbol
+{
+    // qualified name
+    std::string name;
+    SymbolKind kind;
+    // declaring file, relative to the indexed directory
+    std::string file;
+};
+
+struct IndexStats
+{
+    // '.proto' files found in the directory tree
+    size_t files = 0;
+    // files parsed by this build (the others were reused from the old index)
+    size_t parsed = 0;
+    // files that could not be parsed (they are indexed without declarations)
+    size_t failed = 0;
+    size_t symbols = 0;
+    size_t references = 0;
+};
+
+/*
+ * Persistent index of the messages, enumerations and services declared in the
+ * '.proto' files of a directory tree and of the references between them (field
+ * types, requests and responses). The index file is memory-mapped and queried
+ * in place with binary searches, so queries never parse anything.
+ *
+ * The file uses the byte order of the machine that built it and is only
+ * available on POSIX systems.
+ */
+class RepositoryIndex
+{
+    public:
+        // map an index file created by 'build' (throws if the file is invalid)
+        RepositoryIndex( const std::string &path );
+        RepositoryIndex( const RepositoryIndex& ) = delete;
+        ~RepositoryIndex();
+        RepositoryIndex &operator=( const RepositoryIndex& ) = delete;
+
+        /*
+         * Creates or updates the index at 'path' for the directory 'root'. Files
+         * are only parsed when their size and modification time changed and
+         * their content hash differs from the one in the old index. References
+         * are resolved again in every build since they cross files. The new
+         * index replaces the old one atomically.
+         */
+        static IndexStats build( const std::string &root, const std::string &path );
+
+        // declaration of a qualified name
+        bool find( const std::string &name, IndexedSymbol &symbol ) const;
+        // declarations whose qualified names start with 'prefix'
+        std::vector<IndexedSymbol> search( const std::string &prefix ) const;
+        // declarations that reference the given one
+        std::vector<IndexedSymbol> references( const std::string &name ) const;
+        // declarations referenced by the given one
+        std::vector<IndexedSymbol> dependencies( const std::string &name ) const;
+        // declarations of a file (path relative to the indexed directory)
+        std::vector<IndexedSymbol> declarations( const std::string &file ) const;
+
+        std::string root() const;
+        size_t fileCount() const;
+        size_t symbolCount() const;
+
+    private:
+        const uint8_t *data_;
+        size_t size_;
+
+        IndexedSymbol symbol( uint32_t index ) const;
+        // index of the first symbol with the given name or -1
+        int64_t lookup( const std::string &name ) const;
+};
+
+} // protop
+
+#endif // PROTOP_INDEX_API
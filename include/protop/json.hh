@@ -0,0 +1,51 @@
+/*
+ * Copyright 2020-2022 Bruno Ribeiro <https://github.com/brunexgeek>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef PROTOP_JSON_API
+#define PROTOP_JSON_API
+
+#include <protop/codec.hh>
+
+namespace protop {
+
+struct JsonTables;
+
+/*
+ * Converts between the wire format and proto3 JSON without building any
+ * intermediate object. Field names and enumerations are mapped through tables
+ * computed once in the constructor.
+ *
+ * Both conversions write at most 'capacity' bytes into 'out' and return the
+ * number of bytes the complete output requires. If the returned value is larger
+ * than 'capacity', the output was truncated and the call must be repeated with
+ * a larger buffer.
+ */
+class JsonTranscoder
+{
+    public:
+        JsonTranscoder( const Codec &codec );
+        size_t toJson( const MessageCodec &message, const uint8_t *data, size_t size,
+            char *out, size_t capacity ) const;
+        size_t toBinary( const MessageCodec &message, const char *data, size_t size,
+            uint8_t *out, size_t capacity ) const;
+
+    private:
+        std::shared_ptr<JsonTables> tables_;
+};
+
+} // protop
+
+#endif // PROTOP_JSON_API
@@ -0,0 +1,96 @@
+/*
+ * Copyright 2020-2022 Bruno Ribeiro <https://github.com/brunexgeek>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef PROTOP_POOL_API
+#define PROTOP_POOL_API
+
+#include <protop/protop.hh>
+#include <map>
+#include <vector>
+
+namespace protop {
+
+struct PoolState;
+struct PoolIndex;
+
+/*
+ * Immutable view of a 'SchemaPool'. Snapshots share the nodes of the files that
+ * did not change, so they are cheap to keep around, and they can be used from
+ * any thread. The trees must not be modified.
+ */
+class SchemaSnapshot
+{
+    public:
+        SchemaSnapshot( std::shared_ptr<const PoolState> state );
+
+        // number of changes applied to the pool before the snapshot was taken
+        uint64_t version() const;
+        std::vector<std::string> files() const;
+        std::shared_ptr<const Proto> file( const std::string &name ) const;
+        // type names of a file that could not be resolved (as written)
+        std::vector<std::string> unresolved( const std::string &name ) const;
+
+        std::shared_ptr<const Message> message( const std::string &qname ) const;
+        std::shared_ptr<const Enum> enumeration( const std::string &qname ) const;
+        std::shared_ptr<const Service> service( const std::string &qname ) const;
+        // name of the file declaring a symbol (empty if not found)
+        std::string declaringFile( const std::string &qname ) const;
+
+    private:
+        std::shared_ptr<const PoolState> state_;
+};
+
+/*
+ * Set of parsed files linked through one symbol table. Field types, requests
+ * and responses are resolved across files following the scoping rules of
+ * protobuf; names that cannot be resolved yet are kept and resolved when a file
+ * declaring them is added.
+ *
+ * Adding, replacing or removing a file only re-resolves the declarations that
+ * reference a changed symbol. Those are copied before being modified, as are
+ * the declarations that reference the copies, so snapshots taken before the
+ * change remain valid. This class is not thread safe.
+ */
+class SchemaPool
+{
+    public:
+        SchemaPool();
+
+        /*
+         * Parses a file and adds it to the pool, replacing the file with the same
+         * name. Returns the names of the other files whose declarations were
+         * re-resolved. Throws if the file cannot be parsed or declares a symbol
+         * already declared by another file, or if messages would refer to each
+         * other in a cycle; the pool is not changed in those cases. A message may
+         * refer to itself, but that reference does not own the message.
+         */
+        std::vector<std::string> add( const std::string &name, std::istream &input );
+        // removes a file, returning the names of the files re-resolved
+        std::vector<std::string> remove( const std::string &name );
+
+        std::shared_ptr<const SchemaSnapshot> snapshot();
+
+    private:
+        std::shared_ptr<const PoolState> state_;
+        std::shared_ptr<PoolIndex> index_;
+        std::shared_ptr<const SchemaSnapshot> snapshot_;
+
+        std::vector<std::string> update( const std::string &name, std::shared_ptr<Proto> tree );
+};
+
+} // protop
+
+#endif // PROTOP_POOL_API
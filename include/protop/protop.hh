@@ -22,6 +22,7 @@
 #include <unordered_map>
 #include <iostream>
 #include <memory>
+#include <stdint.h>
 
 namespace protop {
 
@@ -63,7 +64,8 @@ enum class OptionType
     IDENTIFIER,
     STRING,
     INTEGER,
-    BOOLEAN
+    BOOLEAN,
+    REAL
 };
 
 struct OptionEntry
@@ -76,12 +78,47 @@ struct OptionEntry
 
 typedef std::unordered_map<std::string, OptionEntry> OptionMap;
 
+/*
+ * Location of a comment in the source (see 'Proto::comment'). A zero length
+ * means there is no comment.
+ */
+struct CommentSpan
+{
+    size_t offset = 0;
+    size_t length = 0;
+};
+
+/*
+ * Comments attached to a declaration when parsing with 'PARSE_COMMENTS'. The
+ * leading comment ends in the line right before the declaration; the trailing
+ * comment starts in the line the declaration (or its opening brace) ends.
+ */
+struct Comments
+{
+    CommentSpan leading;
+    CommentSpan trailing;
+};
+
+/*
+ * Location of a declaration body that was not parsed yet (see 'PARSE_LAZY').
+ * The span starts after the opening brace and includes the closing one. The
+ * line and column are the position of the opening brace.
+ */
+struct BodySpan
+{
+    size_t offset = 0;
+    size_t length = 0;
+    int line = 0;
+    int column = 0;
+};
+
 struct Field
 {
     TypeInfo type;
     std::string name;
     int index = 0;
     OptionMap options;
+    Comments comments;
 };
 
 struct Constant
@@ -97,6 +134,11 @@ struct Enum
     std::string name;
     std::string qname;
     OptionMap options;
+    Comments comments;
+    // pending body (only with 'PARSE_LAZY')
+    BodySpan body;
+    // structural fingerprint (see 'computeFingerprints')
+    uint64_t fingerprint = 0;
 };
 
 struct Message
@@ -105,6 +147,11 @@ struct Message
     std::string name;
     std::string qname;
     OptionMap options;
+    Comments comments;
+    // pending body (only with 'PARSE_LAZY')
+    BodySpan body;
+    // structural fingerprint (see 'computeFingerprints')
+    uint64_t fingerprint = 0;
 };
 
 struct Procedure
@@ -112,16 +159,94 @@ struct Procedure
     std::string name;
     TypeInfo request;
     TypeInfo response;
+    // whether the request or the response is a stream of messages
+    bool requestStream = false;
+    bool responseStream = false;
     OptionMap options;
+    Comments comments;
 };
 
 struct Service
 {
     std::string name;
+    std::string qname;
     std::list<std::shared_ptr<Procedure>> procs;
     OptionMap options;
+    // pending body (only with 'PARSE_LAZY')
+    BodySpan body;
+    // structural fingerprint (see 'computeFingerprints')
+    uint64_t fingerprint = 0;
 };
 
+// number of token kinds (token codes are in the range [0, PROTOP_TOKEN_KINDS))
+#define PROTOP_TOKEN_KINDS 51
+
+/*
+ * Statistics collected by 'Proto::parse' when requested. Times are in seconds;
+ * the parse time does not include the time spent in the tokenizer.
+ */
+struct ParseStats
+{
+    size_t bytes = 0;
+    size_t tokens = 0;
+    size_t tokenKinds[PROTOP_TOKEN_KINDS] = {};
+    // messages, fields, enumerations, constants, services and procedures
+    size_t nodes = 0;
+    double tokenizeTime = 0;
+    double parseTime = 0;
+    double resolveTime = 0;
+    double sortTime = 0;
+    // heap allocations reported through 'trackAllocation'
+    size_t allocations = 0;
+    size_t allocatedBytes = 0;
+
+    static const char *tokenName( int kind );
+};
+
+/*
+ * Reports a heap allocation to the statistics of the 'Proto::parse' running in
+ * the current thread, if any. Call it from a custom 'operator new' or allocator
+ * to count allocations made while parsing.
+ */
+void trackAllocation( size_t size );
+
+/*
+ * Receives the declarations found by 'Proto::parse' as they are parsed, without
+ * building a tree. Options declared inside a message, enumeration or service
+ * are reported between its begin and end events. Complex types are not
+ * resolved. The handler may move from the arguments.
+ */
+class ParseHandler
+{
+    public:
+        virtual ~ParseHandler() = default;
+        virtual void onSyntax( const std::string & ) {}
+        virtual void onPackage( const std::string & ) {}
+        virtual void onImport( const std::string & ) {}
+        virtual void onOption( OptionEntry & ) {}
+        virtual void onMessageBegin( Message & ) {}
+        virtual void onField( Field & ) {}
+        virtual void onMessageEnd() {}
+        virtual void onEnumBegin( Enum & ) {}
+        virtual void onEnumConstant( Constant & ) {}
+        virtual void onEnumEnd() {}
+        virtual void onServiceBegin( Service & ) {}
+        virtual void onRpc( Procedure & ) {}
+        virtual void onServiceEnd() {}
+};
+
+enum ParseFlags
+{
+    // keep the source and attach comments to declarations
+    PARSE_COMMENTS = 0x01,
+    // keep the source and only parse the declaration bodies when accessed
+    // through 'Proto::message', 'Proto::enumeration' and 'Proto::service' or
+    // when calling 'Proto::resolve'
+    PARSE_LAZY = 0x02,
+};
+
+struct SymbolIndex;
+
 class Proto
 {
     public:
@@ -132,8 +257,35 @@ class Proto
         std::string fileName;
         std::string package;
         std::string syntax;
+        // imported file names, as written
+        std::list<std::string> imports;
+        // structural fingerprint (see 'computeFingerprints')
+        uint64_t fingerprint = 0;
+        // source content (only kept with 'PARSE_COMMENTS' or 'PARSE_LAZY')
+        std::shared_ptr<const std::string> source;
+        // lookup table used by 'message', 'enumeration' and 'service'
+        std::shared_ptr<SymbolIndex> symbols;
+
+        static void parse( Proto &tree, std::istream &input, const std::string &fileName = "",
+            ParseStats *stats = nullptr, int flags = 0 );
+        // report the declarations to 'handler' instead of building a tree
+        static void parse( ParseHandler &handler, std::istream &input );
+        // text of a comment without the comment markers
+        std::string comment( const CommentSpan &span ) const;
 
-        static void parse( Proto &tree, std::istream &input, const std::string &fileName = "");
+        /*
+         * Find declarations by qualified name, parsing pending bodies first. The
+         * field types of the returned message are resolved, which also parses
+         * the bodies of the referenced messages and enumerations. The lookup
+         * table is built on the first call, so declarations must not be added
+         * or removed after that. These functions modify the tree and are not
+         * thread safe.
+         */
+        std::shared_ptr<Message> message( const std::string &qname );
+        std::shared_ptr<Enum> enumeration( const std::string &qname );
+        std::shared_ptr<Service> service( const std::string &qname );
+        // parse all pending bodies, resolve the types and sort the messages
+        void resolve();
 };
 
 } // protop
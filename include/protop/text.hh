@@ -0,0 +1,49 @@
+/*
+ * Copyright 2020-2022 Bruno Ribeiro <https://github.com/brunexgeek>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef PROTOP_TEXT_API
+#define PROTOP_TEXT_API
+
+#include <protop/codec.hh>
+#include <iostream>
+
+namespace protop {
+
+/*
+ * Reads and writes the protobuf text format ('name: value', nested messages in
+ * '{ }' or '< >' and repeated values given one by one or as '[ ]' lists). Field
+ * and enumeration names are resolved against the schema of the message, so the
+ * 'Proto' must be resolved. Extensions and 'Any' expansions are not supported.
+ *
+ * Parsing merges the content into the message with the same semantics as the
+ * wire format: singular fields take the last value and singular messages are
+ * merged. Errors are reported through 'protop::exception'.
+ */
+class TextFormat
+{
+    public:
+        static void parse( DynamicMessage &message, const char *data, size_t size );
+        static void parse( DynamicMessage &message, std::istream &input );
+        // convert text format to wire format (e.g. for generated messages), appending to 'out'
+        static void toBinary( const MessageCodec &message, const char *data, size_t size,
+            std::string &out );
+        // append the text format content to 'out'
+        static void print( const DynamicMessage &message, std::string &out );
+};
+
+} // protop
+
+#endif // PROTOP_TEXT_API
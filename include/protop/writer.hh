@@ -0,0 +1,83 @@
+/*
+ * Copyright 2020-2022 Bruno Ribeiro <https://github.com/brunexgeek>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef PROTOP_WRITER_API
+#define PROTOP_WRITER_API
+
+#include <string>
+#include <stdint.h>
+#include <stddef.h>
+
+namespace protop {
+
+/*
+ * Growable buffer for generated code. Text is appended without going through
+ * iostreams and the whole buffer is written with a single system call at the
+ * end. When the indentation level is not zero, the indentation is inserted at
+ * the beginning of every non-empty line.
+ */
+class CodeWriter
+{
+    public:
+        CodeWriter( const std::string &indentation = "    " );
+        CodeWriter( CodeWriter &&that );
+        CodeWriter( const CodeWriter& ) = delete;
+        ~CodeWriter();
+        CodeWriter &operator=( CodeWriter &&that );
+        CodeWriter &operator=( const CodeWriter& ) = delete;
+
+        void write( const char *data, size_t size );
+        CodeWriter &operator<<( const std::string &value );
+        CodeWriter &operator<<( const char *value );
+        CodeWriter &operator<<( char value );
+        CodeWriter &operator<<( int value );
+        CodeWriter &operator<<( long value );
+        CodeWriter &operator<<( long long value );
+        CodeWriter &operator<<( unsigned value );
+        CodeWriter &operator<<( unsigned long value );
+        CodeWriter &operator<<( unsigned long long value );
+
+        void indent() { ++level_; }
+        void dedent() { if (level_ > 0) --level_; }
+
+        const char *data() const { return data_; }
+        size_t size() const { return size_; }
+        std::string str() const { return std::string(data_, size_); }
+        void clear();
+        void swap( CodeWriter &that );
+
+        // write the content to a file descriptor or file
+        bool writeTo( int fd ) const;
+        bool writeFile( const std::string &path ) const;
+        // write the content of several buffers with a single 'writev' (where available)
+        static bool writeTo( int fd, const CodeWriter *const *writers, size_t count );
+
+    private:
+        char *data_;
+        size_t size_;
+        size_t capacity_;
+        std::string indentation_;
+        int level_;
+        bool lineStart_;
+
+        void reserve( size_t size );
+        void append( const char *data, size_t size );
+        void writeUnsigned( uint64_t value, bool negative );
+};
+
+} // protop
+
+#endif // PROTOP_WRITER_API
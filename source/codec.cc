@@ -0,0 +1,461 @@
+/*
+ * Copyright 2020-2022 Bruno Ribeiro <https://github.com/brunexgeek>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <protop/codec.hh>
+#include "wire.hh"
+#include <cstring>
+
+// largest field number handled by the dense dispatch table
+#define MAX_DENSE_NUMBER  4096
+#define MAX_DECODE_DEPTH  100
+
+namespace protop {
+
+static WireType wireType( const TypeInfo &type )
+{
+    switch (type.id)
+    {
+        case TYPE_DOUBLE:
+        case TYPE_FIXED64:
+        case TYPE_SFIXED64:
+            return WIRE_FIXED64;
+        case TYPE_FLOAT:
+        case TYPE_FIXED32:
+        case TYPE_SFIXED32:
+            return WIRE_FIXED32;
+        case TYPE_STRING:
+        case TYPE_BYTES:
+            return WIRE_LENGTH;
+        case TYPE_COMPLEX:
+            return (type.eref != nullptr) ? WIRE_VARINT : WIRE_LENGTH;
+        default:
+            return WIRE_VARINT;
+    }
+}
+
+MessageCodec::MessageCodec( std::shared_ptr<Message> message ) : message(message)
+{
+}
+
+const FieldCodec *MessageCodec::find( int number ) const
+{
+    if (number > 0 && (size_t) number < dispatch_.size())
+    {
+        uint16_t slot = dispatch_[(size_t) number];
+        return (slot == 0) ? nullptr : &fields[slot - 1];
+    }
+    auto it = sparse_.find(number);
+    if (it == sparse_.end()) return nullptr;
+    return &fields[it->second];
+}
+
+const FieldCodec *MessageCodec::find( const std::string &name ) const
+{
+    for (auto &fc : fields)
+        if (fc.field->name == name) return &fc;
+    return nullptr;
+}
+
+Codec::Codec( const Proto &proto )
+{
+    // first pass: create every message codec so nested messages can be linked
+    std::unordered_map<const Message*, MessageCodec*> links;
+    for (auto message : proto.messages)
+    {
+        auto mc = std::make_shared<MessageCodec>(message);
+        mc->index = messages_.size();
+        messages_.push_back(mc);
+        names_[message->qname] = mc;
+        links[message.get()] = mc.get();
+    }
+
+    // second pass: compile the fields
+    for (auto mc : messages_)
+    {
+        int max = 0;
+        for (auto field : mc->message->fields)
+        {
+            FieldCodec fc;
+            fc.field = field;
+            fc.number = field->index;
+            fc.type = field->type.id;
+            fc.wire = wireType(field->type);
+            fc.repeated = field->type.repeated;
+            fc.packed = fc.repeated && fc.wire != WIRE_LENGTH;
+            fc.eref = field->type.eref;
+            if (field->type.mref != nullptr)
+                fc.message = links[field->type.mref.get()];
+            uint64_t key = ((uint64_t) fc.number << 3) | (fc.packed ? WIRE_LENGTH : fc.wire);
+            fc.tagSize = (size_t) (writeVarint(fc.tag, key) - fc.tag);
+            fc.slot = mc->fields.size();
+            mc->fields.push_back(fc);
+            if (fc.number > max) max = fc.number;
+        }
+
+        if (max < MAX_DENSE_NUMBER)
+        {
+            mc->dispatch_.resize((size_t) max + 1, 0);
+            for (auto &fc : mc->fields)
+                mc->dispatch_[(size_t) fc.number] = (uint16_t) (fc.slot + 1);
+        }
+        else
+        {
+            for (auto &fc : mc->fields)
+                mc->sparse_[fc.number] = fc.slot;
+        }
+    }
+}
+
+const MessageCodec *Codec::find( const std::string &qname ) const
+{
+    auto it = names_.find(qname);
+    if (it == names_.end()) return nullptr;
+    return it->second.get();
+}
+
+void DynamicField::clear()
+{
+    values.clear();
+    strings.clear();
+    messages.clear();
+}
+
+double DynamicField::getDouble( size_t index ) const
+{
+    double value;
+    std::memcpy(&value, &values[index], sizeof(value));
+    return value;
+}
+
+float DynamicField::getFloat( size_t index ) const
+{
+    uint32_t bits = (uint32_t) values[index];
+    float value;
+    std::memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+void DynamicField::addDouble( double value )
+{
+    uint64_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    values.push_back(bits);
+}
+
+void DynamicField::addFloat( float value )
+{
+    uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    values.push_back(bits);
+}
+
+DynamicMessage::DynamicMessage( const MessageCodec &codec ) : fields(codec.fields.size()),
+    codec_(&codec)
+{
+}
+
+DynamicField *DynamicMessage::field( int number )
+{
+    auto fc = codec_->find(number);
+    return (fc == nullptr) ? nullptr : &fields[fc->slot];
+}
+
+DynamicField *DynamicMessage::field( const std::string &name )
+{
+    auto fc = codec_->find(name);
+    return (fc == nullptr) ? nullptr : &fields[fc->slot];
+}
+
+const DynamicField *DynamicMessage::field( int number ) const
+{
+    auto fc = codec_->find(number);
+    return (fc == nullptr) ? nullptr : &fields[fc->slot];
+}
+
+const DynamicField *DynamicMessage::field( const std::string &name ) const
+{
+    auto fc = codec_->find(name);
+    return (fc == nullptr) ? nullptr : &fields[fc->slot];
+}
+
+DynamicMessage &DynamicMessage::addMessage( const FieldCodec &field )
+{
+    if (field.message == nullptr)
+        throw exception("Field '" + field.field->name + "' is not a message");
+    auto &items = fields[field.slot].messages;
+    items.push_back(std::make_shared<DynamicMessage>(*field.message));
+    return *items.back();
+}
+
+void DynamicMessage::clear()
+{
+    for (auto &item : fields) item.clear();
+    unknown.clear();
+}
+
+void DynamicMessage::decode( const std::string &data )
+{
+    decode((const uint8_t*) data.data(), data.size());
+}
+
+void DynamicMessage::decode( const uint8_t *data, size_t size )
+{
+    decode(data, size, 0);
+}
+
+void DynamicMessage::decode( const uint8_t *data, size_t size, int depth )
+{
+    if (depth >= MAX_DECODE_DEPTH)
+        throw exception("Nesting depth exceeds " + std::to_string(MAX_DECODE_DEPTH) + " levels");
+    const uint8_t *ptr = data;
+    const uint8_t *end = data + size;
+
+    while (ptr < end)
+    {
+        const uint8_t *start = ptr;
+        uint64_t key;
+        ptr = readVarint(ptr, end, key);
+        int wire = (int) (key & 7);
+        const FieldCodec *fc = codec_->find((int) (key >> 3));
+
+        // length of the payload for length-delimited values
+        uint64_t length = 0;
+        if (wire == WIRE_LENGTH)
+        {
+            ptr = readVarint(ptr, end, length);
+            if (length > (uint64_t) (end - ptr))
+                throw exception("Truncated length-delimited value");
+        }
+
+        if (fc != nullptr && wire == fc->wire)
+        {
+            DynamicField &df = fields[fc->slot];
+            if (fc->message != nullptr)
+            {
+                DynamicMessage *nested;
+                if (fc->repeated || df.messages.empty())
+                {
+                    df.messages.push_back(std::make_shared<DynamicMessage>(*fc->message));
+                    nested = df.messages.back().get();
+                }
+                else
+                    nested = df.messages.front().get(); // merge
+                nested->decode(ptr, (size_t) length, depth + 1);
+                ptr += length;
+                continue;
+            }
+            if (wire == WIRE_LENGTH)
+            {
+                if (fc->repeated || df.strings.empty())
+                    df.strings.push_back(std::string((const char*) ptr, (size_t) length));
+                else
+                    df.strings.front().assign((const char*) ptr, (size_t) length);
+                ptr += length;
+                continue;
+            }
+
+            uint64_t value = 0;
+            if (wire == WIRE_VARINT)
+            {
+                ptr = readVarint(ptr, end, value);
+                value = fromVarint(*fc, value);
+            }
+            else
+            if (wire == WIRE_FIXED64)
+            {
+                if (end - ptr < 8) throw exception("Truncated fixed64 value");
+                value = readFixed64(ptr);
+                ptr += 8;
+            }
+            else
+            {
+                if (end - ptr < 4) throw exception("Truncated fixed32 value");
+                value = fromFixed32(*fc, readFixed32(ptr));
+                ptr += 4;
+            }
+            if (fc->repeated || df.values.empty())
+                df.values.push_back(value);
+            else
+                df.values.front() = value;
+            continue;
+        }
+
+        if (fc != nullptr && wire == WIRE_LENGTH && fc->packed)
+        {
+            DynamicField &df = fields[fc->slot];
+            const uint8_t *last = ptr + length;
+            while (ptr < last)
+            {
+                uint64_t value;
+                if (fc->wire == WIRE_VARINT)
+                {
+                    ptr = readVarint(ptr, last, value);
+                    value = fromVarint(*fc, value);
+                }
+                else
+                if (fc->wire == WIRE_FIXED64)
+                {
+                    if (last - ptr < 8) throw exception("Truncated fixed64 value");
+                    value = readFixed64(ptr);
+                    ptr += 8;
+                }
+                else
+                {
+                    if (last - ptr < 4) throw exception("Truncated fixed32 value");
+                    value = fromFixed32(*fc, readFixed32(ptr));
+                    ptr += 4;
+                }
+                df.values.push_back(value);
+            }
+            continue;
+        }
+
+        // unknown field or unexpected wire type: keep it verbatim
+        switch (wire)
+        {
+            case WIRE_VARINT:
+            {
+                uint64_t value;
+                ptr = readVarint(ptr, end, value);
+                break;
+            }
+            case WIRE_FIXED64:
+                if (end - ptr < 8) throw exception("Truncated fixed64 value");
+                ptr += 8;
+                break;
+            case WIRE_LENGTH:
+                ptr += length;
+                break;
+            case WIRE_FIXED32:
+                if (end - ptr < 4) throw exception("Truncated fixed32 value");
+                ptr += 4;
+                break;
+            default:
+                throw exception("Unsupported wire type " + std::to_string(wire));
+        }
+        unknown.append((const char*) start, (size_t) (ptr - start));
+    }
+}
+
+size_t DynamicMessage::byteSize() const
+{
+    std::vector<size_t> sizes;
+    return measure(sizes);
+}
+
+size_t DynamicMessage::measure( std::vector<size_t> &sizes ) const
+{
+    size_t size = unknown.size();
+    for (auto &fc : codec_->fields)
+    {
+        const DynamicField &df = fields[fc.slot];
+        if (fc.message != nullptr)
+        {
+            for (auto &item : df.messages)
+            {
+                // the slot comes before the sizes of the nested messages
+                size_t slot = sizes.size();
+                sizes.push_back(0);
+                size_t length = item->measure(sizes);
+                sizes[slot] = length;
+                size += fc.tagSize + varintSize(length) + length;
+            }
+        }
+        else
+        if (fc.wire == WIRE_LENGTH)
+        {
+            for (auto &item : df.strings)
+                size += fc.tagSize + varintSize(item.size()) + item.size();
+        }
+        else
+        if (fc.packed)
+        {
+            if (df.values.empty()) continue;
+            size_t length = 0;
+            for (auto value : df.values) length += valueSize(fc, value);
+            size += fc.tagSize + varintSize(length) + length;
+        }
+        else
+        {
+            for (auto value : df.values)
+                size += fc.tagSize + valueSize(fc, value);
+        }
+    }
+    return size;
+}
+
+uint8_t *DynamicMessage::write( uint8_t *ptr, const size_t *&sizes ) const
+{
+    // consumes the sizes of the nested messages in the order recorded by 'measure'
+    for (auto &fc : codec_->fields)
+    {
+        const DynamicField &df = fields[fc.slot];
+        if (fc.message != nullptr)
+        {
+            for (auto &item : df.messages)
+            {
+                std::memcpy(ptr, fc.tag, fc.tagSize);
+                ptr = writeVarint(ptr + fc.tagSize, *sizes++);
+                ptr = item->write(ptr, sizes);
+            }
+        }
+        else
+        if (fc.wire == WIRE_LENGTH)
+        {
+            for (auto &item : df.strings)
+            {
+                std::memcpy(ptr, fc.tag, fc.tagSize);
+                ptr = writeVarint(ptr + fc.tagSize, item.size());
+                std::memcpy(ptr, item.data(), item.size());
+                ptr += item.size();
+            }
+        }
+        else
+        if (fc.packed)
+        {
+            if (df.values.empty()) continue;
+            size_t length = 0;
+            for (auto value : df.values) length += valueSize(fc, value);
+            std::memcpy(ptr, fc.tag, fc.tagSize);
+            ptr = writeVarint(ptr + fc.tagSize, length);
+            for (auto value : df.values) ptr = writeValue(ptr, fc, value);
+        }
+        else
+        {
+            for (auto value : df.values)
+            {
+                std::memcpy(ptr, fc.tag, fc.tagSize);
+                ptr = writeValue(ptr + fc.tagSize, fc, value);
+            }
+        }
+    }
+    std::memcpy(ptr, unknown.data(), unknown.size());
+    return ptr + unknown.size();
+}
+
+void DynamicMessage::encode( std::string &out ) const
+{
+    // size pre-pass, so the output buffer is resized only once; the sizes of the
+    // nested messages are kept locally, so concurrent calls are safe
+    std::vector<size_t> sizes;
+    size_t size = measure(sizes);
+    size_t offset = out.size();
+    out.resize(offset + size);
+    const size_t *next = sizes.data();
+    if (size > 0) write((uint8_t*) &out[offset], next);
+}
+
+} // protop
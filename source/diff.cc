@@ -0,0 +1,377 @@
+/*
+ * Copyright 2020-2022 Bruno Ribeiro <https://github.com/brunexgeek>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <protop/diff.hh>
+#include <algorithm>
+#include <unordered_map>
+
+namespace protop {
+
+#define FNV_OFFSET  14695981039346656037ULL
+#define FNV_PRIME   1099511628211ULL
+
+static const char *TYPES[] =
+{
+    "double",
+    "float",
+    "int32",
+    "int64",
+    "uint32",
+    "uint64",
+    "sint32",
+    "sint64",
+    "fixed32",
+    "fixed64",
+    "sfixed32",
+    "sfixed64",
+    "bool",
+    "string",
+    "bytes",
+};
+
+// FNV-1a over a sequence of values
+struct Hasher
+{
+    uint64_t value = FNV_OFFSET;
+
+    void add( const std::string &text )
+    {
+        for (char c : text)
+        {
+            value ^= (uint8_t) c;
+            value *= FNV_PRIME;
+        }
+        // separator, so "ab" + "c" differs from "a" + "bc"
+        value ^= 0xFF;
+        value *= FNV_PRIME;
+    }
+
+    void add( uint64_t number )
+    {
+        for (int i = 0; i < 8; ++i, number >>= 8)
+        {
+            value ^= number & 0xFF;
+            value *= FNV_PRIME;
+        }
+    }
+
+    // zero means 'not computed'
+    uint64_t result() const { return (value == 0) ? 1 : value; }
+};
+
+typedef std::unordered_map<std::string, std::shared_ptr<Message>> MessageMap;
+
+static void addOptions( Hasher &hasher, const OptionMap &options )
+{
+    std::vector<const OptionEntry*> entries;
+    for (auto &it : options) entries.push_back(&it.second);
+    std::sort(entries.begin(), entries.end(),
+        [](const OptionEntry *a, const OptionEntry *b) { return a->name < b->name; });
+    hasher.add((uint64_t) entries.size());
+    for (auto it : entries)
+    {
+        hasher.add(it->name);
+        hasher.add((uint64_t) it->type);
+        hasher.add(it->value);
+    }
+}
+
+static std::string qualifiedName( const TypeInfo &type )
+{
+    if (type.package.empty()) return type.name;
+    return type.package + '.' + type.name;
+}
+
+static std::string typeName( const TypeInfo &type )
+{
+    std::string out = type.repeated ? "repeated " : "";
+    if (type.id >= TYPE_DOUBLE && type.id <= TYPE_BYTES)
+        out += TYPES[type.id - TYPE_DOUBLE];
+    else
+    if (type.mref != nullptr)
+        out += type.mref->qname;
+    else
+    if (type.eref != nullptr)
+        out += type.eref->qname;
+    else
+        out += qualifiedName(type);
+    return out;
+}
+
+static uint64_t fingerprint( Enum &entity )
+{
+    if (entity.fingerprint != 0) return entity.fingerprint;
+
+    std::vector<const Constant*> constants;
+    for (auto &it : entity.constants) constants.push_back(it.get());
+    std::sort(constants.begin(), constants.end(),
+        [](const Constant *a, const Constant *b)
+        {
+            if (a->value != b->value) return a->value < b->value;
+            return a->name < b->name;
+        });
+
+    Hasher hasher;
+    hasher.add("enum");
+    hasher.add(entity.qname);
+    addOptions(hasher, entity.options);
+    for (auto it : constants)
+    {
+        hasher.add(it->name);
+        hasher.add((uint64_t) (int64_t) it->value);
+        addOptions(hasher, it->options);
+    }
+    return entity.fingerprint = hasher.result();
+}
+
+static uint64_t fingerprint( Message &message )
+{
+    if (message.fingerprint != 0) return message.fingerprint;
+
+    std::vector<const Field*> fields;
+    for (auto &it : message.fields) fields.push_back(it.get());
+    std::sort(fields.begin(), fields.end(),
+        [](const Field *a, const Field *b) { return a->index < b->index; });
+
+    Hasher hasher;
+    hasher.add("message");
+    hasher.add(message.qname);
+    addOptions(hasher, message.options);
+    for (auto it : fields)
+    {
+        hasher.add((uint64_t) it->index);
+        hasher.add(it->name);
+        hasher.add((uint64_t) it->type.repeated);
+        hasher.add((uint64_t) it->type.id);
+        // referenced types contribute with their own fingerprints; there is no
+        // circular reference other than the message referencing itself
+        if (it->type.mref.get() == &message)
+            hasher.add("self");
+        else
+        if (it->type.mref != nullptr)
+            hasher.add(fingerprint(*it->type.mref));
+        else
+        if (it->type.eref != nullptr)
+            hasher.add(fingerprint(*it->type.eref));
+        addOptions(hasher, it->options);
+    }
+    return message.fingerprint = hasher.result();
+}
+
+static void addType( Hasher &hasher, const MessageMap &messages, const TypeInfo &type )
+{
+    std::string name = qualifiedName(type);
+    hasher.add(name);
+    auto it = messages.find(name);
+    if (it != messages.end()) hasher.add(it->second->fingerprint);
+}
+
+static uint64_t fingerprint( Service &service, const MessageMap &messages )
+{
+    std::vector<const Procedure*> procs;
+    for (auto &it : service.procs) procs.push_back(it.get());
+    std::sort(procs.begin(), procs.end(),
+        [](const Procedure *a, const Procedure *b) { return a->name < b->name; });
+
+    Hasher hasher;
+    hasher.add("service");
+    hasher.add(service.qname);
+    addOptions(hasher, service.options);
+    for (auto it : procs)
+    {
+        hasher.add(it->name);
+        addType(hasher, messages, it->request);
+        addType(hasher, messages, it->response);
+        hasher.add((uint64_t) it->requestStream | (uint64_t) it->responseStream << 1);
+        addOptions(hasher, it->options);
+    }
+    return service.fingerprint = hasher.result();
+}
+
+void computeFingerprints( Proto &tree )
+{
+    for (auto it : tree.messages) it->fingerprint = 0;
+    for (auto it : tree.enums) it->fingerprint = 0;
+
+    MessageMap messages;
+    std::vector<uint64_t> values;
+    for (auto it : tree.enums)
+        values.push_back(fingerprint(*it));
+    for (auto it : tree.messages)
+    {
+        values.push_back(fingerprint(*it));
+        messages[it->qname] = it;
+    }
+    for (auto it : tree.services)
+        values.push_back(fingerprint(*it, messages));
+
+    // the tree fingerprint does not depend on the declaration order
+    std::sort(values.begin(), values.end());
+    Hasher hasher;
+    hasher.add(tree.package);
+    addOptions(hasher, tree.options);
+    for (auto value : values) hasher.add(value);
+    tree.fingerprint = hasher.result();
+}
+
+static std::string describe( const Field &field )
+{
+    return typeName(field.type) + " = " + std::to_string(field.index);
+}
+
+static std::string describe( const Constant &constant )
+{
+    return std::to_string(constant.value);
+}
+
+static std::string describe( const Procedure &proc )
+{
+    return std::string(proc.requestStream ? "(stream " : "(") + qualifiedName(proc.request) + ") returns (" +
+        (proc.responseStream ? "stream " : "") + qualifiedName(proc.response) + ")";
+}
+
+/*
+ * Compares two lists of named members, calling 'compare' for members present
+ * in both lists. Results follow the order of 'before', then the order of 'after'.
+ */
+template<typename T, typename F>
+static void diffMembers( std::vector<Change> &out, const std::string &entity,
+    const std::list<std::shared_ptr<T>> &before, const std::list<std::shared_ptr<T>> &after,
+    ChangeType added, ChangeType removed, F compare )
+{
+    std::unordered_map<std::string, std::shared_ptr<T>> names;
+    for (auto it : after) names[it->name] = it;
+    for (auto it : before)
+    {
+        auto match = names.find(it->name);
+        if (match == names.end())
+            out.push_back(Change{removed, entity, it->name, describe(*it), ""});
+        else
+            compare(*it, *match->second);
+    }
+
+    names.clear();
+    for (auto it : before) names[it->name] = it;
+    for (auto it : after)
+    {
+        if (names.find(it->name) == names.end())
+            out.push_back(Change{added, entity, it->name, "", describe(*it)});
+    }
+}
+
+/*
+ * Compares two lists of entities identified by 'key'. Entities with the same
+ * fingerprint are skipped without looking at their members.
+ */
+template<typename T, typename K, typename F>
+static void diffEntities( std::vector<Change> &out, const std::list<std::shared_ptr<T>> &before,
+    const std::list<std::shared_ptr<T>> &after, ChangeType added, ChangeType removed, K key, F compare )
+{
+    std::unordered_map<std::string, std::shared_ptr<T>> names;
+    for (auto it : after) names[key(*it)] = it;
+    for (auto it : before)
+    {
+        auto match = names.find(key(*it));
+        if (match == names.end())
+            out.push_back(Change{removed, key(*it), "", "", ""});
+        else
+        if (match->second->fingerprint != it->fingerprint)
+            compare(key(*it), *it, *match->second);
+    }
+
+    names.clear();
+    for (auto it : before) names[key(*it)] = it;
+    for (auto it : after)
+    {
+        if (names.find(key(*it)) == names.end())
+            out.push_back(Change{added, key(*it), "", "", ""});
+    }
+}
+
+std::vector<Change> diff( Proto &before, Proto &after )
+{
+    std::vector<Change> out;
+
+    if (before.fingerprint == 0) computeFingerprints(before);
+    if (after.fingerprint == 0) computeFingerprints(after);
+    if (before.fingerprint == after.fingerprint) return out;
+
+    diffEntities(out, before.messages, after.messages, ChangeType::MESSAGE_ADDED, ChangeType::MESSAGE_REMOVED,
+        [](const Message &entity) { return entity.qname; },
+        [&out](const std::string &name, const Message &a, const Message &b)
+        {
+            diffMembers(out, name, a.fields, b.fields, ChangeType::FIELD_ADDED, ChangeType::FIELD_REMOVED,
+                [&out, &name](const Field &x, const Field &y)
+                {
+                    if (x.index != y.index)
+                        out.push_back(Change{ChangeType::FIELD_RENUMBERED, name, x.name, describe(x), describe(y)});
+                    if (typeName(x.type) != typeName(y.type))
+                        out.push_back(Change{ChangeType::FIELD_RETYPED, name, x.name, describe(x), describe(y)});
+                });
+        });
+
+    diffEntities(out, before.enums, after.enums, ChangeType::ENUM_ADDED, ChangeType::ENUM_REMOVED,
+        [](const Enum &entity) { return entity.qname; },
+        [&out](const std::string &name, const Enum &a, const Enum &b)
+        {
+            diffMembers(out, name, a.constants, b.constants, ChangeType::CONSTANT_ADDED, ChangeType::CONSTANT_REMOVED,
+                [&out, &name](const Constant &x, const Constant &y)
+                {
+                    if (x.value != y.value)
+                        out.push_back(Change{ChangeType::CONSTANT_CHANGED, name, x.name, describe(x), describe(y)});
+                });
+        });
+
+    diffEntities(out, before.services, after.services, ChangeType::SERVICE_ADDED, ChangeType::SERVICE_REMOVED,
+        [](const Service &entity) { return entity.qname; },
+        [&out](const std::string &name, const Service &a, const Service &b)
+        {
+            diffMembers(out, name, a.procs, b.procs, ChangeType::PROCEDURE_ADDED, ChangeType::PROCEDURE_REMOVED,
+                [&out, &name](const Procedure &x, const Procedure &y)
+                {
+                    if (describe(x) != describe(y))
+                        out.push_back(Change{ChangeType::PROCEDURE_CHANGED, name, x.name, describe(x), describe(y)});
+                });
+        });
+
+    return out;
+}
+
+const char *changeName( ChangeType type )
+{
+    switch (type)
+    {
+        case ChangeType::MESSAGE_ADDED:     return "message added";
+        case ChangeType::MESSAGE_REMOVED:   return "message removed";
+        case ChangeType::FIELD_ADDED:       return "field added";
+        case ChangeType::FIELD_REMOVED:     return "field removed";
+        case ChangeType::FIELD_RENUMBERED:  return "field renumbered";
+        case ChangeType::FIELD_RETYPED:     return "field retyped";
+        case ChangeType::ENUM_ADDED:        return "enum added";
+        case ChangeType::ENUM_REMOVED:      return "enum removed";
+        case ChangeType::CONSTANT_ADDED:    return "constant added";
+        case ChangeType::CONSTANT_REMOVED:  return "constant removed";
+        case ChangeType::CONSTANT_CHANGED:  return "constant changed";
+        case ChangeType::SERVICE_ADDED:     return "service added";
+        case ChangeType::SERVICE_REMOVED:   return "service removed";
+        case ChangeType::PROCEDURE_ADDED:   return "procedure added";
+        case ChangeType::PROCEDURE_REMOVED: return "procedure removed";
+        case ChangeType::PROCEDURE_CHANGED: return "procedure changed";
+    }
+    return "";
+}
+
+} // protop
@@ -15,7 +15,7 @@
  */
 
 #ifndef PROTOP_EXCEPTION
-#define PROTOP_
+#define PROTOP_EXCEPTION
 
 #include <string>
 #include <exception>
@@ -0,0 +1,713 @@
+/*
+ * Copyright 2020-2022 Bruno Ribeiro <https://github.com/brunexgeek>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <protop/index.hh>
+#include <protop/writer.hh>
+#include "exception.hh"
+#include <algorithm>
+#include <cstring>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <unordered_map>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace protop {
+
+#define INDEX_MAGIC      "PROTOPIX"
+#define INDEX_VERSION    1
+
+/*
+ * The index file starts with this header, followed by the arrays of files,
+ * declarations, raw references, symbols, edges sorted by target and edges
+ * sorted by source (in this order) and by the string pool. Strings are stored
+ * as an offset in the pool and a size.
+ */
+struct IndexHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t files;
+    uint32_t declarations;
+    uint32_t raws;
+    uint32_t symbols;
+    uint32_t edges;
+    uint32_t root;
+    uint32_t rootSize;
+    uint64_t strings;
+};
+
+// indexed file (sorted by path)
+struct FileRecord
+{
+    uint64_t size;
+    int64_t mtime;
+    uint64_t hash;
+    uint32_t path;
+    uint32_t pathSize;
+    uint32_t package;
+    uint32_t packageSize;
+    // range of the file in the declaration and raw reference arrays
+    uint32_t firstDeclaration;
+    uint32_t declarationCount;
+    uint32_t firstRaw;
+    uint32_t rawCount;
+    uint32_t failed;
+    uint32_t reserved;
+};
+
+// declaration of a file, in source order
+struct DeclarationRecord
+{
+    uint32_t name;
+    uint32_t nameSize;
+    uint32_t kind;
+    // position in the symbol array
+    uint32_t symbol;
+};
+
+// type name as written in the file, used to resolve references in later builds
+struct RawRecord
+{
+    // declaration using the type (relative to the first declaration of the file)
+    uint32_t source;
+    uint32_t name;
+    uint32_t nameSize;
+};
+
+// declaration of any file (sorted by name)
+struct SymbolRecord
+{
+    uint32_t name;
+    uint32_t nameSize;
+    uint32_t kind;
+    uint32_t file;
+};
+
+struct EdgeRecord
+{
+    uint32_t source;
+    uint32_t target;
+};
+
+struct IndexView
+{
+    const IndexHeader *header;
+    const FileRecord *files;
+    const DeclarationRecord *declarations;
+    const RawRecord *raws;
+    const SymbolRecord *symbols;
+    const EdgeRecord *byTarget;
+    const EdgeRecord *bySource;
+    const char *strings;
+
+    std::string text( uint32_t offset, uint32_t size ) const
+    {
+        if ((uint64_t) offset + size > header->strings) return "";
+        return std::string(strings + offset, size);
+    }
+};
+
+// pointers to the arrays of an index already checked by 'makeView'
+static IndexView layout( const uint8_t *data )
+{
+    IndexView view;
+    view.header = (const IndexHeader*) data;
+    view.files = (const FileRecord*) (view.header + 1);
+    view.declarations = (const DeclarationRecord*) (view.files + view.header->files);
+    view.raws = (const RawRecord*) (view.declarations + view.header->declarations);
+    view.symbols = (const SymbolRecord*) (view.raws + view.header->raws);
+    view.byTarget = (const EdgeRecord*) (view.symbols + view.header->symbols);
+    view.bySource = view.byTarget + view.header->edges;
+    view.strings = (const char*) (view.bySource + view.header->edges);
+    return view;
+}
+
+static bool inRange( uint64_t first, uint64_t count, uint64_t size )
+{
+    return first <= size && count <= size - first;
+}
+
+/*
+ * Checks the whole file, so the queries can use the offsets, counts and
+ * positions without checking them again (the file may be corrupt or come
+ * from somewhere else).
+ */
+static bool makeView( const uint8_t *data, size_t size, IndexView &view )
+{
+    if (data == nullptr || size < sizeof(IndexHeader)) return false;
+    auto header = (const IndexHeader*) data;
+    if (std::memcmp(header->magic, INDEX_MAGIC, sizeof(header->magic)) != 0 || header->version != INDEX_VERSION)
+        return false;
+    // each count is 32 bits, so the sum cannot overflow
+    uint64_t expected = sizeof(IndexHeader) + (uint64_t) header->files * sizeof(FileRecord) +
+        (uint64_t) header->declarations * sizeof(DeclarationRecord) + (uint64_t) header->raws * sizeof(RawRecord) +
+        (uint64_t) header->symbols * sizeof(SymbolRecord) + (uint64_t) header->edges * 2 * sizeof(EdgeRecord);
+    if (expected > size || header->strings != size - expected) return false;
+
+    view = layout(data);
+    uint64_t strings = header->strings;
+    if (!inRange(header->root, header->rootSize, strings)) return false;
+    for (uint32_t i = 0; i < header->files; ++i)
+    {
+        const FileRecord &file = view.files[i];
+        if (!inRange(file.path, file.pathSize, strings) || !inRange(file.package, file.packageSize, strings) ||
+            !inRange(file.firstDeclaration, file.declarationCount, header->declarations) ||
+            !inRange(file.firstRaw, file.rawCount, header->raws))
+            return false;
+        for (uint32_t j = 0; j < file.rawCount; ++j)
+            if (view.raws[file.firstRaw + j].source >= file.declarationCount) return false;
+    }
+    for (uint32_t i = 0; i < header->declarations; ++i)
+    {
+        const DeclarationRecord &record = view.declarations[i];
+        if (!inRange(record.name, record.nameSize, strings) || record.symbol >= header->symbols) return false;
+    }
+    for (uint32_t i = 0; i < header->raws; ++i)
+        if (!inRange(view.raws[i].name, view.raws[i].nameSize, strings)) return false;
+    for (uint32_t i = 0; i < header->symbols; ++i)
+    {
+        const SymbolRecord &record = view.symbols[i];
+        if (!inRange(record.name, record.nameSize, strings) || record.file >= header->files) return false;
+    }
+    for (uint32_t i = 0; i < header->edges; ++i)
+    {
+        if (view.byTarget[i].source >= header->symbols || view.byTarget[i].target >= header->symbols ||
+            view.bySource[i].source >= header->symbols || view.bySource[i].target >= header->symbols)
+            return false;
+    }
+    return true;
+}
+
+static const uint8_t *mapFile( const std::string &path, size_t &size )
+{
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) return nullptr;
+    void *data = MAP_FAILED;
+    struct stat info;
+    if (fstat(fd, &info) == 0 && info.st_size > 0)
+    {
+        size = (size_t) info.st_size;
+        data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    ::close(fd);
+    return data == MAP_FAILED ? nullptr : (const uint8_t*) data;
+}
+
+//
+// Build
+//
+
+struct IndexedFile
+{
+    std::string path;
+    uint64_t size = 0;
+    int64_t mtime = 0;
+    uint64_t hash = 0;
+    std::string package;
+    std::vector<std::pair<std::string, SymbolKind>> declarations;
+    // declaration using the type and the type name
+    std::vector<std::pair<uint32_t, std::string>> raws;
+    bool failed = false;
+};
+
+class DeclarationCollector : public ParseHandler
+{
+    public:
+        DeclarationCollector( IndexedFile &file ) : file_(file) {}
+
+        void onPackage( const std::string &name ) override { file_.package = name; }
+        void onMessageBegin( Message &message ) override { declare(message.qname, SymbolKind::MESSAGE); }
+        void onEnumBegin( Enum &entity ) override { declare(entity.qname, SymbolKind::ENUM); }
+        void onServiceBegin( Service &service ) override { declare(service.qname, SymbolKind::SERVICE); }
+        void onField( Field &field ) override { use(field.type); }
+
+        void onRpc( Procedure &proc ) override
+        {
+            use(proc.request);
+            use(proc.response);
+        }
+
+    private:
+        IndexedFile &file_;
+
+        void declare( const std::string &name, SymbolKind kind )
+        {
+            file_.declarations.emplace_back(name, kind);
+        }
+
+        void use( const TypeInfo &type )
+        {
+            if (type.id == TYPE_COMPLEX && !file_.declarations.empty())
+                file_.raws.emplace_back((uint32_t) file_.declarations.size() - 1, type.name);
+        }
+};
+
+class StringPool
+{
+    public:
+        uint32_t add( const std::string &value )
+        {
+            auto it = offsets_.find(value);
+            if (it != offsets_.end()) return it->second;
+            if (data_.size() + value.size() > UINT32_MAX)
+                throw exception("Index string pool is too large");
+            uint32_t offset = (uint32_t) data_.size();
+            data_ += value;
+            offsets_[value] = offset;
+            return offset;
+        }
+        const std::string &data() const { return data_; }
+
+    private:
+        std::string data_;
+        std::unordered_map<std::string, uint32_t> offsets_;
+};
+
+static bool hasSuffix( const std::string &value, const std::string &suffix )
+{
+    return value.size() >= suffix.size() && value.compare(value.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+static int64_t modificationTime( const struct stat &info )
+{
+#ifdef __APPLE__
+    return (int64_t) info.st_mtimespec.tv_sec * 1000000000 + (int64_t) info.st_mtimespec.tv_nsec;
+#else
+    return (int64_t) info.st_mtim.tv_sec * 1000000000 + (int64_t) info.st_mtim.tv_nsec;
+#endif
+}
+
+// list the '.proto' files under 'root' (hidden entries and symbolic links are ignored)
+static void listFiles( const std::string &root, const std::string &relative, std::vector<IndexedFile> &out )
+{
+    DIR *dir = opendir((root + '/' + relative).c_str());
+    if (dir == nullptr) return;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != nullptr)
+    {
+        std::string name = entry->d_name;
+        if (name.empty() || name[0] == '.') continue;
+        std::string path = relative + name;
+        struct stat info;
+        if (lstat((root + '/' + path).c_str(), &info) != 0) continue;
+        if (S_ISDIR(info.st_mode))
+            listFiles(root, path + '/', out);
+        else
+        if (S_ISREG(info.st_mode) && hasSuffix(name, ".proto"))
+        {
+            out.emplace_back();
+            out.back().path = path;
+            out.back().size = (uint64_t) info.st_size;
+            out.back().mtime = modificationTime(info);
+        }
+    }
+    closedir(dir);
+}
+
+static bool readFile( const std::string &path, std::string &content )
+{
+    std::ifstream input(path, std::ios::binary);
+    if (!input.good()) return false;
+    std::ostringstream buffer;
+    buffer << input.rdbuf();
+    content = buffer.str();
+    return true;
+}
+
+static uint64_t contentHash( const std::string &content )
+{
+    uint64_t hash = 14695981039346656037ULL;
+    for (char c : content)
+    {
+        hash ^= (uint8_t) c;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+// copy the declarations of a file from the old index
+static void reuse( const IndexView &view, const FileRecord &record, IndexedFile &file )
+{
+    file.package = view.text(record.package, record.packageSize);
+    file.failed = record.failed != 0;
+    for (uint32_t i = 0; i < record.declarationCount; ++i)
+    {
+        const DeclarationRecord &decl = view.declarations[record.firstDeclaration + i];
+        file.declarations.emplace_back(view.text(decl.name, decl.nameSize), (SymbolKind) decl.kind);
+    }
+    for (uint32_t i = 0; i < record.rawCount; ++i)
+    {
+        const RawRecord &raw = view.raws[record.firstRaw + i];
+        file.raws.emplace_back(raw.source, view.text(raw.name, raw.nameSize));
+    }
+}
+
+// symbol referenced by a type name, following the scoping rules of protobuf
+static int64_t resolveName( const std::unordered_map<std::string, uint32_t> &names, const std::string &package,
+    const std::string &name )
+{
+    if (!name.empty() && name[0] == '.')
+    {
+        auto it = names.find(name.substr(1));
+        return it == names.end() ? -1 : it->second;
+    }
+    std::string scope = package;
+    while (true)
+    {
+        auto it = names.find(scope.empty() ? name : scope + '.' + name);
+        if (it != names.end()) return it->second;
+        if (scope.empty()) return -1;
+        auto pos = scope.rfind('.');
+        scope = (pos == std::string::npos) ? "" : scope.substr(0, pos);
+    }
+}
+
+template<typename T>
+static void writeArray( CodeWriter &out, const std::vector<T> &items )
+{
+    if (!items.empty()) out.write((const char*) items.data(), items.size() * sizeof(T));
+}
+
+IndexStats RepositoryIndex::build( const std::string &root, const std::string &path )
+{
+    std::string base = root;
+    while (base.size() > 1 && base.back() == '/') base.pop_back();
+
+    // previous index (if any)
+    size_t oldSize = 0;
+    const uint8_t *oldData = mapFile(path, oldSize);
+    IndexView old;
+    std::unordered_map<std::string, const FileRecord*> previous;
+    if (makeView(oldData, oldSize, old) && old.text(old.header->root, old.header->rootSize) == base)
+    {
+        for (uint32_t i = 0; i < old.header->files; ++i)
+            previous[old.text(old.files[i].path, old.files[i].pathSize)] = old.files + i;
+    }
+
+    IndexStats stats;
+    std::vector<IndexedFile> files;
+    listFiles(base, "", files);
+    std::sort(files.begin(), files.end(),
+        [](const IndexedFile &a, const IndexedFile &b) { return a.path < b.path; });
+    for (auto &file : files)
+    {
+        auto it = previous.find(file.path);
+        const FileRecord *record = (it == previous.end()) ? nullptr : it->second;
+        if (record != nullptr && record->size == file.size && record->mtime == file.mtime)
+        {
+            file.hash = record->hash;
+            reuse(old, *record, file);
+            continue;
+        }
+        std::string content;
+        if (!readFile(base + '/' + file.path, content)) continue;
+        file.hash = contentHash(content);
+        if (record != nullptr && record->hash == file.hash)
+        {
+            reuse(old, *record, file);
+            continue;
+        }
+        ++stats.parsed;
+        try
+        {
+            std::istringstream input(content);
+            DeclarationCollector collector(file);
+            Proto::parse(collector, input);
+        } catch (std::exception &)
+        {
+            file.declarations.clear();
+            file.raws.clear();
+            file.failed = true;
+        }
+    }
+    if (oldData != nullptr) munmap((void*) oldData, oldSize);
+
+    // symbol table
+    struct Entry { const std::string *name; SymbolKind kind; uint32_t file; uint32_t local; };
+    std::vector<Entry> entries;
+    for (size_t i = 0; i < files.size(); ++i)
+    {
+        stats.failed += files[i].failed ? 1 : 0;
+        for (size_t j = 0; j < files[i].declarations.size(); ++j)
+            entries.push_back(Entry{&files[i].declarations[j].first, files[i].declarations[j].second, (uint32_t) i, (uint32_t) j});
+    }
+    std::stable_sort(entries.begin(), entries.end(),
+        [](const Entry &a, const Entry &b) { return *a.name < *b.name; });
+    std::vector<std::vector<uint32_t>> positions(files.size());
+    for (size_t i = 0; i < files.size(); ++i) positions[i].resize(files[i].declarations.size());
+    std::unordered_map<std::string, uint32_t> names;
+    for (size_t i = 0; i < entries.size(); ++i)
+    {
+        positions[entries[i].file][entries[i].local] = (uint32_t) i;
+        names.insert(std::make_pair(*entries[i].name, (uint32_t) i));
+    }
+
+    // references
+    std::vector<EdgeRecord> byTarget;
+    for (size_t i = 0; i < files.size(); ++i)
+    {
+        for (auto &raw : files[i].raws)
+        {
+            int64_t target = resolveName(names, files[i].package, raw.second);
+            if (target >= 0 && raw.first < positions[i].size())
+                byTarget.push_back(EdgeRecord{positions[i][raw.first], (uint32_t) target});
+        }
+    }
+    std::sort(byTarget.begin(), byTarget.end(), [](const EdgeRecord &a, const EdgeRecord &b)
+        { return a.target < b.target || (a.target == b.target && a.source < b.source); });
+    byTarget.erase(std::unique(byTarget.begin(), byTarget.end(), [](const EdgeRecord &a, const EdgeRecord &b)
+        { return a.target == b.target && a.source == b.source; }), byTarget.end());
+    std::vector<EdgeRecord> bySource = byTarget;
+    std::sort(bySource.begin(), bySource.end(), [](const EdgeRecord &a, const EdgeRecord &b)
+        { return a.source < b.source || (a.source == b.source && a.target < b.target); });
+
+    // records
+    StringPool pool;
+    std::vector<FileRecord> fileRecords;
+    std::vector<DeclarationRecord> declarations;
+    std::vector<RawRecord> raws;
+    std::vector<SymbolRecord> symbols;
+    for (size_t i = 0; i < files.size(); ++i)
+    {
+        const IndexedFile &file = files[i];
+        FileRecord record;
+        std::memset(&record, 0, sizeof(record));
+        record.size = file.size;
+        record.mtime = file.mtime;
+        record.hash = file.hash;
+        record.path = pool.add(file.path);
+        record.pathSize = (uint32_t) file.path.size();
+        record.package = pool.add(file.package);
+        record.packageSize = (uint32_t) file.package.size();
+        record.firstDeclaration = (uint32_t) declarations.size();
+        record.declarationCount = (uint32_t) file.declarations.size();
+        record.firstRaw = (uint32_t) raws.size();
+        record.rawCount = (uint32_t) file.raws.size();
+        record.failed = file.failed ? 1 : 0;
+        fileRecords.push_back(record);
+        for (size_t j = 0; j < file.declarations.size(); ++j)
+        {
+            const std::string &name = file.declarations[j].first;
+            declarations.push_back(DeclarationRecord{pool.add(name), (uint32_t) name.size(),
+                (uint32_t) file.declarations[j].second, positions[i][j]});
+        }
+        for (auto &raw : file.raws)
+            raws.push_back(RawRecord{raw.first, pool.add(raw.second), (uint32_t) raw.second.size()});
+    }
+    for (auto &entry : entries)
+    {
+        symbols.push_back(SymbolRecord{pool.add(*entry.name), (uint32_t) entry.name->size(),
+            (uint32_t) entry.kind, entry.file});
+    }
+
+    IndexHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, INDEX_MAGIC, sizeof(header.magic));
+    header.version = INDEX_VERSION;
+    header.files = (uint32_t) fileRecords.size();
+    header.declarations = (uint32_t) declarations.size();
+    header.raws = (uint32_t) raws.size();
+    header.symbols = (uint32_t) symbols.size();
+    header.edges = (uint32_t) byTarget.size();
+    header.root = pool.add(base);
+    header.rootSize = (uint32_t) base.size();
+    header.strings = pool.data().size();
+
+    CodeWriter out;
+    out.write((const char*) &header, sizeof(header));
+    writeArray(out, fileRecords);
+    writeArray(out, declarations);
+    writeArray(out, raws);
+    writeArray(out, symbols);
+    writeArray(out, byTarget);
+    writeArray(out, bySource);
+    out.write(pool.data().data(), pool.data().size());
+
+    // readers keep using the old file until they map the new one
+    std::string temporary = path + ".tmp";
+    if (!out.writeFile(temporary) || std::rename(temporary.c_str(), path.c_str()) != 0)
+    {
+        std::remove(temporary.c_str());
+        throw exception("Unable to write the index file '" + path + "'");
+    }
+
+    stats.files = files.size();
+    stats.symbols = symbols.size();
+    stats.references = byTarget.size();
+    return stats;
+}
+
+//
+// Queries
+//
+
+RepositoryIndex::RepositoryIndex( const std::string &path ) : size_(0)
+{
+    data_ = mapFile(path, size_);
+    IndexView view;
+    if (!makeView(data_, size_, view))
+    {
+        if (data_ != nullptr) munmap((void*) data_, size_);
+        throw exception("Invalid index file '" + path + "'");
+    }
+}
+
+RepositoryIndex::~RepositoryIndex()
+{
+    munmap((void*) data_, size_);
+}
+
+static int compareText( const IndexView &view, uint32_t offset, uint32_t length, const char *text, size_t size )
+{
+    int result = std::memcmp(view.strings + offset, text, std::min((size_t) length, size));
+    if (result != 0) return result;
+    return (length < size) ? -1 : (length > size ? 1 : 0);
+}
+
+static int compareName( const IndexView &view, const SymbolRecord &symbol, const char *name, size_t size )
+{
+    return compareText(view, symbol.name, symbol.nameSize, name, size);
+}
+
+// index of the first symbol whose name is not less than 'name'
+static uint32_t lowerBound( const IndexView &view, const char *name, size_t size )
+{
+    uint32_t first = 0, count = view.header->symbols;
+    while (count > 0)
+    {
+        uint32_t step = count / 2;
+        if (compareName(view, view.symbols[first + step], name, size) < 0)
+        {
+            first += step + 1;
+            count -= step + 1;
+        }
+        else
+            count = step;
+    }
+    return first;
+}
+
+IndexedSymbol RepositoryIndex::symbol( uint32_t index ) const
+{
+    IndexView view = layout(data_);
+    const SymbolRecord &record = view.symbols[index];
+    const FileRecord &file = view.files[record.file];
+    return IndexedSymbol{view.text(record.name, record.nameSize), (SymbolKind) record.kind,
+        view.text(file.path, file.pathSize)};
+}
+
+int64_t RepositoryIndex::lookup( const std::string &name ) const
+{
+    IndexView view = layout(data_);
+    uint32_t index = lowerBound(view, name.data(), name.size());
+    if (index < view.header->symbols && compareName(view, view.symbols[index], name.data(), name.size()) == 0)
+        return index;
+    return -1;
+}
+
+bool RepositoryIndex::find( const std::string &name, IndexedSymbol &symbol ) const
+{
+    int64_t index = lookup(name);
+    if (index < 0) return false;
+    symbol = this->symbol((uint32_t) index);
+    return true;
+}
+
+std::vector<IndexedSymbol> RepositoryIndex::search( const std::string &prefix ) const
+{
+    IndexView view = layout(data_);
+    std::vector<IndexedSymbol> result;
+    for (uint32_t i = lowerBound(view, prefix.data(), prefix.size()); i < view.header->symbols; ++i)
+    {
+        const SymbolRecord &record = view.symbols[i];
+        if (record.nameSize < prefix.size() || std::memcmp(view.strings + record.name, prefix.data(), prefix.size()) != 0)
+            break;
+        result.push_back(symbol(i));
+    }
+    return result;
+}
+
+std::vector<IndexedSymbol> RepositoryIndex::references( const std::string &name ) const
+{
+    std::vector<IndexedSymbol> result;
+    int64_t index = lookup(name);
+    if (index < 0) return result;
+    IndexView view = layout(data_);
+    // duplicated names are declared by different symbols
+    for (uint32_t i = (uint32_t) index; i < view.header->symbols &&
+        compareName(view, view.symbols[i], name.data(), name.size()) == 0; ++i)
+    {
+        const EdgeRecord *end = view.byTarget + view.header->edges;
+        const EdgeRecord *it = std::lower_bound(view.byTarget, end, i,
+            [](const EdgeRecord &edge, uint32_t target) { return edge.target < target; });
+        for (; it != end && it->target == i; ++it) result.push_back(symbol(it->source));
+    }
+    return result;
+}
+
+std::vector<IndexedSymbol> RepositoryIndex::dependencies( const std::string &name ) const
+{
+    std::vector<IndexedSymbol> result;
+    int64_t index = lookup(name);
+    if (index < 0) return result;
+    IndexView view = layout(data_);
+    // duplicated names are declared by different symbols
+    for (uint32_t i = (uint32_t) index; i < view.header->symbols &&
+        compareName(view, view.symbols[i], name.data(), name.size()) == 0; ++i)
+    {
+        const EdgeRecord *end = view.bySource + view.header->edges;
+        const EdgeRecord *it = std::lower_bound(view.bySource, end, i,
+            [](const EdgeRecord &edge, uint32_t source) { return edge.source < source; });
+        for (; it != end && it->source == i; ++it) result.push_back(symbol(it->target));
+    }
+    return result;
+}
+
+std::vector<IndexedSymbol> RepositoryIndex::declarations( const std::string &file ) const
+{
+    std::vector<IndexedSymbol> result;
+    IndexView view = layout(data_);
+    const FileRecord *end = view.files + view.header->files;
+    const FileRecord *it = std::lower_bound(view.files, end, file, [&view](const FileRecord &record, const std::string &path)
+        { return compareText(view, record.path, record.pathSize, path.data(), path.size()) < 0; });
+    if (it == end || compareText(view, it->path, it->pathSize, file.data(), file.size()) != 0) return result;
+    for (uint32_t i = 0; i < it->declarationCount; ++i)
+        result.push_back(symbol(view.declarations[it->firstDeclaration + i].symbol));
+    return result;
+}
+
+std::string RepositoryIndex::root() const
+{
+    IndexView view = layout(data_);
+    return view.text(view.header->root, view.header->rootSize);
+}
+
+size_t RepositoryIndex::fileCount() const
+{
+    return ((const IndexHeader*) data_)->files;
+}
+
+size_t RepositoryIndex::symbolCount() const
+{
+    return ((const IndexHeader*) data_)->symbols;
+}
+
+} // protop
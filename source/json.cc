@@ -0,0 +1,1203 @@
+/*
+ * Copyright 2020-2022 Bruno Ribeiro <https://github.com/brunexgeek>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <protop/json.hh>
+#include "wire.hh"
+#include "number.hh"
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+// number of fields whose spans are kept in the stack when converting a message
+#define MAX_LOCAL_SLOTS  64
+// same limit as 'DynamicMessage::decode'
+#define MAX_JSON_DEPTH   100
+
+#define IS_JSON_LITERAL(x)  ( ((x) >= '0' && (x) <= '9') || ((x) >= 'a' && (x) <= 'z') || \
+                              ((x) >= 'A' && (x) <= 'Z') || (x) == '-' || (x) == '+' || (x) == '.' )
+
+namespace protop {
+
+/*
+ * Open addressing hash table mapping names to integers. Lookups work directly
+ * on the input buffer, so no string is created to find a key.
+ */
+class NameTable
+{
+    public:
+        void add( const std::string &name, int value )
+        {
+            names_.push_back(name);
+            values_.push_back(value);
+        }
+
+        void build()
+        {
+            size_t size = 8;
+            while (size < names_.size() * 2) size <<= 1;
+            buckets_.assign(size, -1);
+            for (size_t i = 0; i < names_.size(); ++i)
+            {
+                size_t pos = hash(names_[i].data(), names_[i].size()) & (size - 1);
+                while (buckets_[pos] >= 0) pos = (pos + 1) & (size - 1);
+                buckets_[pos] = (int) i;
+            }
+        }
+
+        bool find( const char *name, size_t length, int &value ) const
+        {
+            size_t mask = buckets_.size() - 1;
+            size_t pos = hash(name, length) & mask;
+            while (buckets_[pos] >= 0)
+            {
+                const std::string &item = names_[(size_t) buckets_[pos]];
+                if (item.size() == length && std::memcmp(item.data(), name, length) == 0)
+                {
+                    value = values_[(size_t) buckets_[pos]];
+                    return true;
+                }
+                pos = (pos + 1) & mask;
+            }
+            return false;
+        }
+
+    private:
+        std::vector<std::string> names_;
+        std::vector<int> values_;
+        std::vector<int> buckets_;
+
+        static size_t hash( const char *name, size_t length )
+        {
+            // FNV-1a
+            uint32_t value = 2166136261U;
+            for (size_t i = 0; i < length; ++i)
+                value = (value ^ (uint8_t) name[i]) * 16777619U;
+            return value;
+        }
+};
+
+struct EnumTable
+{
+    NameTable names;
+    // constant value and its quoted name, sorted by value
+    std::vector<std::pair<int, std::string>> values;
+
+    const std::string *find( int value ) const
+    {
+        auto it = std::lower_bound(values.begin(), values.end(), value,
+            [](const std::pair<int, std::string> &item, int value) { return item.first < value; });
+        if (it == values.end() || it->first != value) return nullptr;
+        return &it->second;
+    }
+};
+
+struct MessageTable
+{
+    // JSON and original field names to slot
+    NameTable names;
+    // quoted JSON name followed by colon for each slot
+    std::vector<std::string> keys;
+    // enumeration table for each slot (if any)
+    std::vector<const EnumTable*> enums;
+};
+
+struct JsonTables
+{
+    std::vector<MessageTable> messages;
+    std::list<EnumTable> enums;
+};
+
+static std::string jsonName( const std::string &name )
+{
+    std::string out;
+    bool upper = false;
+    for (auto c : name)
+    {
+        if (c == '_')
+            upper = true;
+        else
+        {
+            out += (upper && c >= 'a' && c <= 'z') ? (char) (c - 'a' + 'A') : c;
+            upper = false;
+        }
+    }
+    return out;
+}
+
+JsonTranscoder::JsonTranscoder( const Codec &codec ) : tables_(std::make_shared<JsonTables>())
+{
+    std::unordered_map<const Enum*, const EnumTable*> enums;
+
+    tables_->messages.resize(codec.messages().size());
+    for (auto mc : codec.messages())
+    {
+        MessageTable &table = tables_->messages[mc->index];
+        for (auto &fc : mc->fields)
+        {
+            auto name = jsonName(fc.field->name);
+            table.names.add(name, (int) fc.slot);
+            if (name != fc.field->name) table.names.add(fc.field->name, (int) fc.slot);
+            table.keys.push_back('"' + name + "\":");
+
+            const EnumTable *et = nullptr;
+            if (fc.eref != nullptr)
+            {
+                auto it = enums.find(fc.eref.get());
+                if (it == enums.end())
+                {
+                    tables_->enums.push_back(EnumTable());
+                    EnumTable &entry = tables_->enums.back();
+                    for (auto constant : fc.eref->constants)
+                    {
+                        entry.names.add(constant->name, constant->value);
+                        entry.values.push_back(std::make_pair(constant->value, '"' + constant->name + '"'));
+                    }
+                    entry.names.build();
+                    // keep the first name declared for aliased values
+                    std::stable_sort(entry.values.begin(), entry.values.end(),
+                        [](const std::pair<int, std::string> &a, const std::pair<int, std::string> &b) { return a.first < b.first; });
+                    entry.values.erase(std::unique(entry.values.begin(), entry.values.end(),
+                        [](const std::pair<int, std::string> &a, const std::pair<int, std::string> &b) { return a.first == b.first; }),
+                        entry.values.end());
+                    et = &entry;
+                    enums[fc.eref.get()] = et;
+                }
+                else
+                    et = it->second;
+            }
+            table.enums.push_back(et);
+        }
+        table.names.build();
+    }
+}
+
+//
+// Output buffer
+//
+
+struct Output
+{
+    uint8_t *data;
+    size_t capacity;
+    // logical length (keeps growing after the buffer is full)
+    size_t length;
+    bool overflow;
+
+    Output( uint8_t *data, size_t capacity ) : data(data), capacity(capacity), length(0),
+        overflow(false)
+    {
+    }
+
+    inline void put( char value )
+    {
+        if (!overflow && length < capacity)
+            data[length] = (uint8_t) value;
+        else
+            overflow = true;
+        ++length;
+    }
+
+    inline void write( const void *value, size_t size )
+    {
+        if (!overflow && size <= capacity - length)
+            std::memcpy(data + length, value, size);
+        else
+            overflow = true;
+        length += size;
+    }
+
+    inline void write( const std::string &value )
+    {
+        write(value.data(), value.size());
+    }
+
+    // insert bytes at a previous position, moving everything after it
+    void insert( size_t pos, const uint8_t *value, size_t size )
+    {
+        if (!overflow && size <= capacity - length)
+        {
+            std::memmove(data + pos + size, data + pos, length - pos);
+            std::memcpy(data + pos, value, size);
+        }
+        else
+            overflow = true;
+        length += size;
+    }
+};
+
+static const char DIGITS[] =
+    "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+    "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+static void writeUInt( Output &out, uint64_t value )
+{
+    char buffer[24];
+    char *ptr = buffer + sizeof(buffer);
+    while (value >= 100)
+    {
+        size_t pos = (size_t) (value % 100) * 2;
+        value /= 100;
+        *--ptr = DIGITS[pos + 1];
+        *--ptr = DIGITS[pos];
+    }
+    if (value >= 10)
+    {
+        size_t pos = (size_t) value * 2;
+        *--ptr = DIGITS[pos + 1];
+        *--ptr = DIGITS[pos];
+    }
+    else
+        *--ptr = (char) ('0' + value);
+    out.write(ptr, (size_t) (buffer + sizeof(buffer) - ptr));
+}
+
+static void writeInt( Output &out, int64_t value )
+{
+    if (value < 0)
+    {
+        out.put('-');
+        writeUInt(out, 0 - (uint64_t) value);
+    }
+    else
+        writeUInt(out, (uint64_t) value);
+}
+
+static void writeReal( Output &out, double value, bool single )
+{
+    if (std::isnan(value))
+    {
+        out.write("\"NaN\"", 5);
+        return;
+    }
+    if (std::isinf(value))
+    {
+        if (value < 0)
+            out.write("\"-Infinity\"", 11);
+        else
+            out.write("\"Infinity\"", 10);
+        return;
+    }
+    // integral values do not need 'formatReal'
+    if (value == std::trunc(value) && std::fabs(value) < 1e15 && !std::signbit(value))
+    {
+        writeUInt(out, (uint64_t) value);
+        return;
+    }
+    if (value == std::trunc(value) && std::fabs(value) < 1e15 && value != 0)
+    {
+        writeInt(out, (int64_t) value);
+        return;
+    }
+
+    char buffer[32];
+    out.write(buffer, formatReal(buffer, value, single));
+}
+
+static void writeString( Output &out, const uint8_t *ptr, size_t size )
+{
+    static const char HEX[] = "0123456789abcdef";
+    const uint8_t *end = ptr + size;
+
+    out.put('"');
+    while (ptr < end)
+    {
+        // copy runs of characters that need no escaping at once
+        const uint8_t *start = ptr;
+        while (ptr < end && *ptr >= 0x20 && *ptr != '"' && *ptr != '\\') ++ptr;
+        if (ptr > start) out.write(start, (size_t) (ptr - start));
+        if (ptr == end) break;
+
+        char escape[6] = { '\\', 0, 0, 0, 0, 0 };
+        size_t length = 2;
+        switch (*ptr)
+        {
+            case '"':  escape[1] = '"'; break;
+            case '\\': escape[1] = '\\'; break;
+            case '\b': escape[1] = 'b'; break;
+            case '\f': escape[1] = 'f'; break;
+            case '\n': escape[1] = 'n'; break;
+            case '\r': escape[1] = 'r'; break;
+            case '\t': escape[1] = 't'; break;
+            default:
+                escape[1] = 'u';
+                escape[2] = '0';
+                escape[3] = '0';
+                escape[4] = HEX[*ptr >> 4];
+                escape[5] = HEX[*ptr & 0xF];
+                length = 6;
+        }
+        out.write(escape, length);
+        ++ptr;
+    }
+    out.put('"');
+}
+
+static const char BASE64[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+static void writeBase64( Output &out, const uint8_t *ptr, size_t size )
+{
+    out.put('"');
+    const uint8_t *end = ptr + size;
+    while (end - ptr >= 3)
+    {
+        char chunk[4] = {
+            BASE64[ptr[0] >> 2],
+            BASE64[((ptr[0] & 3) << 4) | (ptr[1] >> 4)],
+            BASE64[((ptr[1] & 15) << 2) | (ptr[2] >> 6)],
+            BASE64[ptr[2] & 63] };
+        out.write(chunk, 4);
+        ptr += 3;
+    }
+    if (end - ptr == 2)
+    {
+        char chunk[4] = {
+            BASE64[ptr[0] >> 2],
+            BASE64[((ptr[0] & 3) << 4) | (ptr[1] >> 4)],
+            BASE64[(ptr[1] & 15) << 2],
+            '=' };
+        out.write(chunk, 4);
+    }
+    else
+    if (end - ptr == 1)
+    {
+        char chunk[4] = {
+            BASE64[ptr[0] >> 2],
+            BASE64[(ptr[0] & 3) << 4],
+            '=', '=' };
+        out.write(chunk, 4);
+    }
+    out.put('"');
+}
+
+//
+// Wire format to JSON
+//
+
+static inline const uint8_t *skipWireValue( const uint8_t *ptr, const uint8_t *end, int wire )
+{
+    uint64_t value;
+    switch (wire)
+    {
+        case WIRE_VARINT:
+            return readVarint(ptr, end, value);
+        case WIRE_FIXED64:
+            if (end - ptr < 8) throw exception("Truncated fixed64 value");
+            return ptr + 8;
+        case WIRE_LENGTH:
+            ptr = readVarint(ptr, end, value);
+            if (value > (uint64_t) (end - ptr))
+                throw exception("Truncated length-delimited value");
+            return ptr + value;
+        case WIRE_FIXED32:
+            if (end - ptr < 4) throw exception("Truncated fixed32 value");
+            return ptr + 4;
+        default:
+            throw exception("Unsupported wire type " + std::to_string(wire));
+    }
+}
+
+static inline const uint8_t *readScalar( const FieldCodec &fc, const uint8_t *ptr, const uint8_t *end,
+    uint64_t &value )
+{
+    if (fc.wire == WIRE_VARINT)
+    {
+        ptr = readVarint(ptr, end, value);
+        value = fromVarint(fc, value);
+        return ptr;
+    }
+    if (fc.wire == WIRE_FIXED64)
+    {
+        if (end - ptr < 8) throw exception("Truncated fixed64 value");
+        value = readFixed64(ptr);
+        return ptr + 8;
+    }
+    if (end - ptr < 4) throw exception("Truncated fixed32 value");
+    value = fromFixed32(fc, readFixed32(ptr));
+    return ptr + 4;
+}
+
+static void writeScalar( Output &out, const FieldCodec &fc, const EnumTable *et, uint64_t value )
+{
+    switch (fc.type)
+    {
+        case TYPE_DOUBLE:
+        {
+            double temp;
+            std::memcpy(&temp, &value, sizeof(temp));
+            writeReal(out, temp, false);
+            break;
+        }
+        case TYPE_FLOAT:
+        {
+            uint32_t bits = (uint32_t) value;
+            float temp;
+            std::memcpy(&temp, &bits, sizeof(temp));
+            writeReal(out, temp, true);
+            break;
+        }
+        case TYPE_INT64:
+        case TYPE_SINT64:
+        case TYPE_SFIXED64:
+            out.put('"');
+            writeInt(out, (int64_t) value);
+            out.put('"');
+            break;
+        case TYPE_UINT64:
+        case TYPE_FIXED64:
+            out.put('"');
+            writeUInt(out, value);
+            out.put('"');
+            break;
+        case TYPE_UINT32:
+        case TYPE_FIXED32:
+            writeUInt(out, value);
+            break;
+        case TYPE_BOOL:
+            if (value != 0)
+                out.write("true", 4);
+            else
+                out.write("false", 5);
+            break;
+        case TYPE_COMPLEX:
+        {
+            const std::string *name = (et == nullptr) ? nullptr : et->find((int) value);
+            if (name != nullptr)
+                out.write(*name);
+            else
+                writeInt(out, (int64_t) value);
+            break;
+        }
+        default:
+            writeInt(out, (int64_t) value);
+    }
+}
+
+static void writeMessage( const JsonTables &tables, Output &out, const MessageCodec &mc,
+    const uint8_t *data, const uint8_t *end, int depth );
+
+// write the value of a field whose key was already consumed
+static const uint8_t *writeFieldValue( const JsonTables &tables, Output &out, const FieldCodec &fc,
+    const EnumTable *et, const uint8_t *ptr, const uint8_t *end, int depth )
+{
+    if (fc.wire == WIRE_LENGTH)
+    {
+        uint64_t length;
+        ptr = readVarint(ptr, end, length);
+        if (length > (uint64_t) (end - ptr))
+            throw exception("Truncated length-delimited value");
+        if (fc.message != nullptr)
+            writeMessage(tables, out, *fc.message, ptr, ptr + length, depth + 1);
+        else
+        if (fc.type == TYPE_BYTES)
+            writeBase64(out, ptr, (size_t) length);
+        else
+            writeString(out, ptr, (size_t) length);
+        return ptr + length;
+    }
+
+    uint64_t value;
+    ptr = readScalar(fc, ptr, end, value);
+    writeScalar(out, fc, et, value);
+    return ptr;
+}
+
+struct Span
+{
+    const uint8_t *first;
+    const uint8_t *last;
+};
+
+static void writeMessage( const JsonTables &tables, Output &out, const MessageCodec &mc,
+    const uint8_t *data, const uint8_t *end, int depth )
+{
+    if (depth >= MAX_JSON_DEPTH)
+        throw exception("Nesting depth exceeds " + std::to_string(MAX_JSON_DEPTH) + " levels");
+    const MessageTable &table = tables.messages[mc.index];
+    size_t count = mc.fields.size();
+
+    // first pass: find the first and last occurrence of each field
+    Span local[MAX_LOCAL_SLOTS];
+    std::vector<Span> heap;
+    Span *spans = local;
+    if (count > MAX_LOCAL_SLOTS)
+    {
+        heap.resize(count);
+        spans = &heap[0];
+    }
+    for (size_t i = 0; i < count; ++i) spans[i].first = spans[i].last = nullptr;
+
+    const uint8_t *ptr = data;
+    while (ptr < end)
+    {
+        const uint8_t *start = ptr;
+        uint64_t key;
+        ptr = readVarint(ptr, end, key);
+        int wire = (int) (key & 7);
+        ptr = skipWireValue(ptr, end, wire);
+
+        const FieldCodec *fc = mc.find((int) (key >> 3));
+        if (fc != nullptr && (wire == fc->wire || (wire == WIRE_LENGTH && fc->packed)))
+        {
+            Span &span = spans[fc->slot];
+            if (span.first == nullptr) span.first = start;
+            span.last = start;
+        }
+    }
+
+    // second pass: write fields in declaration order
+    out.put('{');
+    bool comma = false;
+    for (auto &fc : mc.fields)
+    {
+        const Span &span = spans[fc.slot];
+        if (span.first == nullptr) continue;
+        const EnumTable *et = table.enums[fc.slot];
+
+        if (!fc.repeated && fc.message != nullptr && span.first != span.last)
+        {
+            // occurrences of a singular message are merged, which for the wire
+            // format is the same as concatenating their contents
+            std::string merged;
+            ptr = span.first;
+            while (ptr <= span.last)
+            {
+                uint64_t key;
+                ptr = readVarint(ptr, end, key);
+                int wire = (int) (key & 7);
+                if ((int) (key >> 3) != fc.number || wire != fc.wire)
+                {
+                    ptr = skipWireValue(ptr, end, wire);
+                    continue;
+                }
+                uint64_t length;
+                ptr = readVarint(ptr, end, length);
+                merged.append((const char*) ptr, (size_t) length);
+                ptr += length;
+            }
+            if (comma) out.put(',');
+            out.write(table.keys[fc.slot]);
+            const uint8_t *first = (const uint8_t*) merged.data();
+            writeMessage(tables, out, *fc.message, first, first + merged.size(), depth + 1);
+            comma = true;
+            continue;
+        }
+
+        if (!fc.repeated)
+        {
+            // the last occurrence wins
+            ptr = span.last;
+            uint64_t key;
+            ptr = readVarint(ptr, end, key);
+            if (fc.message == nullptr)
+            {
+                // omit default values
+                uint64_t value;
+                if (fc.wire == WIRE_LENGTH)
+                    readVarint(ptr, end, value);
+                else
+                    readScalar(fc, ptr, end, value);
+                if (value == 0) continue;
+            }
+            if (comma) out.put(',');
+            out.write(table.keys[fc.slot]);
+            writeFieldValue(tables, out, fc, et, ptr, end, depth);
+            comma = true;
+            continue;
+        }
+
+        if (comma) out.put(',');
+        out.write(table.keys[fc.slot]);
+        out.put('[');
+        bool first = true;
+        ptr = span.first;
+        while (ptr <= span.last)
+        {
+            uint64_t key;
+            ptr = readVarint(ptr, end, key);
+            int wire = (int) (key & 7);
+            if ((int) (key >> 3) != fc.number || (wire != fc.wire && !(wire == WIRE_LENGTH && fc.packed)))
+            {
+                ptr = skipWireValue(ptr, end, wire);
+                continue;
+            }
+            if (wire != fc.wire)
+            {
+                // packed block
+                uint64_t length;
+                ptr = readVarint(ptr, end, length);
+                const uint8_t *last = ptr + length;
+                while (ptr < last)
+                {
+                    uint64_t value;
+                    ptr = readScalar(fc, ptr, last, value);
+                    if (!first) out.put(',');
+                    writeScalar(out, fc, et, value);
+                    first = false;
+                }
+                continue;
+            }
+            if (!first) out.put(',');
+            ptr = writeFieldValue(tables, out, fc, et, ptr, end, depth);
+            first = false;
+        }
+        out.put(']');
+        comma = true;
+    }
+    out.put('}');
+}
+
+size_t JsonTranscoder::toJson( const MessageCodec &message, const uint8_t *data, size_t size,
+    char *out, size_t capacity ) const
+{
+    Output output((uint8_t*) out, capacity);
+    writeMessage(*tables_, output, message, data, data + size, 0);
+    return output.length;
+}
+
+//
+// JSON to wire format
+//
+
+struct Input
+{
+    const char *begin;
+    const char *ptr;
+    const char *end;
+
+    Input( const char *data, size_t size ) : begin(data), ptr(data), end(data + size)
+    {
+    }
+
+    [[noreturn]] void error( const std::string &message ) const
+    {
+        int line = 1, column = 1;
+        for (const char *cur = begin; cur < ptr && cur < end; ++cur)
+        {
+            if (*cur == '\n')
+            {
+                ++line;
+                column = 1;
+            }
+            else
+                ++column;
+        }
+        throw exception(message, line, column);
+    }
+
+    inline void skipws()
+    {
+        while (ptr < end && (*ptr == ' ' || *ptr == '\t' || *ptr == '\n' || *ptr == '\r')) ++ptr;
+    }
+
+    inline int peek() const
+    {
+        return (ptr < end) ? (uint8_t) *ptr : -1;
+    }
+
+    inline void expect( char value )
+    {
+        if (ptr >= end || *ptr != value)
+            error(std::string("Expected '") + value + "'");
+        ++ptr;
+    }
+
+    inline bool consume( const char *literal, size_t size )
+    {
+        if ((size_t) (end - ptr) < size || std::memcmp(ptr, literal, size) != 0) return false;
+        ptr += size;
+        return true;
+    }
+};
+
+static void appendUtf8( std::string &out, uint32_t code )
+{
+    if (code < 0x80)
+        out += (char) code;
+    else
+    if (code < 0x800)
+    {
+        out += (char) (0xC0 | (code >> 6));
+        out += (char) (0x80 | (code & 0x3F));
+    }
+    else
+    if (code < 0x10000)
+    {
+        out += (char) (0xE0 | (code >> 12));
+        out += (char) (0x80 | ((code >> 6) & 0x3F));
+        out += (char) (0x80 | (code & 0x3F));
+    }
+    else
+    {
+        out += (char) (0xF0 | (code >> 18));
+        out += (char) (0x80 | ((code >> 12) & 0x3F));
+        out += (char) (0x80 | ((code >> 6) & 0x3F));
+        out += (char) (0x80 | (code & 0x3F));
+    }
+}
+
+static uint32_t parseHex4( Input &in )
+{
+    if (in.end - in.ptr < 4) in.error("Truncated unicode escape");
+    uint32_t code = 0;
+    for (int i = 0; i < 4; ++i)
+    {
+        char c = *in.ptr++;
+        code <<= 4;
+        if (c >= '0' && c <= '9') code |= (uint32_t) (c - '0');
+        else
+        if (c >= 'a' && c <= 'f') code |= (uint32_t) (c - 'a' + 10);
+        else
+        if (c >= 'A' && c <= 'F') code |= (uint32_t) (c - 'A' + 10);
+        else
+            in.error("Invalid unicode escape");
+    }
+    return code;
+}
+
+/*
+ * Parse a JSON string. If the string has no escape sequences, the result points
+ * to the input buffer; otherwise the string is decoded into 'temp'.
+ */
+static void parseString( Input &in, std::string &temp, const char *&value, size_t &size )
+{
+    in.expect('"');
+    const char *start = in.ptr;
+    while (in.ptr < in.end && *in.ptr != '"' && *in.ptr != '\\') ++in.ptr;
+    if (in.ptr >= in.end) in.error("Unterminated string");
+    if (*in.ptr == '"')
+    {
+        value = start;
+        size = (size_t) (in.ptr - start);
+        ++in.ptr;
+        return;
+    }
+
+    temp.assign(start, (size_t) (in.ptr - start));
+    while (true)
+    {
+        if (in.ptr >= in.end) in.error("Unterminated string");
+        char c = *in.ptr++;
+        if (c == '"') break;
+        if (c != '\\')
+        {
+            temp += c;
+            continue;
+        }
+        if (in.ptr >= in.end) in.error("Unterminated string");
+        c = *in.ptr++;
+        switch (c)
+        {
+            case '"':  temp += '"'; break;
+            case '\\': temp += '\\'; break;
+            case '/':  temp += '/'; break;
+            case 'b':  temp += '\b'; break;
+            case 'f':  temp += '\f'; break;
+            case 'n':  temp += '\n'; break;
+            case 'r':  temp += '\r'; break;
+            case 't':  temp += '\t'; break;
+            case 'u':
+            {
+                uint32_t code = parseHex4(in);
+                if (code >= 0xD800 && code < 0xDC00)
+                {
+                    // surrogate pair
+                    if (!in.consume("\\u", 2)) in.error("Missing low surrogate");
+                    uint32_t low = parseHex4(in);
+                    if (low < 0xDC00 || low > 0xDFFF) in.error("Invalid low surrogate");
+                    code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+                }
+                appendUtf8(temp, code);
+                break;
+            }
+            default:
+                in.error("Invalid escape sequence");
+        }
+    }
+    value = temp.data();
+    size = temp.size();
+}
+
+static void skipJsonValue( Input &in, int depth )
+{
+    if (depth >= MAX_JSON_DEPTH) in.error("Nesting depth exceeds " + std::to_string(MAX_JSON_DEPTH) + " levels");
+    in.skipws();
+    int c = in.peek();
+    if (c == '"')
+    {
+        std::string temp;
+        const char *value;
+        size_t size;
+        parseString(in, temp, value, size);
+    }
+    else
+    if (c == '{' || c == '[')
+    {
+        char close = (c == '{') ? '}' : ']';
+        ++in.ptr;
+        in.skipws();
+        if (in.peek() == close)
+        {
+            ++in.ptr;
+            return;
+        }
+        while (true)
+        {
+            if (close == '}')
+            {
+                in.skipws();
+                skipJsonValue(in, depth + 1);
+                in.skipws();
+                in.expect(':');
+            }
+            skipJsonValue(in, depth + 1);
+            in.skipws();
+            if (in.peek() == ',')
+            {
+                ++in.ptr;
+                continue;
+            }
+            in.expect(close);
+            break;
+        }
+    }
+    else
+    {
+        const char *start = in.ptr;
+        while (in.ptr < in.end && (IS_JSON_LITERAL(*in.ptr))) ++in.ptr;
+        if (in.ptr == start) in.error("Invalid value");
+    }
+}
+
+static int base64Value( char c )
+{
+    if (c >= 'A' && c <= 'Z') return c - 'A';
+    if (c >= 'a' && c <= 'z') return c - 'a' + 26;
+    if (c >= '0' && c <= '9') return c - '0' + 52;
+    if (c == '+' || c == '-') return 62;
+    if (c == '/' || c == '_') return 63;
+    return -1;
+}
+
+static void writeBinary( Input &in, Output &out, const char *ptr, size_t size )
+{
+    // padding is optional
+    while (size > 0 && ptr[size - 1] == '=') --size;
+    if (size % 4 == 1) in.error("Invalid base64 value");
+
+    uint8_t buffer[3];
+    uint32_t bits = 0;
+    int count = 0;
+    for (size_t i = 0; i < size; ++i)
+    {
+        int value = base64Value(ptr[i]);
+        if (value < 0) in.error("Invalid base64 value");
+        bits = (bits << 6) | (uint32_t) value;
+        if (++count == 4)
+        {
+            buffer[0] = (uint8_t) (bits >> 16);
+            buffer[1] = (uint8_t) (bits >> 8);
+            buffer[2] = (uint8_t) bits;
+            out.write(buffer, 3);
+            bits = 0;
+            count = 0;
+        }
+    }
+    if (count == 3)
+    {
+        buffer[0] = (uint8_t) (bits >> 10);
+        buffer[1] = (uint8_t) (bits >> 2);
+        out.write(buffer, 2);
+    }
+    else
+    if (count == 2)
+    {
+        buffer[0] = (uint8_t) (bits >> 4);
+        out.write(buffer, 1);
+    }
+}
+
+// parse a number or a boolean into the representation used by 'DynamicField'
+static uint64_t parseScalar( Input &in, const FieldCodec &fc, const EnumTable *et )
+{
+    if (fc.type == TYPE_BOOL)
+    {
+        if (in.consume("true", 4)) return 1;
+        if (in.consume("false", 5)) return 0;
+        in.error("Invalid boolean value");
+    }
+
+    // numbers may be quoted
+    std::string temp;
+    const char *value;
+    size_t size;
+    if (in.peek() == '"')
+        parseString(in, temp, value, size);
+    else
+    {
+        value = in.ptr;
+        while (in.ptr < in.end && IS_JSON_LITERAL(*in.ptr)) ++in.ptr;
+        size = (size_t) (in.ptr - value);
+    }
+
+    if (fc.type == TYPE_COMPLEX && et != nullptr)
+    {
+        int number;
+        if (et->names.find(value, size, number)) return (uint64_t) (int64_t) number;
+    }
+
+    char buffer[64];
+    if (size == 0 || size >= sizeof(buffer)) in.error("Invalid numeric value");
+    std::memcpy(buffer, value, size);
+    buffer[size] = 0;
+
+    if (fc.type == TYPE_DOUBLE || fc.type == TYPE_FLOAT)
+    {
+        double real;
+        if (std::strcmp(buffer, "NaN") == 0)
+            real = NAN;
+        else
+        if (std::strcmp(buffer, "Infinity") == 0)
+            real = INFINITY;
+        else
+        if (std::strcmp(buffer, "-Infinity") == 0)
+            real = -INFINITY;
+        else
+        {
+            char *last;
+            real = scanReal(buffer, &last);
+            if (*last != 0) in.error("Invalid numeric value");
+        }
+        uint64_t bits;
+        if (fc.type == TYPE_FLOAT)
+        {
+            float single = (float) real;
+            uint32_t temp32;
+            std::memcpy(&temp32, &single, sizeof(temp32));
+            bits = temp32;
+        }
+        else
+            std::memcpy(&bits, &real, sizeof(bits));
+        return bits;
+    }
+
+    bool is_unsigned = fc.type == TYPE_UINT32 || fc.type == TYPE_UINT64 || fc.type == TYPE_FIXED32 ||
+        fc.type == TYPE_FIXED64;
+    bool is_64 = fc.type == TYPE_INT64 || fc.type == TYPE_UINT64 || fc.type == TYPE_SINT64 ||
+        fc.type == TYPE_FIXED64 || fc.type == TYPE_SFIXED64;
+
+    char *last;
+    errno = 0;
+    uint64_t result;
+    if (std::strpbrk(buffer, ".eE") != nullptr)
+    {
+        // exponent notation is accepted for integral values
+        double real = scanReal(buffer, &last);
+        if (*last != 0 || real != std::trunc(real)) in.error("Invalid integer value");
+        // the conversion is undefined outside the range of the target type
+        if (is_unsigned)
+        {
+            if (!(real >= 0 && real < 18446744073709551616.0)) in.error("Integer value out of range");
+            result = (uint64_t) real;
+        }
+        else
+        {
+            if (!(real >= -9223372036854775808.0 && real < 9223372036854775808.0))
+                in.error("Integer value out of range");
+            result = (uint64_t) (int64_t) real;
+        }
+    }
+    else
+    if (is_unsigned)
+    {
+        if (buffer[0] == '-') in.error("Invalid integer value");
+        result = strtoull(buffer, &last, 10);
+    }
+    else
+        result = (uint64_t) strtoll(buffer, &last, 10);
+    if (*last != 0 || errno == ERANGE) in.error("Invalid integer value");
+
+    if (!is_64)
+    {
+        bool valid = is_unsigned ? (result <= 0xFFFFFFFFULL) :
+            ((int64_t) result >= -2147483648LL && (int64_t) result <= 2147483647LL);
+        if (!valid) in.error("Integer value out of range");
+    }
+    return result;
+}
+
+static void writeTag( Output &out, const FieldCodec &fc )
+{
+    out.write(fc.tag, fc.tagSize);
+}
+
+static void insertLength( Output &out, size_t mark )
+{
+    uint8_t buffer[10];
+    size_t size = (size_t) (writeVarint(buffer, out.length - mark) - buffer);
+    out.insert(mark, buffer, size);
+}
+
+static void readMessage( const JsonTables &tables, Input &in, Output &out, const MessageCodec &mc, int depth );
+
+// parse a field value; default values are omitted for singular fields
+static void readValue( const JsonTables &tables, Input &in, Output &out, const FieldCodec &fc,
+    const EnumTable *et, bool repeated, int depth )
+{
+    if (fc.message != nullptr)
+    {
+        writeTag(out, fc);
+        size_t mark = out.length;
+        readMessage(tables, in, out, *fc.message, depth + 1);
+        insertLength(out, mark);
+        return;
+    }
+
+    if (fc.type == TYPE_STRING || fc.type == TYPE_BYTES)
+    {
+        std::string temp;
+        const char *value;
+        size_t size;
+        parseString(in, temp, value, size);
+        if (size == 0 && !repeated) return;
+        writeTag(out, fc);
+        uint8_t buffer[10];
+        if (fc.type == TYPE_STRING)
+        {
+            out.write(buffer, (size_t) (writeVarint(buffer, size) - buffer));
+            out.write(value, size);
+        }
+        else
+        {
+            size_t mark = out.length;
+            writeBinary(in, out, value, size);
+            insertLength(out, mark);
+        }
+        return;
+    }
+
+    uint64_t value = parseScalar(in, fc, et);
+    if (value == 0 && !repeated) return;
+    uint8_t buffer[16];
+    uint8_t *ptr = writeValue(buffer, fc, value);
+    writeTag(out, fc);
+    out.write(buffer, (size_t) (ptr - buffer));
+}
+
+static void readArray( const JsonTables &tables, Input &in, Output &out, const FieldCodec &fc,
+    const EnumTable *et, int depth )
+{
+    in.expect('[');
+    in.skipws();
+    if (in.peek() == ']')
+    {
+        ++in.ptr;
+        return;
+    }
+
+    size_t mark = 0;
+    if (fc.packed)
+    {
+        writeTag(out, fc);
+        mark = out.length;
+    }
+    while (true)
+    {
+        in.skipws();
+        if (fc.packed)
+        {
+            uint8_t buffer[16];
+            uint8_t *ptr = writeValue(buffer, fc, parseScalar(in, fc, et));
+            out.write(buffer, (size_t) (ptr - buffer));
+        }
+        else
+            readValue(tables, in, out, fc, et, true, depth);
+        in.skipws();
+        if (in.peek() == ',')
+        {
+            ++in.ptr;
+            continue;
+        }
+        in.expect(']');
+        break;
+    }
+    if (fc.packed) insertLength(out, mark);
+}
+
+static void readMessage( const JsonTables &tables, Input &in, Output &out, const MessageCodec &mc, int depth )
+{
+    if (depth >= MAX_JSON_DEPTH) in.error("Nesting depth exceeds " + std::to_string(MAX_JSON_DEPTH) + " levels");
+    const MessageTable &table = tables.messages[mc.index];
+    std::string temp;
+
+    in.skipws();
+    in.expect('{');
+    in.skipws();
+    if (in.peek() == '}')
+    {
+        ++in.ptr;
+        return;
+    }
+
+    while (true)
+    {
+        in.skipws();
+        const char *name;
+        size_t size;
+        parseString(in, temp, name, size);
+        in.skipws();
+        in.expect(':');
+        in.skipws();
+
+        int slot;
+        if (!table.names.find(name, size, slot))
+            skipJsonValue(in, depth + 1); // unknown fields are ignored
+        else
+        if (!in.consume("null", 4))
+        {
+            const FieldCodec &fc = mc.fields[(size_t) slot];
+            if (fc.repeated)
+                readArray(tables, in, out, fc, table.enums[fc.slot], depth);
+            else
+                readValue(tables, in, out, fc, table.enums[fc.slot], false, depth);
+        }
+
+        in.skipws();
+        if (in.peek() == ',')
+        {
+            ++in.ptr;
+            continue;
+        }
+        in.expect('}');
+        break;
+    }
+}
+
+size_t JsonTranscoder::toBinary( const MessageCodec &message, const char *data, size_t size,
+    uint8_t *out, size_t capacity ) const
+{
+    Input input(data, size);
+    Output output(out, capacity);
+    readMessage(*tables_, input, output, message, 0);
+    input.skipws();
+    if (input.ptr != input.end) input.error("Unexpected content after the message");
+    return output.length;
+}
+
+} // protop
@@ -0,0 +1,99 @@
+/*
+ * Copyright 2020-2022 Bruno Ribeiro <https://github.com/brunexgeek>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "number.hh"
+#include <cfloat>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <locale.h>
+#ifdef __APPLE__
+#include <xlocale.h>
+#endif
+
+namespace protop {
+
+#ifdef _WIN32
+
+static _locale_t classicLocale()
+{
+    static _locale_t locale = _create_locale(LC_NUMERIC, "C");
+    return locale;
+}
+
+#define PRINT_REAL(buffer, precision, value) \
+    _snprintf_l((buffer), 32, "%.*g", classicLocale(), (precision), (value))
+#define SCAN_REAL(text, last) \
+    _strtod_l((text), (last), classicLocale())
+
+#else
+
+static locale_t classicLocale()
+{
+    static locale_t locale = newlocale(LC_NUMERIC_MASK, "C", (locale_t) 0);
+    return locale;
+}
+
+// switches the locale of the calling thread while in scope
+class LocaleScope
+{
+    public:
+        LocaleScope() : previous_(uselocale(classicLocale())) {}
+        ~LocaleScope() { uselocale(previous_); }
+
+    private:
+        locale_t previous_;
+};
+
+#define PRINT_REAL(buffer, precision, value) \
+    snprintf((buffer), 32, "%.*g", (precision), (value))
+#define SCAN_REAL(text, last) \
+    strtod((text), (last))
+
+#endif
+
+size_t formatReal( char *buffer, double value, bool single )
+{
+#ifndef _WIN32
+    LocaleScope scope;
+#endif
+    // starts with the number of digits that always survives the round trip
+    // and adds one until the value is read back exactly (subnormal values have
+    // fewer significant digits, so they start from one)
+    double magnitude = std::fabs(value);
+    bool subnormal = magnitude > 0 && magnitude < (single ? FLT_MIN : DBL_MIN);
+    int precision = subnormal ? 1 : (single ? 6 : 15);
+    int limit = single ? 9 : 17;
+    int size;
+    for (;; ++precision)
+    {
+        size = PRINT_REAL(buffer, precision, value);
+        if (precision == limit) break;
+        double parsed = SCAN_REAL(buffer, nullptr);
+        if (single ? ((float) parsed == (float) value) : (parsed == value)) break;
+    }
+    return (size < 0) ? 0 : (size_t) size;
+}
+
+double scanReal( const char *text, char **last )
+{
+#ifndef _WIN32
+    LocaleScope scope;
+#endif
+    return SCAN_REAL(text, last);
+}
+
+} // protop
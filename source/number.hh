@@ -0,0 +1,40 @@
+/*
+ * Copyright 2020-2022 Bruno Ribeiro <https://github.com/brunexgeek>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef PROTOP_NUMBER
+#define PROTOP_NUMBER
+
+#include <cstddef>
+
+namespace protop {
+
+/*
+ * Writes the shortest representation of a finite value that reads back to the
+ * same value ('single' precision or double), always using '.' as the decimal
+ * separator regardless of the current locale. Returns the number of characters
+ * written; 'buffer' must have at least 32 characters.
+ */
+size_t formatReal( char *buffer, double value, bool single );
+
+/*
+ * Same as 'strtod', but always expects '.' as the decimal separator regardless
+ * of the current locale.
+ */
+double scanReal( const char *text, char **last );
+
+} // protop
+
+#endif // PROTOP_NUMBER
@@ -16,10 +16,14 @@
 
 #include <protop/protop.hh>
 #include "tokenizer.hh"
+#include "parser.hh"
 #include <iterator>
 #include <sstream>
 #include <list>
 #include <set>
+#include <vector>
+#include <unordered_set>
+#include <chrono>
 
 #define IS_VALID_TYPE(x)       ( (x) >= protogen::TYPE_DOUBLE && (x) <= protogen::TYPE_MESSAGE )
 #define TOKEN_POSITION(t)      (t).line, (t).column
@@ -83,12 +87,16 @@ namespace protop {
 struct Context
 {
     Tokenizer &tokens;
-    Proto &tree;
+    ParseHandler &handler;
     InputStream &is;
     std::string package;
+    // numbers and names of the fields of the current message
+    std::vector<std::pair<int, std::string>> fields;
+    // skip the declaration bodies (see 'PARSE_LAZY')
+    bool lazy;
 
-    Context( Tokenizer &tokenizer, Proto &tree, InputStream &is ) :
-        tokens(tokenizer), tree(tree), is(is)
+    Context( Tokenizer &tokenizer, ParseHandler &handler, InputStream &is, bool lazy = false ) :
+        tokens(tokenizer), handler(handler), is(is), lazy(lazy)
     {
     }
 };
@@ -125,7 +133,16 @@ static OptionEntry parseOption( Context &ctx )
 
     // option name
     ctx.tokens.next();
-    temp.name = parseName(ctx, true);
+    if (ctx.tokens.current.code == TOKEN_LPAREN)
+    {
+        // custom option (e.g. '(my.option)')
+        ctx.tokens.next();
+        temp.name = "(" + parseName(ctx, true) + ")";
+        if (ctx.tokens.next().code != TOKEN_RPAREN)
+            throw exception("Expected ')'", TOKEN_POSITION(ctx.tokens.current));
+    }
+    else
+        temp.name = parseName(ctx, true);
     // equal symbol
     if (ctx.tokens.next().code != TOKEN_EQUAL)
         throw exception("Expected '='", TOKEN_POSITION(ctx.tokens.current));
@@ -141,8 +158,27 @@ static OptionEntry parseOption( Context &ctx )
             temp.type = OptionType::IDENTIFIER; break;
         case TOKEN_INTEGER:
             temp.type = OptionType::INTEGER; break;
+        case TOKEN_REAL:
+            temp.type = OptionType::REAL; break;
         case TOKEN_STRING:
             temp.type = OptionType::STRING; break;
+        case TOKEN_MINUS:
+        {
+            // sign separated from the number (e.g. '- 1')
+            Token tt = ctx.tokens.next();
+            if (tt.code == TOKEN_INTEGER || tt.code == TOKEN_REAL)
+            {
+                if (tt.value[0] == '-') throw exception("Invalid option value", TOKEN_POSITION(tt));
+                temp.type = (tt.code == TOKEN_INTEGER) ? OptionType::INTEGER : OptionType::REAL;
+            }
+            else
+            if (tt.code == TOKEN_NAME && (tt.value == "inf" || tt.value == "nan"))
+                temp.type = OptionType::REAL;
+            else
+                throw exception("Invalid option value", TOKEN_POSITION(tt));
+            temp.value = "-" + tt.value;
+            return temp;
+        }
         default:
             throw exception("Invalid option value", TOKEN_POSITION(ctx.tokens.current));
     }
@@ -164,7 +200,7 @@ static void parseFieldOptions( Context &ctx, OptionMap &entries )
     ctx.tokens.unget();
 }
 
-static void parseStandardOption( Context &ctx, OptionMap &entries )
+static void parseStandardOption( Context &ctx )
 {
     // the token 'option' is already consumed at this point
 
@@ -174,19 +210,19 @@ static void parseStandardOption( Context &ctx, OptionMap &entries )
     if (ctx.tokens.next().code != TOKEN_SCOLON)
         throw exception("Expected '='", TOKEN_POSITION(ctx.tokens.current));
 
-    entries[option.name] = option;
+    ctx.handler.onOption(option);
 }
 
-static std::shared_ptr<Enum> findEnum( Context &ctx, const std::string &name )
+static std::shared_ptr<Enum> findEnum( const Proto &tree, const std::string &name )
 {
-    for (auto it = ctx.tree.enums.begin(); it != ctx.tree.enums.end(); ++it)
+    for (auto it = tree.enums.begin(); it != tree.enums.end(); ++it)
         if ((*it)->qname == name) return *it;
     return nullptr;
 }
 
-static std::shared_ptr<Message> findMessage( Context &ctx, const std::string &name )
+static std::shared_ptr<Message> findMessage( const Proto &tree, const std::string &name )
 {
-    for (auto it = ctx.tree.messages.begin(); it != ctx.tree.messages.end(); ++it)
+    for (auto it = tree.messages.begin(); it != tree.messages.end(); ++it)
         if ((*it)->qname == name) return *it;
     return nullptr;
 }
@@ -226,36 +262,37 @@ static void parseTypeInfo( Context &ctx, TypeInfo &type )
         throw exception("Missing type", TOKEN_POSITION(ctx.tokens.current));
 }
 
-static void parseField( Context &ctx, Message &message )
+static void parseField( Context &ctx )
 {
-    std::shared_ptr<Field> field = std::make_shared<Field>();
+    Field field;
+    field.comments.leading = ctx.tokens.current.comment;
 
     if (ctx.tokens.current.code == TOKEN_REPEATED)
     {
-        field->type.repeated = true;
+        field.type.repeated = true;
         ctx.tokens.next();
     }
     else
-        field->type.repeated = false;
+        field.type.repeated = false;
 
     // type
-    parseTypeInfo(ctx, field->type);
+    parseTypeInfo(ctx, field.type);
 
     // name
     ctx.tokens.next();
-    field->name = parseName(ctx);
+    field.name = parseName(ctx);
     // equal symbol
     if (ctx.tokens.next().code != TOKEN_EQUAL) throw exception("Expected '='", TOKEN_POSITION(ctx.tokens.current));
     // index
     if (ctx.tokens.next().code != TOKEN_INTEGER) throw exception("Missing field index", TOKEN_POSITION(ctx.tokens.current));
-    field->index = (int) strtol(ctx.tokens.current.value.c_str(), nullptr, 10);
+    field.index = (int) strtol(ctx.tokens.current.value.c_str(), nullptr, 0);
 
     ctx.tokens.next();
 
     // options
     if (ctx.tokens.current.code == TOKEN_LBRACKET)
     {
-        parseFieldOptions(ctx, field->options);
+        parseFieldOptions(ctx, field.options);
         if (ctx.tokens.next().code != TOKEN_RBRACKET)
             throw exception("Expected ']'", TOKEN_POSITION(ctx.tokens.current));
         ctx.tokens.next();
@@ -264,79 +301,116 @@ static void parseField( Context &ctx, Message &message )
     // semi-colon
     if (ctx.tokens.current.code != TOKEN_SCOLON)
         throw exception("Expected ';'", TOKEN_POSITION(ctx.tokens.current));
+    field.comments.trailing = ctx.tokens.trailing();
 
     // check for repeated field indices
-    for (auto item : message.fields)
-        if (item->index == field->index)
-            throw exception("Field '" + item->name + "' has the same index as '" + field->name + "'", CURRENT_TOKEN_POSITION);
+    for (auto &item : ctx.fields)
+        if (item.first == field.index)
+            throw exception("Field '" + item.second + "' has the same index as '" + field.name + "'", CURRENT_TOKEN_POSITION);
+    ctx.fields.push_back(std::make_pair(field.index, field.name));
 
-    message.fields.push_back(field);
+    ctx.handler.onField(field);
 }
 
-static void parseContant( Context &ctx, Enum &entity )
+static void parseContant( Context &ctx )
 {
-    std::shared_ptr<Constant> value = std::make_shared<Constant>();
+    Constant value;
 
     // name
-    value->name = parseName(ctx);
+    value.name = parseName(ctx);
     if (ctx.tokens.next().code != TOKEN_EQUAL)
         throw exception("Missing equal sign", CURRENT_TOKEN_POSITION);
     // value
     if (ctx.tokens.next().code != TOKEN_INTEGER)
         throw exception("Missing constant value", CURRENT_TOKEN_POSITION);
-    value->value = (int) strtol(ctx.tokens.current.value.c_str(), nullptr, 10);
+    value.value = (int) strtol(ctx.tokens.current.value.c_str(), nullptr, 0);
     // semicolon
     if (ctx.tokens.next().code != TOKEN_SCOLON)
         throw exception("Missing semicolon", CURRENT_TOKEN_POSITION);
 
-    entity.constants.push_back(value);
+    ctx.handler.onEnumConstant(value);
+}
+
+// records the span of the body of the current declaration and skips it
+static BodySpan skipBody( Context &ctx )
+{
+    BodySpan span;
+    span.offset = ctx.is.offset();
+    span.line = ctx.is.line();
+    span.column = ctx.is.column();
+    ctx.tokens.skipBlock();
+    span.length = ctx.is.offset() - span.offset;
+    return span;
+}
+
+// the '{' is already consumed at this point
+static void parseEnumBody( Context &ctx )
+{
+    while (ctx.tokens.next().code != TOKEN_END)
+    {
+        if (ctx.tokens.current.code == TOKEN_OPTION)
+            parseStandardOption(ctx);
+        else
+            parseContant(ctx);
+    }
 }
 
 static void parseEnum( Context &ctx )
 {
     if (ctx.tokens.current.code == TOKEN_ENUM)
     {
-        std::shared_ptr<Enum> entity = std::make_shared<Enum>();
+        Enum entity;
+        entity.comments.leading = ctx.tokens.current.comment;
 
         ctx.tokens.next();
-        entity->name = parseName(ctx);;
-        entity->qname = qualifiedName(ctx, entity->name);
+        entity.name = parseName(ctx);;
+        entity.qname = qualifiedName(ctx, entity.name);
         if (ctx.tokens.next().code != TOKEN_BEGIN)
             throw exception("Missing enum body", CURRENT_TOKEN_POSITION);
-
-        while (ctx.tokens.next().code != TOKEN_END)
-        {
-            if (ctx.tokens.current.code == TOKEN_OPTION)
-                parseStandardOption(ctx, entity->options);
-            else
-                parseContant(ctx, *entity);
-        }
-        ctx.tree.enums.push_back(entity);
+        if (ctx.lazy)
+            entity.body = skipBody(ctx);
+        else
+            entity.comments.trailing = ctx.tokens.trailing();
+        ctx.handler.onEnumBegin(entity);
+        if (!ctx.lazy) parseEnumBody(ctx);
+        ctx.handler.onEnumEnd();
     }
     else
         throw exception("Expected enum", CURRENT_TOKEN_POSITION);
 }
 
+// the '{' is already consumed at this point
+static void parseMessageBody( Context &ctx )
+{
+    ctx.fields.clear();
+    while (ctx.tokens.next().code != TOKEN_END)
+    {
+        if (ctx.tokens.current.code == TOKEN_OPTION)
+            parseStandardOption(ctx);
+        else
+            parseField(ctx);
+    }
+}
+
 static void parseMessage( Context &ctx )
 {
     if (ctx.tokens.current.code == TOKEN_MESSAGE)
     {
-        std::shared_ptr<Message> message = std::make_shared<Message>();
+        Message message;
+        message.comments.leading = ctx.tokens.current.comment;
 
         ctx.tokens.next();
-        message->name = parseName(ctx);
-        message->qname = qualifiedName(ctx, message->name);
+        message.name = parseName(ctx);
+        message.qname = qualifiedName(ctx, message.name);
         if (ctx.tokens.next().code != TOKEN_BEGIN)
             throw exception("Missing message body", CURRENT_TOKEN_POSITION);
-
-        while (ctx.tokens.next().code != TOKEN_END)
-        {
-            if (ctx.tokens.current.code == TOKEN_OPTION)
-                parseStandardOption(ctx, message->options);
-            else
-                parseField(ctx, *message);
-        }
-        ctx.tree.messages.push_back(message);
+        if (ctx.lazy)
+            message.body = skipBody(ctx);
+        else
+            message.comments.trailing = ctx.tokens.trailing();
+        ctx.handler.onMessageBegin(message);
+        if (!ctx.lazy) parseMessageBody(ctx);
+        ctx.handler.onMessageEnd();
     }
     else
         throw exception("Invalid message", CURRENT_TOKEN_POSITION);
@@ -349,11 +423,22 @@ static void parsePackage( Context &ctx )
     if ((tt.code == TOKEN_NAME || tt.code == TOKEN_QNAME) && ctx.tokens.next().code == TOKEN_SCOLON)
     {
         ctx.package = tt.value;
+        ctx.handler.onPackage(ctx.package);
     }
     else
         throw exception("Invalid package", CURRENT_TOKEN_POSITION);
 }
 
+static void parseImport( Context &ctx )
+{
+    Token tt = ctx.tokens.next();
+    if (tt.code == TOKEN_NAME && (tt.value == "public" || tt.value == "weak"))
+        tt = ctx.tokens.next();
+    if (tt.code == TOKEN_STRING && ctx.tokens.next().code == TOKEN_SCOLON)
+        ctx.handler.onImport(tt.value);
+    else
+        throw exception("Invalid import", CURRENT_TOKEN_POSITION);
+}
 
 static void parseSyntax( Context &ctx )
 {
@@ -365,23 +450,33 @@ static void parseSyntax( Context &ctx )
     if (tt.code == TOKEN_STRING && ctx.tokens.next().code == TOKEN_SCOLON)
     {
         if (tt.value != "proto3") throw exception("Invalid language version", CURRENT_TOKEN_POSITION);
+        ctx.handler.onSyntax(tt.value);
     }
     else
         throw exception("Invalid syntax", CURRENT_TOKEN_POSITION);
 }
 
-static void parseProcedure( Context &ctx, std::shared_ptr<Service> service )
+// moves to the type name, consuming the optional 'stream' keyword
+static bool parseStream( Context &ctx )
+{
+    if (ctx.tokens.next().code != TOKEN_STREAM) return false;
+    ctx.tokens.next();
+    return true;
+}
+
+static void parseProcedure( Context &ctx )
 {
-    auto proc = std::make_shared<Procedure>();
+    Procedure proc;
+    proc.comments.leading = ctx.tokens.current.comment;
 
     // name
     ctx.tokens.next();
-    proc->name = parseName(ctx);
+    proc.name = parseName(ctx);
     // request
     if (ctx.tokens.next().code != TOKEN_LPAREN)
         throw exception("Missing left parenthesis", CURRENT_TOKEN_POSITION);
-    ctx.tokens.next();
-    parseTypeInfo(ctx, proc->request);
+    proc.requestStream = parseStream(ctx);
+    parseTypeInfo(ctx, proc.request);
     if (ctx.tokens.next().code != TOKEN_RPAREN)
         throw exception("Missing right parenthesis", CURRENT_TOKEN_POSITION);
     // response
@@ -389,8 +484,8 @@ static void parseProcedure( Context &ctx, std::shared_ptr<Service> service )
         throw exception("Missing returns", CURRENT_TOKEN_POSITION);
     if (ctx.tokens.next().code != TOKEN_LPAREN)
         throw exception("Missing left parenthesis", CURRENT_TOKEN_POSITION);
-    ctx.tokens.next();
-    parseTypeInfo(ctx, proc->response);
+    proc.responseStream = parseStream(ctx);
+    parseTypeInfo(ctx, proc.response);
     if (ctx.tokens.next().code != TOKEN_RPAREN)
         throw exception("Missing right parenthesis", CURRENT_TOKEN_POSITION);
 
@@ -399,29 +494,37 @@ static void parseProcedure( Context &ctx, std::shared_ptr<Service> service )
         throw exception("Unexpected token", CURRENT_TOKEN_POSITION);
     if (ctx.tokens.current.code == TOKEN_BEGIN && ctx.tokens.next().code != TOKEN_END)
         throw exception("Missing right braces", CURRENT_TOKEN_POSITION);
+    proc.comments.trailing = ctx.tokens.trailing();
 
-    service->procs.push_back(proc);
+    ctx.handler.onRpc(proc);
 }
 
-static void parseService( Context &ctx )
+// the '{' is already consumed at this point
+static void parseServiceBody( Context &ctx )
 {
-    auto service = std::make_shared<Service>();
-
-    ctx.tokens.next();
-    service->name = parseName(ctx);
-
-    if (ctx.tokens.next().code != TOKEN_BEGIN)
-        throw exception("Missing service body", CURRENT_TOKEN_POSITION);
-
     while (ctx.tokens.next().code != TOKEN_END)
     {
         if (ctx.tokens.current.code == TOKEN_RPC)
-            parseProcedure(ctx, service);
+            parseProcedure(ctx);
         else
             throw exception("Unexpected token" + ctx.tokens.current.value, TOKEN_POSITION(ctx.tokens.current));
     }
+}
+
+static void parseService( Context &ctx )
+{
+    Service service;
+
+    ctx.tokens.next();
+    service.name = parseName(ctx);
+    service.qname = qualifiedName(ctx, service.name);
 
-    ctx.tree.services.push_back(service);
+    if (ctx.tokens.next().code != TOKEN_BEGIN)
+        throw exception("Missing service body", CURRENT_TOKEN_POSITION);
+    if (ctx.lazy) service.body = skipBody(ctx);
+    ctx.handler.onServiceBegin(service);
+    if (!ctx.lazy) parseServiceBody(ctx);
+    ctx.handler.onServiceEnd();
 }
 
 static void parseProto( Context &ctx )
@@ -435,6 +538,9 @@ static void parseProto( Context &ctx )
         if (ctx.tokens.current.code == TOKEN_PACKAGE)
             parsePackage(ctx);
         else
+        if (ctx.tokens.current.code == TOKEN_IMPORT)
+            parseImport(ctx);
+        else
         if (ctx.tokens.current.code == TOKEN_COMMENT)
             continue;
         else
@@ -442,7 +548,7 @@ static void parseProto( Context &ctx )
             parseSyntax(ctx);
         else
         if (ctx.tokens.current.code == TOKEN_OPTION)
-            parseStandardOption(ctx, ctx.tree.options);
+            parseStandardOption(ctx);
         else
         if (ctx.tokens.current.code == TOKEN_ENUM)
             parseEnum(ctx);
@@ -462,65 +568,154 @@ static void parseProto( Context &ctx )
 typedef std::list<std::shared_ptr<Message>> MessageList;
 typedef std::set<std::shared_ptr<Message>> MessageSet;
 
-static bool contains( const MessageList &items, const std::shared_ptr<Message> message )
-{
-    for (auto mi = items.begin(); mi != items.end(); ++mi)
-        if (*mi == message) return true;
-    return false;
-}
-
-static void sort( MessageList &items, MessageSet &pending, std::shared_ptr<Message> message )
+static void sort( MessageList &items, MessageSet &pending, MessageSet &done, std::shared_ptr<Message> message )
 {
+    if (done.find(message) != done.end()) return; // already processed
     if (pending.find(message) != pending.end())
         throw exception("Circular reference with " + message->name);
-    //if (contains(items, message)) return; // already processed
 
     pending.insert(message);
     for (auto fi : message->fields)
     {
         if (fi->type.mref == nullptr || fi->type.mref == message)
             continue;
-        if (!contains(items, fi->type.mref))
-            sort(items, pending, fi->type.mref);
+        sort(items, pending, done, fi->type.mref);
     }
     items.push_back(message);
     pending.erase(message);
+    done.insert(message);
 }
 
-static void sort_messages( Context &ctx )
+void sortMessages( Proto &tree )
 {
     MessageList items;
     MessageSet pending;
-    for (auto mi : ctx.tree.messages)
-        sort(items, pending, mi);
-    ctx.tree.messages.swap(items);
+    MessageSet done;
+    for (auto mi : tree.messages)
+        sort(items, pending, done, mi);
+    tree.messages.swap(items);
 }
 
-void Proto::parse( Proto &tree, std::istream &input, const std::string &fileName )
+// handler used by 'Proto::parse' to build the tree
+class TreeBuilder : public ParseHandler
 {
-    std::ios_base::fmtflags flags = input.flags();
-    std::noskipws(input);
-    std::istream_iterator<char> end;
-    std::istream_iterator<char> begin(input);
+    public:
+        TreeBuilder( Proto &tree ) : tree_(tree), options_(&tree.options)
+        {
+        }
 
-    IteratorInputStream< std::istream_iterator<char> > is(begin, end);
-    Tokenizer tok(is);
+        // add the events to an existing declaration (used to parse a pending body)
+        void open( std::shared_ptr<Message> message )
+        {
+            message_ = message;
+            options_ = &message->options;
+        }
 
-    Context ctx(tok, tree, is);
-    tree.fileName = fileName;
+        void open( std::shared_ptr<Enum> entity )
+        {
+            enum_ = entity;
+            options_ = &entity->options;
+        }
 
-    try
-    {
-        parseProto(ctx);
-        tree.package = ctx.package;
-        if (flags & std::ios::skipws) std::skipws(input);
-    } catch (exception &ex)
-    {
-        if (flags & std::ios::skipws) std::skipws(input);
-        throw ex;
-    }
+        void open( std::shared_ptr<Service> service )
+        {
+            service_ = service;
+            options_ = &service->options;
+        }
 
-    // check if we have unresolved types
+        void onPackage( const std::string &name ) override
+        {
+            tree_.package = name;
+        }
+
+        void onImport( const std::string &name ) override
+        {
+            tree_.imports.push_back(name);
+        }
+
+        void onOption( OptionEntry &option ) override
+        {
+            (*options_)[option.name] = std::move(option);
+        }
+
+        void onMessageBegin( Message &message ) override
+        {
+            message_ = std::make_shared<Message>(std::move(message));
+            options_ = &message_->options;
+        }
+
+        void onField( Field &field ) override
+        {
+            message_->fields.push_back(std::make_shared<Field>(std::move(field)));
+        }
+
+        void onMessageEnd() override
+        {
+            tree_.messages.push_back(message_);
+            message_ = nullptr;
+            options_ = &tree_.options;
+        }
+
+        void onEnumBegin( Enum &entity ) override
+        {
+            enum_ = std::make_shared<Enum>(std::move(entity));
+            options_ = &enum_->options;
+        }
+
+        void onEnumConstant( Constant &constant ) override
+        {
+            enum_->constants.push_back(std::make_shared<Constant>(std::move(constant)));
+        }
+
+        void onEnumEnd() override
+        {
+            tree_.enums.push_back(enum_);
+            enum_ = nullptr;
+            options_ = &tree_.options;
+        }
+
+        void onServiceBegin( Service &service ) override
+        {
+            service_ = std::make_shared<Service>(std::move(service));
+            options_ = &service_->options;
+        }
+
+        void onRpc( Procedure &procedure ) override
+        {
+            service_->procs.push_back(std::make_shared<Procedure>(std::move(procedure)));
+        }
+
+        void onServiceEnd() override
+        {
+            tree_.services.push_back(service_);
+            service_ = nullptr;
+            options_ = &tree_.options;
+        }
+
+    private:
+        Proto &tree_;
+        // where the next option goes
+        OptionMap *options_;
+        std::shared_ptr<Message> message_;
+        std::shared_ptr<Enum> enum_;
+        std::shared_ptr<Service> service_;
+};
+
+static void parseEvents( ParseHandler &handler, InputStream &is, ParseStats *stats, int flags )
+{
+    Tokenizer tok(is, stats, (flags & PARSE_COMMENTS) != 0);
+    Context ctx(tok, handler, is, (flags & PARSE_LAZY) != 0);
+    parseProto(ctx);
+}
+
+void parseTree( Proto &tree, InputStream &is, ParseStats *stats, int flags )
+{
+    TreeBuilder builder(tree);
+    parseEvents(builder, is, stats, flags);
+}
+
+void resolveTypes( Proto &tree )
+{
     for (auto mit : tree.messages)
     {
         for (auto fit : mit->fields)
@@ -529,16 +724,330 @@ void Proto::parse( Proto &tree, std::istream &input, const std::string &fileName
 
             auto qname = fit->type.package + "." + fit->type.name;
 
-            fit->type.mref = findMessage(ctx, qname);
+            fit->type.mref = findMessage(tree, qname);
             if (fit->type.mref == nullptr)
-                fit->type.eref = findEnum(ctx, qname);
+                fit->type.eref = findEnum(tree, qname);
             if (fit->type.mref == nullptr && fit->type.eref == nullptr)
                     throw exception("Unable to find type '" + qname + "'");
         }
     }
+}
+
+const char *ParseStats::tokenName( int kind )
+{
+    return protop::tokenName(kind);
+}
+
+// statistics of the parse running in the current thread
+static thread_local ParseStats *activeStats = nullptr;
+
+void trackAllocation( size_t size )
+{
+    ParseStats *stats = activeStats;
+    if (stats == nullptr) return;
+    ++stats->allocations;
+    stats->allocatedBytes += size;
+}
+
+// input stream that also counts the bytes read
+template <typename I> class CountingInputStream : public IteratorInputStream<I>
+{
+    public:
+        size_t count;
+
+        CountingInputStream( const I& first, const I& last ) : IteratorInputStream<I>(first, last), count(0)
+        {
+        }
+
+        int get() override
+        {
+            bool again = this->ungot_;
+            int value = IteratorInputStream<I>::get();
+            if (!again && value >= 0) ++count;
+            return value;
+        }
+
+        size_t offset() const override
+        {
+            return this->ungot_ ? count - 1 : count;
+        }
+};
+
+static double elapsed( std::chrono::steady_clock::time_point start )
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static size_t countNodes( const Proto &tree )
+{
+    size_t count = tree.messages.size() + tree.enums.size() + tree.services.size();
+    for (auto it : tree.messages) count += it->fields.size();
+    for (auto it : tree.enums) count += it->constants.size();
+    for (auto it : tree.services) count += it->procs.size();
+    return count;
+}
+
+/*
+ * Variant of 'Proto::parse' used when statistics are requested, so the usual
+ * path has no extra work.
+ */
+template <typename I>
+static void parseWithStats( Proto &tree, const I &begin, const I &end, ParseStats &stats, int flags )
+{
+    struct Scope
+    {
+        ParseStats *previous;
+        Scope( ParseStats *stats ) : previous(activeStats) { activeStats = stats; }
+        ~Scope() { activeStats = previous; }
+    } scope(&stats);
+
+    CountingInputStream<I> is(begin, end);
+
+    auto start = std::chrono::steady_clock::now();
+    double tokenizeTime = stats.tokenizeTime;
+    parseTree(tree, is, &stats, flags);
+    stats.parseTime += elapsed(start) - (stats.tokenizeTime - tokenizeTime);
+    stats.bytes += is.count;
+    if (flags & PARSE_LAZY) return;
+
+    start = std::chrono::steady_clock::now();
+    resolveTypes(tree);
+    stats.resolveTime += elapsed(start);
+
+    start = std::chrono::steady_clock::now();
+    sortMessages(tree);
+    stats.sortTime += elapsed(start);
+
+    stats.nodes += countNodes(tree);
+}
+
+template <typename I>
+static void parseInput( Proto &tree, const I &begin, const I &end, ParseStats *stats, int flags )
+{
+    if (stats != nullptr)
+    {
+        parseWithStats(tree, begin, end, *stats, flags);
+        return;
+    }
+
+    if (flags & (PARSE_COMMENTS | PARSE_LAZY))
+    {
+        // comment and body spans need the byte offsets
+        CountingInputStream<I> is(begin, end);
+        parseTree(tree, is, nullptr, flags);
+    }
+    else
+    {
+        IteratorInputStream<I> is(begin, end);
+        parseTree(tree, is);
+    }
+    if (flags & PARSE_LAZY) return;
+
+    // check if we have unresolved types
+    resolveTypes(tree);
     // sort messages and check for circular references
-    sort_messages(ctx);
+    sortMessages(tree);
 }
 
-} // protogen
+void Proto::parse( Proto &tree, std::istream &input, const std::string &fileName, ParseStats *stats,
+    int flags )
+{
+    std::ios_base::fmtflags state = input.flags();
+    std::noskipws(input);
+    tree.fileName = fileName;
 
+    try
+    {
+        if (flags & (PARSE_COMMENTS | PARSE_LAZY))
+        {
+            auto source = std::make_shared<std::string>(std::istreambuf_iterator<char>(input),
+                std::istreambuf_iterator<char>());
+            tree.source = source;
+            parseInput(tree, source->cbegin(), source->cend(), stats, flags);
+        }
+        else
+            parseInput(tree, std::istream_iterator<char>(input), std::istream_iterator<char>(), stats, 0);
+        if (state & std::ios::skipws) std::skipws(input);
+    } catch (exception &ex)
+    {
+        if (state & std::ios::skipws) std::skipws(input);
+        throw ex;
+    }
+}
+
+void Proto::parse( ParseHandler &handler, std::istream &input )
+{
+    std::ios_base::fmtflags state = input.flags();
+    std::noskipws(input);
+
+    std::istream_iterator<char> end;
+    std::istream_iterator<char> begin(input);
+    IteratorInputStream< std::istream_iterator<char> > is(begin, end);
+    try
+    {
+        parseEvents(handler, is, nullptr, 0);
+        if (state & std::ios::skipws) std::skipws(input);
+    } catch (exception &ex)
+    {
+        if (state & std::ios::skipws) std::skipws(input);
+        throw ex;
+    }
+}
+
+// removes the comment markers and the decoration of each line
+std::string Proto::comment( const CommentSpan &span ) const
+{
+    if (source == nullptr || span.length == 0 || span.offset + span.length > source->size())
+        return "";
+    const char *ptr = source->data() + span.offset;
+    const char *end = ptr + span.length;
+    bool block = span.length >= 4 && ptr[1] == '*';
+    if (block)
+    {
+        ptr += 2;
+        end -= 2;
+    }
+
+    std::string text;
+    while (ptr < end)
+    {
+        const char *eol = ptr;
+        while (eol < end && *eol != '\n') ++eol;
+        const char *cur = ptr;
+        while (cur < eol && (*cur == ' ' || *cur == '\t')) ++cur;
+        if (!block && eol - cur >= 2 && cur[0] == '/' && cur[1] == '/')
+            cur += 2;
+        else
+        if (block && cur < eol && *cur == '*')
+            ++cur;
+        if (cur < eol && *cur == ' ') ++cur;
+        const char *last = eol;
+        while (last > cur && (last[-1] == ' ' || last[-1] == '\t' || last[-1] == '\r')) --last;
+
+        if (!text.empty() || last > cur) text.append(cur, last).append("\n");
+        ptr = eol + 1;
+    }
+    while (!text.empty() && text.back() == '\n') text.pop_back();
+    return text;
+}
+
+struct SymbolIndex
+{
+    std::unordered_map<std::string, std::shared_ptr<Message>> messages;
+    std::unordered_map<std::string, std::shared_ptr<Enum>> enums;
+    std::unordered_map<std::string, std::shared_ptr<Service>> services;
+    // messages whose field types are resolved
+    std::unordered_set<const Message*> resolved;
+};
+
+static SymbolIndex &symbolIndex( Proto &tree )
+{
+    if (tree.symbols == nullptr)
+    {
+        auto index = std::make_shared<SymbolIndex>();
+        for (auto it : tree.messages) index->messages[it->qname] = it;
+        for (auto it : tree.enums) index->enums[it->qname] = it;
+        for (auto it : tree.services) index->services[it->qname] = it;
+        tree.symbols = index;
+    }
+    return *tree.symbols;
+}
+
+// input stream over a declaration body that keeps the positions of the whole source
+class BodyInputStream : public IteratorInputStream<const char*>
+{
+    public:
+        BodyInputStream( const std::string &source, const BodySpan &span ) :
+            IteratorInputStream<const char*>(source.data() + span.offset, source.data() + span.offset + span.length),
+            base_(source.data())
+        {
+            line_ = span.line;
+            column_ = span.column;
+        }
+
+        size_t offset() const override
+        {
+            return (size_t) (cur_ - base_) - (ungot_ ? 1 : 0);
+        }
+
+    private:
+        const char *base_;
+};
+
+/*
+ * Parses the pending body of a declaration, if any. The span is cleared first,
+ * so the body is never parsed twice. Comments are always recorded since the
+ * source is available.
+ */
+template <typename T>
+static void parseBody( Proto &tree, std::shared_ptr<T> entity, void (*parse)( Context& ) )
+{
+    if (entity->body.length == 0) return;
+    if (tree.source == nullptr || entity->body.offset + entity->body.length > tree.source->size())
+        throw exception("Invalid body span for '" + entity->qname + "'");
+    BodySpan span = entity->body;
+    entity->body = BodySpan();
+
+    BodyInputStream is(*tree.source, span);
+    Tokenizer tok(is, nullptr, true);
+    TreeBuilder builder(tree);
+    builder.open(entity);
+    Context ctx(tok, builder, is);
+    ctx.package = tree.package;
+    parse(ctx);
+}
+
+std::shared_ptr<Message> Proto::message( const std::string &qname )
+{
+    SymbolIndex &index = symbolIndex(*this);
+    auto it = index.messages.find(qname);
+    if (it == index.messages.end()) return nullptr;
+    auto message = it->second;
+    parseBody(*this, message, parseMessageBody);
+
+    // mark first to stop at circular references
+    if (!index.resolved.insert(message.get()).second) return message;
+    for (auto fit : message->fields)
+    {
+        if (fit->type.id != TYPE_COMPLEX || fit->type.mref != nullptr || fit->type.eref != nullptr)
+            continue;
+        auto name = fit->type.package + "." + fit->type.name;
+        fit->type.mref = this->message(name);
+        if (fit->type.mref == nullptr)
+            fit->type.eref = enumeration(name);
+        if (fit->type.mref == nullptr && fit->type.eref == nullptr)
+            throw exception("Unable to find type '" + name + "'");
+    }
+    return message;
+}
+
+std::shared_ptr<Enum> Proto::enumeration( const std::string &qname )
+{
+    SymbolIndex &index = symbolIndex(*this);
+    auto it = index.enums.find(qname);
+    if (it == index.enums.end()) return nullptr;
+    parseBody(*this, it->second, parseEnumBody);
+    return it->second;
+}
+
+std::shared_ptr<Service> Proto::service( const std::string &qname )
+{
+    SymbolIndex &index = symbolIndex(*this);
+    auto it = index.services.find(qname);
+    if (it == index.services.end()) return nullptr;
+    parseBody(*this, it->second, parseServiceBody);
+    return it->second;
+}
+
+void Proto::resolve()
+{
+    for (auto it : messages) parseBody(*this, it, parseMessageBody);
+    for (auto it : enums) parseBody(*this, it, parseEnumBody);
+    for (auto it : services) parseBody(*this, it, parseServiceBody);
+    // check if we have unresolved types
+    resolveTypes(*this);
+    // sort messages and check for circular references
+    sortMessages(*this);
+}
+
+} // protogen
@@ -0,0 +1,39 @@
+/*
+ * Copyright 2020-2022 Bruno Ribeiro <https://github.com/brunexgeek>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef PROTOP_PARSER
+#define PROTOP_PARSER
+
+#include <protop/protop.hh>
+#include "tokenizer.hh"
+
+namespace protop {
+
+/*
+ * Phases of 'Proto::parse'. They are available separately so in-tree tools
+ * can measure each one; applications should call 'Proto::parse' instead.
+ */
+
+// read the declarations into 'tree' (complex types remain unresolved)
+void parseTree( Proto &tree, InputStream &is, ParseStats *stats = nullptr, int flags = 0 );
+// link complex field types to their messages and enumerations
+void resolveTypes( Proto &tree );
+// sort messages by dependency and check for circular references
+void sortMessages( Proto &tree );
+
+} // protop
+
+#endif // PROTOP_PARSER
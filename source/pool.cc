@@ -0,0 +1,483 @@
+/*
+ * Copyright 2020-2022 Bruno Ribeiro <https://github.com/brunexgeek>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <protop/pool.hh>
+#include "parser.hh"
+#include "exception.hh"
+#include <algorithm>
+#include <functional>
+#include <iterator>
+#include <set>
+#include <unordered_set>
+
+#define TABLE_BUCKETS  64
+
+namespace protop {
+
+/*
+ * Hash table whose buckets are shared between copies. Copying a table only
+ * copies the bucket pointers and a shared bucket is copied before its first
+ * change, so a new state shares with the snapshots everything it did not change.
+ */
+template<typename T>
+class SharedTable
+{
+    public:
+        typedef std::unordered_map<std::string, T> Bucket;
+
+        SharedTable() : buckets_(TABLE_BUCKETS)
+        {
+            for (auto &it : buckets_) it = std::make_shared<Bucket>();
+        }
+
+        const T *find( const std::string &key ) const
+        {
+            const Bucket &bucket = *buckets_[index(key)];
+            auto it = bucket.find(key);
+            return (it == bucket.end()) ? nullptr : &it->second;
+        }
+
+        T &operator[]( const std::string &key )
+        {
+            return modify(key)[key];
+        }
+
+        void erase( const std::string &key )
+        {
+            if (find(key) != nullptr) modify(key).erase(key);
+        }
+
+        template<typename F>
+        void forEach( F function ) const
+        {
+            for (auto &bucket : buckets_)
+                for (auto &it : *bucket) function(it.first, it.second);
+        }
+
+    private:
+        std::vector<std::shared_ptr<Bucket>> buckets_;
+
+        static size_t index( const std::string &key )
+        {
+            return std::hash<std::string>()(key) % TABLE_BUCKETS;
+        }
+
+        Bucket &modify( const std::string &key )
+        {
+            // the other owners are immutable states
+            auto &bucket = buckets_[index(key)];
+            if (bucket.use_count() > 1) bucket = std::make_shared<Bucket>(*bucket);
+            return *bucket;
+        }
+};
+
+struct PoolSymbol
+{
+    std::string file;
+    std::shared_ptr<Message> message;
+    std::shared_ptr<Enum> enumeration;
+    std::shared_ptr<Service> service;
+};
+
+struct PoolFile
+{
+    std::shared_ptr<Proto> tree;
+    std::vector<std::string> unresolved;
+    // qualified names the type names of the file may refer to
+    std::vector<std::string> candidates;
+};
+
+// never modified once published
+struct PoolState
+{
+    uint64_t version = 0;
+    SharedTable<PoolFile> files;
+    SharedTable<PoolSymbol> symbols;
+};
+
+// only needed to apply changes, so it is not part of the snapshots
+struct PoolIndex
+{
+    // qualified name to the files with a type name that may refer to it
+    std::unordered_map<std::string, std::set<std::string>> users;
+};
+
+// qualified names a type name may refer to, from the innermost scope
+static void candidates( const TypeInfo &type, std::vector<std::string> &out )
+{
+    if (!type.name.empty() && type.name[0] == '.')
+    {
+        out.push_back(type.name.substr(1));
+        return;
+    }
+    std::string scope = type.package;
+    while (true)
+    {
+        out.push_back(scope.empty() ? type.name : scope + '.' + type.name);
+        if (scope.empty()) return;
+        auto pos = scope.rfind('.');
+        scope = (pos == std::string::npos) ? "" : scope.substr(0, pos);
+    }
+}
+
+static bool refersTo( const TypeInfo &type, const std::string &qname )
+{
+    if (type.id != TYPE_COMPLEX) return false;
+    std::vector<std::string> names;
+    candidates(type, names);
+    for (auto &it : names)
+        if (it == qname) return true;
+    return false;
+}
+
+static bool refersTo( const Message &message, const std::string &qname )
+{
+    for (auto &it : message.fields)
+        if (refersTo(it->type, qname)) return true;
+    return false;
+}
+
+static bool refersTo( const Service &service, const std::string &qname )
+{
+    for (auto &it : service.procs)
+        if (refersTo(it->request, qname) || refersTo(it->response, qname)) return true;
+    return false;
+}
+
+static void resolve( const PoolState &state, TypeInfo &type, bool messageOnly )
+{
+    if (type.id != TYPE_COMPLEX) return;
+    type.mref = nullptr;
+    type.eref = nullptr;
+    std::vector<std::string> names;
+    candidates(type, names);
+    for (auto &it : names)
+    {
+        const PoolSymbol *symbol = state.symbols.find(it);
+        if (symbol == nullptr) continue;
+        if (symbol->message != nullptr)
+            type.mref = symbol->message;
+        else
+        if (!messageOnly && symbol->enumeration != nullptr)
+            type.eref = symbol->enumeration;
+        else
+            continue;
+        return;
+    }
+}
+
+static void resolve( const PoolState &state, Message &message )
+{
+    for (auto &it : message.fields)
+    {
+        resolve(state, it->type, false);
+        // a message owning itself would never be released
+        if (it->type.mref.get() == &message)
+            it->type.mref = std::shared_ptr<Message>(std::shared_ptr<Message>(), &message);
+    }
+}
+
+static void resolve( const PoolState &state, Service &service )
+{
+    for (auto &it : service.procs)
+    {
+        resolve(state, it->request, true);
+        resolve(state, it->response, true);
+    }
+}
+
+static void collectUnresolved( PoolFile &file )
+{
+    file.unresolved.clear();
+    auto check = [&file]( const TypeInfo &type )
+    {
+        if (type.id == TYPE_COMPLEX && type.mref == nullptr && type.eref == nullptr)
+            file.unresolved.push_back(type.name);
+    };
+    for (auto &message : file.tree->messages)
+        for (auto &it : message->fields) check(it->type);
+    for (auto &service : file.tree->services)
+    {
+        for (auto &it : service->procs)
+        {
+            check(it->request);
+            check(it->response);
+        }
+    }
+}
+
+// same rule as 'Proto::parse': only a message may refer to itself
+static void checkCycles( std::shared_ptr<Message> message, std::set<Message*> &pending, std::set<Message*> &done )
+{
+    if (done.count(message.get()) > 0) return;
+    if (pending.count(message.get()) > 0)
+        throw exception("Circular reference with " + message->qname);
+    pending.insert(message.get());
+    for (auto &it : message->fields)
+    {
+        if (it->type.mref != nullptr && it->type.mref != message)
+            checkCycles(it->type.mref, pending, done);
+    }
+    pending.erase(message.get());
+    done.insert(message.get());
+}
+
+template<typename F>
+static void forEachSymbol( const Proto &tree, F function )
+{
+    for (auto &it : tree.messages) function(it->qname);
+    for (auto &it : tree.enums) function(it->qname);
+    for (auto &it : tree.services) function(it->qname);
+}
+
+SchemaPool::SchemaPool() : state_(std::make_shared<PoolState>()), index_(std::make_shared<PoolIndex>())
+{
+}
+
+std::vector<std::string> SchemaPool::add( const std::string &name, std::istream &input )
+{
+    std::string content((std::istreambuf_iterator<char>(input)), std::istreambuf_iterator<char>());
+    IteratorInputStream<std::string::const_iterator> is(content.cbegin(), content.cend());
+    auto tree = std::make_shared<Proto>();
+    tree->fileName = name;
+    parseTree(*tree, is);
+    return update(name, tree);
+}
+
+std::vector<std::string> SchemaPool::remove( const std::string &name )
+{
+    if (state_->files.find(name) == nullptr) return std::vector<std::string>();
+    return update(name, nullptr);
+}
+
+std::vector<std::string> SchemaPool::update( const std::string &name, std::shared_ptr<Proto> tree )
+{
+    // changes are applied to a copy, published only if everything succeeds
+    auto next = std::make_shared<PoolState>(*state_);
+    PoolState &state = *next;
+    auto &users = index_->users;
+
+    // check for conflicts before changing anything
+    if (tree != nullptr)
+    {
+        std::unordered_set<std::string> seen;
+        forEachSymbol(*tree, [&]( const std::string &qname )
+        {
+            if (!seen.insert(qname).second)
+                throw exception("Symbol '" + qname + "' is declared twice in '" + name + "'");
+            const PoolSymbol *symbol = state.symbols.find(qname);
+            if (symbol != nullptr && symbol->file != name)
+                throw exception("Symbol '" + qname + "' is already declared in '" + symbol->file + "'");
+        });
+    }
+
+    // symbols whose declarations changed
+    std::vector<std::string> changed;
+    std::vector<std::string> previousCandidates;
+    const PoolFile *previous = state.files.find(name);
+    if (previous != nullptr)
+    {
+        forEachSymbol(*previous->tree, [&]( const std::string &qname )
+        {
+            state.symbols.erase(qname);
+            changed.push_back(qname);
+        });
+        previousCandidates = previous->candidates;
+        state.files.erase(name);
+    }
+    if (tree != nullptr)
+    {
+        for (auto &it : tree->messages) state.symbols[it->qname] = PoolSymbol{name, it, nullptr, nullptr};
+        for (auto &it : tree->enums) state.symbols[it->qname] = PoolSymbol{name, nullptr, it, nullptr};
+        for (auto &it : tree->services) state.symbols[it->qname] = PoolSymbol{name, nullptr, nullptr, it};
+        forEachSymbol(*tree, [&]( const std::string &qname ) { changed.push_back(qname); });
+
+        std::set<std::string> names;
+        std::vector<std::string> buffer;
+        for (auto &message : tree->messages)
+            for (auto &it : message->fields) candidates(it->type, buffer);
+        for (auto &service : tree->services)
+        {
+            for (auto &it : service->procs)
+            {
+                candidates(it->request, buffer);
+                candidates(it->response, buffer);
+            }
+        }
+        names.insert(buffer.begin(), buffer.end());
+        PoolFile &file = state.files[name];
+        file.tree = tree;
+        file.candidates.assign(names.begin(), names.end());
+    }
+
+    // declarations of other files that refer to a changed symbol, directly or
+    // through another marked declaration (each one is marked once)
+    std::map<std::string, std::set<std::string>> marked;
+    for (size_t i = 0; i < changed.size(); ++i)
+    {
+        auto entry = users.find(changed[i]);
+        if (entry == users.end()) continue;
+        for (auto &user : entry->second)
+        {
+            if (user == name) continue;
+            std::set<std::string> &entities = marked[user];
+            const Proto &current = *state.files.find(user)->tree;
+            for (auto &it : current.messages)
+            {
+                if (entities.count(it->qname) == 0 && refersTo(*it, changed[i]))
+                {
+                    entities.insert(it->qname);
+                    changed.push_back(it->qname);
+                }
+            }
+            for (auto &it : current.services)
+                if (entities.count(it->qname) == 0 && refersTo(*it, changed[i])) entities.insert(it->qname);
+        }
+    }
+
+    // copy the marked declarations and publish the copies before resolving,
+    // so references between copies point to the copies
+    std::vector<std::shared_ptr<Message>> messages;
+    std::vector<std::shared_ptr<Service>> services;
+    std::vector<std::string> affected;
+    for (auto &entry : marked)
+    {
+        if (entry.second.empty()) continue;
+        PoolFile &file = state.files[entry.first];
+        auto copy = std::make_shared<Proto>(*file.tree);
+        for (auto &it : copy->messages)
+        {
+            if (entry.second.count(it->qname) == 0) continue;
+            it = std::make_shared<Message>(*it);
+            for (auto &field : it->fields) field = std::make_shared<Field>(*field);
+            state.symbols[it->qname].message = it;
+            messages.push_back(it);
+        }
+        for (auto &it : copy->services)
+        {
+            if (entry.second.count(it->qname) == 0) continue;
+            it = std::make_shared<Service>(*it);
+            for (auto &proc : it->procs) proc = std::make_shared<Procedure>(*proc);
+            state.symbols[it->qname].service = it;
+            services.push_back(it);
+        }
+        file.tree = copy;
+        affected.push_back(entry.first);
+    }
+
+    for (auto &it : messages) resolve(state, *it);
+    for (auto &it : services) resolve(state, *it);
+    for (auto &it : affected) collectUnresolved(state.files[it]);
+    if (tree != nullptr)
+    {
+        for (auto &it : tree->messages) resolve(state, *it);
+        for (auto &it : tree->services) resolve(state, *it);
+        collectUnresolved(state.files[name]);
+        messages.insert(messages.end(), tree->messages.begin(), tree->messages.end());
+    }
+
+    // a cycle would also keep the messages alive forever; the current state
+    // has none, so a new one must go through a message resolved above
+    std::set<Message*> pending;
+    std::set<Message*> done;
+    try
+    {
+        for (auto &it : messages) checkCycles(it, pending, done);
+    } catch (...)
+    {
+        // the messages resolved above are not shared with the current state
+        for (auto &message : messages)
+            for (auto &it : message->fields) it->type.mref = nullptr;
+        throw;
+    }
+
+    for (auto &it : previousCandidates)
+    {
+        auto entry = users.find(it);
+        if (entry == users.end()) continue;
+        entry->second.erase(name);
+        if (entry->second.empty()) users.erase(entry);
+    }
+    if (tree != nullptr)
+        for (auto &it : state.files.find(name)->candidates) users[it].insert(name);
+
+    ++state.version;
+    state_ = next;
+    snapshot_ = nullptr;
+    return affected;
+}
+
+std::shared_ptr<const SchemaSnapshot> SchemaPool::snapshot()
+{
+    // the state is immutable, so snapshots share it
+    if (snapshot_ == nullptr) snapshot_ = std::make_shared<SchemaSnapshot>(state_);
+    return snapshot_;
+}
+
+SchemaSnapshot::SchemaSnapshot( std::shared_ptr<const PoolState> state ) : state_(state)
+{
+}
+
+uint64_t SchemaSnapshot::version() const
+{
+    return state_->version;
+}
+
+std::vector<std::string> SchemaSnapshot::files() const
+{
+    std::vector<std::string> result;
+    state_->files.forEach([&]( const std::string &name, const PoolFile& ) { result.push_back(name); });
+    std::sort(result.begin(), result.end());
+    return result;
+}
+
+std::shared_ptr<const Proto> SchemaSnapshot::file( const std::string &name ) const
+{
+    const PoolFile *file = state_->files.find(name);
+    return file == nullptr ? nullptr : file->tree;
+}
+
+std::vector<std::string> SchemaSnapshot::unresolved( const std::string &name ) const
+{
+    const PoolFile *file = state_->files.find(name);
+    return file == nullptr ? std::vector<std::string>() : file->unresolved;
+}
+
+std::shared_ptr<const Message> SchemaSnapshot::message( const std::string &qname ) const
+{
+    const PoolSymbol *symbol = state_->symbols.find(qname);
+    return symbol == nullptr ? nullptr : symbol->message;
+}
+
+std::shared_ptr<const Enum> SchemaSnapshot::enumeration( const std::string &qname ) const
+{
+    const PoolSymbol *symbol = state_->symbols.find(qname);
+    return symbol == nullptr ? nullptr : symbol->enumeration;
+}
+
+std::shared_ptr<const Service> SchemaSnapshot::service( const std::string &qname ) const
+{
+    const PoolSymbol *symbol = state_->symbols.find(qname);
+    return symbol == nullptr ? nullptr : symbol->service;
+}
+
+std::string SchemaSnapshot::declaringFile( const std::string &qname ) const
+{
+    const PoolSymbol *symbol = state_->symbols.find(qname);
+    return symbol == nullptr ? "" : symbol->file;
+}
+
+} // protop
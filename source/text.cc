@@ -0,0 +1,394 @@
+/*
+ * Copyright 2020-2022 Bruno Ribeiro <https://github.com/brunexgeek>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <protop/text.hh>
+#include "tokenizer.hh"
+#include "number.hh"
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iterator>
+
+#define TOKEN_POSITION(t)  (t).line, (t).column
+// same limit as 'DynamicMessage::decode'
+#define MAX_TEXT_DEPTH     100
+
+namespace protop {
+
+static bool isIdentifier( const Token &token )
+{
+    // keywords are valid field and enumeration names
+    return token.code != TOKEN_STRING && token.code != TOKEN_QNAME &&
+        !token.value.empty() && IS_LETTER(token.value[0]);
+}
+
+static bool isSigned( FieldType type )
+{
+    return type == TYPE_INT32 || type == TYPE_INT64 || type == TYPE_SINT32 || type == TYPE_SINT64 ||
+        type == TYPE_SFIXED32 || type == TYPE_SFIXED64 || type == TYPE_COMPLEX;
+}
+
+static bool is32Bits( FieldType type )
+{
+    return type == TYPE_INT32 || type == TYPE_UINT32 || type == TYPE_SINT32 || type == TYPE_FIXED32 ||
+        type == TYPE_SFIXED32 || type == TYPE_COMPLEX;
+}
+
+static std::string lowercase( const std::string &value )
+{
+    std::string result(value);
+    for (auto &c : result)
+        if (c >= 'A' && c <= 'Z') c = (char) (c - 'A' + 'a');
+    return result;
+}
+
+/*
+ * Parses decimal, octal and hexadecimal integers. A sign given as a separate
+ * token ('- 5') is passed in 'negative'.
+ */
+static uint64_t parseInteger( const Token &token, FieldType type, bool negative )
+{
+    if (token.code != TOKEN_INTEGER)
+        throw exception("Expected integer value", TOKEN_POSITION(token));
+    std::string text = negative ? "-" + token.value : token.value;
+    char *last = nullptr;
+    errno = 0;
+    uint64_t result;
+    bool valid;
+    if (isSigned(type))
+    {
+        long long value = strtoll(text.c_str(), &last, 0);
+        valid = !is32Bits(type) || (value >= INT32_MIN && value <= INT32_MAX);
+        result = (uint64_t) value;
+    }
+    else
+    {
+        if (text[0] == '-') throw exception("Negative value for unsigned field", TOKEN_POSITION(token));
+        unsigned long long value = strtoull(text.c_str(), &last, 0);
+        valid = !is32Bits(type) || value <= UINT32_MAX;
+        result = (uint64_t) value;
+    }
+    if (*last != 0) throw exception("Invalid integer value", TOKEN_POSITION(token));
+    if (errno == ERANGE || !valid) throw exception("Integer out of range", TOKEN_POSITION(token));
+    return result;
+}
+
+static double parseReal( const Token &token, bool negative )
+{
+    double value;
+    if (token.code == TOKEN_INTEGER || token.code == TOKEN_REAL)
+        value = scanReal(token.value.c_str(), nullptr);
+    else
+    {
+        std::string name = isIdentifier(token) ? lowercase(token.value) : "";
+        if (name == "inf" || name == "infinity")
+            value = HUGE_VAL;
+        else
+        if (name == "nan")
+            value = NAN;
+        else
+            throw exception("Expected real value", TOKEN_POSITION(token));
+    }
+    return negative ? -value : value;
+}
+
+static uint64_t parseEnum( const Token &token, const FieldCodec &fc, bool negative )
+{
+    if (token.code == TOKEN_INTEGER) return parseInteger(token, fc.type, negative);
+    if (!negative && isIdentifier(token))
+    {
+        for (auto &constant : fc.eref->constants)
+            if (constant->name == token.value) return (uint64_t) (int64_t) constant->value;
+    }
+    throw exception("Invalid value for enumeration '" + fc.eref->qname + "'", TOKEN_POSITION(token));
+}
+
+static uint64_t parseBool( const Token &token )
+{
+    const std::string &value = token.value;
+    if (token.code != TOKEN_STRING)
+    {
+        if (value == "true" || value == "True" || value == "t" || value == "1") return 1;
+        if (value == "false" || value == "False" || value == "f" || value == "0") return 0;
+    }
+    throw exception("Expected boolean value", TOKEN_POSITION(token));
+}
+
+// returns the value in the representation of 'DynamicField::values'
+static uint64_t parseScalar( Tokenizer &tokens, const FieldCodec &fc )
+{
+    bool negative = false;
+    if (tokens.current.code == TOKEN_MINUS)
+    {
+        negative = true;
+        tokens.next();
+    }
+    const Token &token = tokens.current;
+
+    if (fc.type == TYPE_DOUBLE)
+    {
+        double value = parseReal(token, negative);
+        uint64_t bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+        return bits;
+    }
+    if (fc.type == TYPE_FLOAT)
+    {
+        float value = (float) parseReal(token, negative);
+        uint32_t bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+        return bits;
+    }
+    if (fc.eref != nullptr) return parseEnum(token, fc, negative);
+    if (negative) return parseInteger(token, fc.type, true);
+    if (fc.type == TYPE_BOOL) return parseBool(token);
+    return parseInteger(token, fc.type, false);
+}
+
+static void parseMessage( Tokenizer &tokens, DynamicMessage &message, int end, int depth );
+
+// parses the value starting at the current token
+static void parseValue( Tokenizer &tokens, DynamicMessage &message, const FieldCodec &fc, int depth )
+{
+    DynamicField &df = message.fields[fc.slot];
+
+    if (fc.message != nullptr)
+    {
+        int code = tokens.current.code;
+        if (code != TOKEN_BEGIN && code != TOKEN_LT)
+            throw exception("Expected '{'", TOKEN_POSITION(tokens.current));
+        DynamicMessage *nested;
+        if (fc.repeated || df.messages.empty())
+            nested = &message.addMessage(fc);
+        else
+            nested = df.messages.front().get(); // merge
+        parseMessage(tokens, *nested, (code == TOKEN_BEGIN) ? TOKEN_END : TOKEN_GT, depth + 1);
+        return;
+    }
+
+    if (fc.wire == WIRE_LENGTH)
+    {
+        if (tokens.current.code != TOKEN_STRING)
+            throw exception("Expected string value", TOKEN_POSITION(tokens.current));
+        // adjacent literals are concatenated
+        std::string value;
+        value.swap(tokens.current.value);
+        while (tokens.next().code == TOKEN_STRING) value += tokens.current.value;
+        tokens.unget();
+        if (fc.repeated || df.strings.empty())
+            df.strings.push_back(std::move(value));
+        else
+            df.strings.front().swap(value);
+        return;
+    }
+
+    uint64_t value = parseScalar(tokens, fc);
+    if (fc.repeated || df.values.empty())
+        df.values.push_back(value);
+    else
+        df.values.front() = value;
+}
+
+/*
+ * Parses fields until the token 'end' (closing bracket of a nested message or
+ * the end of the input). Each field may be followed by ';' or ','.
+ */
+static void parseMessage( Tokenizer &tokens, DynamicMessage &message, int end, int depth )
+{
+    if (depth >= MAX_TEXT_DEPTH)
+        throw exception("Nesting depth exceeds " + std::to_string(MAX_TEXT_DEPTH) + " levels",
+            TOKEN_POSITION(tokens.current));
+    while (true)
+    {
+        tokens.next();
+        const Token &token = tokens.current;
+        if (token.code == end) return;
+        if (token.code == TOKEN_EOF)
+            throw exception((end == TOKEN_GT) ? "Missing '>'" : "Missing '}'", TOKEN_POSITION(token));
+        if (token.code == TOKEN_LBRACKET)
+            throw exception("Extensions and 'Any' expansions are not supported", TOKEN_POSITION(token));
+        if (!isIdentifier(token))
+            throw exception("Expected field name", TOKEN_POSITION(token));
+        const FieldCodec *fc = message.codec().find(token.value);
+        if (fc == nullptr)
+            throw exception("Unknown field '" + token.value + "' in '" + message.codec().message->qname + "'",
+                TOKEN_POSITION(token));
+
+        // the colon is optional before nested messages
+        bool colon = (tokens.next().code == TOKEN_COLON);
+        if (colon) tokens.next();
+        if (colon && tokens.current.code == TOKEN_LBRACKET)
+        {
+            if (!fc->repeated)
+                throw exception("List of values for non-repeated field '" + fc->field->name + "'",
+                    TOKEN_POSITION(tokens.current));
+            if (tokens.next().code != TOKEN_RBRACKET)
+            {
+                while (true)
+                {
+                    parseValue(tokens, message, *fc, depth);
+                    if (tokens.next().code == TOKEN_RBRACKET) break;
+                    if (tokens.current.code != TOKEN_COMMA)
+                        throw exception("Expected ',' or ']'", TOKEN_POSITION(tokens.current));
+                    tokens.next();
+                }
+            }
+        }
+        else
+        {
+            if (!colon && fc->message == nullptr)
+                throw exception("Expected ':'", TOKEN_POSITION(tokens.current));
+            parseValue(tokens, message, *fc, depth);
+        }
+
+        if (tokens.next().code != TOKEN_SCOLON && tokens.current.code != TOKEN_COMMA)
+            tokens.unget();
+    }
+}
+
+void TextFormat::parse( DynamicMessage &message, const char *data, size_t size )
+{
+    IteratorInputStream<const char*> is(data, data + size);
+    Tokenizer tokens(is);
+    tokens.hashComments = true;
+    parseMessage(tokens, message, TOKEN_EOF, 0);
+}
+
+void TextFormat::parse( DynamicMessage &message, std::istream &input )
+{
+    std::string content((std::istreambuf_iterator<char>(input)), std::istreambuf_iterator<char>());
+    parse(message, content.data(), content.size());
+}
+
+void TextFormat::toBinary( const MessageCodec &message, const char *data, size_t size, std::string &out )
+{
+    DynamicMessage temp(message);
+    parse(temp, data, size);
+    temp.encode(out);
+}
+
+static void printString( std::string &out, const std::string &value )
+{
+    static const char *HEX = "0123456789abcdef";
+    out += '"';
+    for (auto c : value)
+    {
+        unsigned char uc = (unsigned char) c;
+        if (c == '"' || c == '\\')
+        {
+            out += '\\';
+            out += c;
+        }
+        else
+        if (c == '\n')
+            out += "\\n";
+        else
+        if (c == '\r')
+            out += "\\r";
+        else
+        if (c == '\t')
+            out += "\\t";
+        else
+        if (uc < 0x20 || uc >= 0x7F)
+        {
+            out += "\\x";
+            out += HEX[uc >> 4];
+            out += HEX[uc & 15];
+        }
+        else
+            out += c;
+    }
+    out += '"';
+}
+
+static void printScalar( std::string &out, const FieldCodec &fc, const DynamicField &df, size_t index )
+{
+    char buffer[32];
+    if (fc.eref != nullptr)
+    {
+        int value = (int) df.getInt(index);
+        for (auto &constant : fc.eref->constants)
+        {
+            if (constant->value != value) continue;
+            out += constant->name;
+            return;
+        }
+        snprintf(buffer, sizeof(buffer), "%d", value);
+    }
+    else
+    if (fc.type == TYPE_DOUBLE || fc.type == TYPE_FLOAT)
+    {
+        double value = (fc.type == TYPE_DOUBLE) ? df.getDouble(index) : (double) df.getFloat(index);
+        if (std::isnan(value))
+            strcpy(buffer, "nan");
+        else
+        if (std::isinf(value))
+            strcpy(buffer, (value < 0) ? "-inf" : "inf");
+        else
+            buffer[formatReal(buffer, value, fc.type == TYPE_FLOAT)] = 0;
+    }
+    else
+    if (fc.type == TYPE_BOOL)
+        strcpy(buffer, df.getBool(index) ? "true" : "false");
+    else
+    if (isSigned(fc.type))
+        snprintf(buffer, sizeof(buffer), "%lld", (long long) df.getInt(index));
+    else
+        snprintf(buffer, sizeof(buffer), "%llu", (unsigned long long) df.getUInt(index));
+    out += buffer;
+}
+
+static void printMessage( std::string &out, const DynamicMessage &message, size_t indent )
+{
+    for (auto &fc : message.codec().fields)
+    {
+        const DynamicField &df = message.fields[fc.slot];
+        for (auto &nested : df.messages)
+        {
+            out.append(indent, ' ');
+            out += fc.field->name;
+            out += " {\n";
+            printMessage(out, *nested, indent + 2);
+            out.append(indent, ' ');
+            out += "}\n";
+        }
+        for (auto &value : df.strings)
+        {
+            out.append(indent, ' ');
+            out += fc.field->name;
+            out += ": ";
+            printString(out, value);
+            out += '\n';
+        }
+        for (size_t i = 0; i < df.values.size(); ++i)
+        {
+            out.append(indent, ' ');
+            out += fc.field->name;
+            out += ": ";
+            printScalar(out, fc, df, i);
+            out += '\n';
+        }
+    }
+}
+
+void TextFormat::print( const DynamicMessage &message, std::string &out )
+{
+    printMessage(out, message, 0);
+}
+
+} // protop
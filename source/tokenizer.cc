@@ -15,6 +15,8 @@
  */
 
 #include "tokenizer.hh"
+#include <protop/protop.hh>
+#include <chrono>
 
 namespace protop {
 
@@ -51,6 +53,8 @@ static const struct
     { TOKEN_RPC         , "rpc" },
     { TOKEN_SERVICE     , "service" },
     { TOKEN_RETURNS     , "returns" },
+    { TOKEN_STREAM      , "stream" },
+    { TOKEN_IMPORT      , "import" },
     { 0, nullptr },
 };
 
@@ -62,6 +66,38 @@ int findKeyword( const std::string &name )
     return TOKEN_NAME;
 }
 
+const char *tokenName( int code )
+{
+    switch (code)
+    {
+        case TOKEN_EOF:        return "eof";
+        case TOKEN_NAME:       return "name";
+        case TOKEN_QNAME:      return "qualified name";
+        case TOKEN_STRING:     return "string literal";
+        case TOKEN_INTEGER:    return "integer";
+        case TOKEN_REAL:       return "real number";
+        case TOKEN_COMMENT:    return "comment";
+        case TOKEN_EQUAL:      return "=";
+        case TOKEN_COLON:      return ":";
+        case TOKEN_MINUS:      return "-";
+        case TOKEN_SCOLON:     return ";";
+        case TOKEN_LT:         return "<";
+        case TOKEN_GT:         return ">";
+        case TOKEN_COMMA:      return ",";
+        case TOKEN_BEGIN:      return "{";
+        case TOKEN_END:        return "}";
+        case TOKEN_LBRACKET:   return "[";
+        case TOKEN_RBRACKET:   return "]";
+        case TOKEN_LPAREN:     return "(";
+        case TOKEN_RPAREN:     return ")";
+        case TOKEN_T_COMPLEX:  return "complex";
+        default:               break;
+    }
+    for (int i = 0; KEYWORDS[i].keyword != nullptr; ++i)
+        if (KEYWORDS[i].code == code) return KEYWORDS[i].keyword;
+    return nullptr;
+}
+
 Token::Token( int code, const std::string &value, int line, int column )
     : code(code), value(value), line(line), column(column)
 {
@@ -74,7 +110,8 @@ Token::Token( int code, const std::string &value, int line, int column )
     column = is.column() - value.length();
 }*/
 
-Tokenizer::Tokenizer( InputStream &is ) : ungot(false), is(is)
+Tokenizer::Tokenizer( InputStream &is, ParseStats *stats, bool comments ) : ungot(false), hashComments(false), is(is),
+    stats(stats), comments(comments), pendingLine(0), pendingSingle(false), lastLine(0)
 {
 }
 
@@ -88,6 +125,21 @@ void Tokenizer::unget()
 // TODO: create function to consume token and throw error is not from indicated type
 
 Token Tokenizer::next()
+{
+    if (stats == nullptr || ungot) return read();
+
+    auto start = std::chrono::steady_clock::now();
+    Token token = read();
+    stats->tokenizeTime += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    if (token.code != TOKEN_EOF)
+    {
+        ++stats->tokens;
+        if (token.code >= 0 && token.code < PROTOP_TOKEN_KINDS) ++stats->tokenKinds[token.code];
+    }
+    return token;
+}
+
+Token Tokenizer::read()
 {
     int line = 1;
     int column = 1;
@@ -114,23 +166,49 @@ Token Tokenizer::next()
         }
         else
         if (IS_DIGIT(cur))
-            current = integer(cur, line, column);
+            current = number(cur, line, column);
+        else
+        if (cur == '-' || cur == '.')
+        {
+            // only a number if followed by a digit
+            int next = is.get();
+            is.unget();
+            if (IS_DIGIT(next))
+                current = number(cur, line, column);
+            else
+            if (cur == '-')
+                current = Token(TOKEN_MINUS, "", line, column);
+            else
+                throw exception("Invalid symbol", line, column);
+        }
+        else
+        if (cur == '#' && hashComments)
+        {
+            while ((cur = is.get()) >= 0 && cur != '\n');
+            continue;
+        }
         else
         if (cur == '/')
         {
-            comment(); //discarding
+            if (comments)
+                recordComment(line);
+            else
+                skipComment();
             continue;
         }
         else
         if (cur == '\n' || cur == '\r')
             continue;
         else
-        if (cur == '"')
-            current = literalString(line, column);
+        if (cur == '"' || cur == '\'')
+            current = literalString(cur, line, column);
         else
         if (cur == '=')
             current = Token(TOKEN_EQUAL, "", line, column);
         else
+        if (cur == ':')
+            current = Token(TOKEN_COLON, "", line, column);
+        else
         if (cur == '{')
             current = Token(TOKEN_BEGIN, "", line, column);
         else
@@ -163,35 +241,121 @@ Token Tokenizer::next()
         else
             throw exception("Invalid symbol", line, column);
 
+        if (comments) attachComments();
         return current;
     }
 
-    return current = Token(TOKEN_EOF, "", line, column);
+    current = Token(TOKEN_EOF, "", line, column);
+    if (comments) attachComments();
+    return current;
 }
 
-Token Tokenizer::comment()
+/*
+ * Skips a comment (the first '/' is already consumed) without keeping its
+ * content. Returns whether it is a single line comment. The line break that
+ * ends a single line comment is left in the input.
+ */
+bool Tokenizer::skipComment()
 {
-    Token temp(TOKEN_COMMENT, "");
     int cur = is.get();
 
     if (cur == '/')
     {
-        while ((cur = is.get()) != '\n') temp.value += (char) cur;
-        return temp;
+        while ((cur = is.get()) >= 0 && cur != '\n');
+        is.unget();
+        return true;
     }
     else
     if (cur == '*')
     {
-        while (true)
+        while ((cur = is.get()) >= 0)
+            if (cur == '*' && is.expect('/')) break;
+    }
+    else
+        is.unget();
+    return false;
+}
+
+/*
+ * Skips a comment and records its location. A comment starting in the line of
+ * the previous token is a trailing comment; otherwise it becomes the leading
+ * comment of the next token. Consecutive single line comments are merged.
+ */
+void Tokenizer::recordComment( int line )
+{
+    size_t offset = is.offset() - 1;
+    bool single = skipComment();
+    CommentSpan span;
+    span.offset = offset;
+    span.length = is.offset() - offset;
+
+    if (line == lastLine && trailer.length == 0)
+    {
+        trailer = span;
+        return;
+    }
+    if (pending.length > 0 && single && pendingSingle && line == pendingLine + 1)
+        pending.length = span.offset + span.length - pending.offset;
+    else
+        pending = span;
+    pendingSingle = single;
+    pendingLine = is.line();
+}
+
+void Tokenizer::attachComments()
+{
+    previousTrailer = trailer;
+    trailer = CommentSpan();
+    // only comments ending in the line right before the token are attached
+    if (pending.length > 0 && pendingLine + 1 >= current.line)
+        current.comment = pending;
+    pending = CommentSpan();
+    lastLine = current.line;
+}
+
+CommentSpan Tokenizer::trailing()
+{
+    if (!comments) return CommentSpan();
+    // the trailing comment is only known after reading the next token
+    if (!ungot)
+    {
+        next();
+        unget();
+    }
+    return previousTrailer;
+}
+
+/*
+ * Counts braces at byte level. String literals and comments are skipped so the
+ * braces inside them are ignored.
+ */
+void Tokenizer::skipBlock()
+{
+    if (ungot) throw exception("Cannot skip a block after unget", current.line, current.column);
+
+    int depth = 1;
+    int cur;
+    while ((cur = is.get()) >= 0)
+    {
+        if (cur == '{')
+            ++depth;
+        else
+        if (cur == '}')
         {
-            cur = is.get();
-            if (cur == '*' && is.expect('/')) return temp;
-            if (cur < 0) return Token();
-            temp.value += (char) cur;
+            if (--depth == 0) return;
         }
+        else
+        if (cur == '"' || cur == '\'')
+        {
+            int quote = cur;
+            while ((cur = is.get()) >= 0 && cur != quote && cur != '\n')
+                if (cur == '\\') is.get();
+        }
+        else
+        if (cur == '/')
+            skipComment();
     }
-
-    return Token();
+    throw exception("Missing '}'", current.line, current.column);
 }
 
 Token Tokenizer::qname( int line, int column )
@@ -232,35 +396,197 @@ std::string Tokenizer::name()
     return temp;
 }
 
-Token Tokenizer::integer( int first, int line, int column )
+/*
+ * Reads a decimal, octal or hexadecimal integer or a real number. The sign and
+ * the digits are kept as written; the 'f' suffix of real numbers (text format)
+ * is consumed but not included in the value.
+ */
+Token Tokenizer::number( int first, int line, int column )
 {
     Token tt(TOKEN_INTEGER, "", line, column);
-    if (first != 0) tt.value += (char) first;
+    int cur = first;
+    if (cur == '-')
+    {
+        tt.value += '-';
+        cur = is.get();
+    }
 
-    do
+    if (cur == '0')
     {
-        int cur = is.get();
-        if (!IS_DIGIT(cur))
+        tt.value += '0';
+        cur = is.get();
+        if (cur == 'x' || cur == 'X')
         {
+            tt.value += (char) cur;
+            while (true)
+            {
+                cur = is.get();
+                if (!IS_HEX_DIGIT(cur)) break;
+                tt.value += (char) cur;
+            }
             is.unget();
+            if (!IS_HEX_DIGIT(tt.value.back()))
+                throw exception("Invalid hexadecimal number", line, column);
             return tt;
         }
+    }
+    while (IS_DIGIT(cur))
+    {
         tt.value += (char) cur;
-    } while (true);
-
+        cur = is.get();
+    }
+    if (cur == '.')
+    {
+        tt.code = TOKEN_REAL;
+        tt.value += '.';
+        cur = is.get();
+        while (IS_DIGIT(cur))
+        {
+            tt.value += (char) cur;
+            cur = is.get();
+        }
+    }
+    if (cur == 'e' || cur == 'E')
+    {
+        tt.code = TOKEN_REAL;
+        tt.value += 'e';
+        cur = is.get();
+        if (cur == '-' || cur == '+')
+        {
+            tt.value += (char) cur;
+            cur = is.get();
+        }
+        if (!IS_DIGIT(cur)) throw exception("Invalid exponent", line, column);
+        while (IS_DIGIT(cur))
+        {
+            tt.value += (char) cur;
+            cur = is.get();
+        }
+    }
+    // the suffix makes any decimal number a real (e.g. '1f')
+    if (cur == 'f' || cur == 'F')
+    {
+        tt.code = TOKEN_REAL;
+        return tt;
+    }
+    is.unget();
     return tt;
 }
 
-Token Tokenizer::literalString(int line, int column )
+static int hexValue( int c )
+{
+    if (IS_DIGIT(c)) return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+static void appendUtf8( std::string &out, uint32_t code )
+{
+    if (code < 0x80)
+        out += (char) code;
+    else
+    if (code < 0x800)
+    {
+        out += (char) (0xC0 | (code >> 6));
+        out += (char) (0x80 | (code & 0x3F));
+    }
+    else
+    if (code < 0x10000)
+    {
+        out += (char) (0xE0 | (code >> 12));
+        out += (char) (0x80 | ((code >> 6) & 0x3F));
+        out += (char) (0x80 | (code & 0x3F));
+    }
+    else
+    {
+        out += (char) (0xF0 | (code >> 18));
+        out += (char) (0x80 | ((code >> 12) & 0x3F));
+        out += (char) (0x80 | ((code >> 6) & 0x3F));
+        out += (char) (0x80 | (code & 0x3F));
+    }
+}
+
+/*
+ * Decodes the escape sequence after a backslash: C escapes, up to three octal
+ * digits, up to two hexadecimal digits ('\x') and Unicode code points ('\u' and
+ * '\U', written as UTF-8).
+ */
+void Tokenizer::escape( std::string &out, int line, int column )
+{
+    int cur = is.get();
+    switch (cur)
+    {
+        case 'a': out += '\a'; return;
+        case 'b': out += '\b'; return;
+        case 'f': out += '\f'; return;
+        case 'n': out += '\n'; return;
+        case 'r': out += '\r'; return;
+        case 't': out += '\t'; return;
+        case 'v': out += '\v'; return;
+        case '\\':
+        case '\'':
+        case '"':
+        case '?':
+            out += (char) cur;
+            return;
+        default:
+            break;
+    }
+
+    if (cur >= '0' && cur <= '7')
+    {
+        int value = cur - '0';
+        for (int i = 0; i < 2; ++i)
+        {
+            cur = is.get();
+            if (cur < '0' || cur > '7')
+            {
+                is.unget();
+                break;
+            }
+            value = value * 8 + (cur - '0');
+        }
+        out += (char) value;
+        return;
+    }
+
+    int digits = (cur == 'x' || cur == 'X') ? 2 : (cur == 'u') ? 4 : (cur == 'U') ? 8 : 0;
+    if (digits == 0) throw exception("Invalid escape sequence", line, column);
+    uint32_t value = 0;
+    int count = 0;
+    for (; count < digits; ++count)
+    {
+        int digit = hexValue(cur = is.get());
+        if (digit < 0)
+        {
+            is.unget();
+            break;
+        }
+        value = (value << 4) | (uint32_t) digit;
+    }
+    // only '\x' accepts less digits than the maximum
+    if (count == 0 || (digits > 2 && count != digits) || value > 0x10FFFF)
+        throw exception("Invalid escape sequence", line, column);
+    if (digits == 2)
+        out += (char) value;
+    else
+        appendUtf8(out, value);
+}
+
+Token Tokenizer::literalString( int quote, int line, int column )
 {
     Token tt(TOKEN_STRING, "", line, column);
 
     do
     {
         int cur = is.get();
-        if (cur == '\n' || cur == 0) return Token();
-        if (cur == '"') return tt;
-        tt.value += (char) cur;
+        if (cur == '\n' || cur < 0) throw exception("Missing closing quote", line, column);
+        if (cur == quote) return tt;
+        if (cur == '\\')
+            escape(tt.value, line, column);
+        else
+            tt.value += (char) cur;
     } while (true);
 
     return tt;
@@ -17,6 +17,7 @@
 #ifndef PROTOP_TOKENIZER
 #define PROTOP_TOKENIZER
 
+#include <protop/protop.hh>
 #include <string>
 #include "exception.hh"
 
@@ -65,9 +66,15 @@
 #define TOKEN_RETURNS          43
 #define TOKEN_LPAREN           44
 #define TOKEN_RPAREN           45
+#define TOKEN_STREAM           46
+#define TOKEN_IMPORT           47
+#define TOKEN_REAL             48
+#define TOKEN_COLON            49
+#define TOKEN_MINUS            50
 
 #define IS_LETTER(x)           ( ((x) >= 'A' && (x) <= 'Z') || ((x) >= 'a' && (x) <= 'z') || (x) == '_' )
 #define IS_DIGIT(x)            ( (x) >= '0' && (x) <= '9' )
+#define IS_HEX_DIGIT(x)        ( IS_DIGIT(x) || ((x) >= 'a' && (x) <= 'f') || ((x) >= 'A' && (x) <= 'F') )
 #define IS_LETTER_OR_DIGIT(x)  ( IS_LETTER(x) || IS_DIGIT(x) )
 
 namespace protop {
@@ -84,6 +91,8 @@ class InputStream
         virtual int column() const = 0;
         virtual void skipws() = 0;
         virtual bool expect(int expect) = 0;
+        // offset of the next byte (only required when tracking comments)
+        virtual size_t offset() const { return 0; }
 };
 
 template <typename I> class IteratorInputStream : public InputStream
@@ -174,32 +183,55 @@ struct Token
     int code;
     std::string value;
     int line, column;
+    // leading comment (only when tracking comments)
+    CommentSpan comment;
 
     Token( int code = TOKEN_EOF, const std::string &value = "", int line = 1, int column = 1);
     //Token( int code, const std::string &value, InputStream &is );
 };
 
 int findKeyword( const std::string &name );
+const char *tokenName( int code );
 
 class Tokenizer
 {
     public:
         Token current;
         bool ungot;
+        // treat '#' as the start of a single line comment (text format)
+        bool hashComments;
 
-        Tokenizer( InputStream &is );
+        Tokenizer( InputStream &is, ParseStats *stats = nullptr, bool comments = false );
         void unget();
         // TODO: create function to consume token and throw error is not from indicated type
         Token next();
+        // comment in the same line after the current token (only when tracking comments)
+        CommentSpan trailing();
+        // skip up to the '}' matching the current '{' without producing tokens
+        void skipBlock();
 
     private:
         InputStream &is;
-
-        Token comment();
+        ParseStats *stats;
+        bool comments;
+        // comment block waiting for the next token and the line it ends
+        CommentSpan pending;
+        int pendingLine;
+        bool pendingSingle;
+        // trailing comments of the current and of the previous token
+        CommentSpan trailer;
+        CommentSpan previousTrailer;
+        int lastLine;
+
+        Token read();
+        bool skipComment();
+        void recordComment( int line );
+        void attachComments();
         Token qname( int line = 1, int column = 1 );
         std::string name();
-        Token integer( int first = 0, int line = 1, int column = 1 );
-        Token literalString(int line = 1, int column = 1 );
+        Token number( int first, int line = 1, int column = 1 );
+        Token literalString( int quote, int line = 1, int column = 1 );
+        void escape( std::string &out, int line, int column );
 };
 
 } // protop
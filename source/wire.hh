@@ -0,0 +1,149 @@
+/*
+ * Copyright 2020-2022 Bruno Ribeiro <https://github.com/brunexgeek>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef PROTOP_WIRE
+#define PROTOP_WIRE
+
+#include <protop/codec.hh>
+#include "exception.hh"
+
+namespace protop {
+
+static inline size_t varintSize( uint64_t value )
+{
+    size_t size = 1;
+    while (value >= 0x80)
+    {
+        value >>= 7;
+        ++size;
+    }
+    return size;
+}
+
+static inline uint8_t *writeVarint( uint8_t *ptr, uint64_t value )
+{
+    while (value >= 0x80)
+    {
+        *ptr++ = (uint8_t) (value | 0x80);
+        value >>= 7;
+    }
+    *ptr++ = (uint8_t) value;
+    return ptr;
+}
+
+static inline uint8_t *writeFixed32( uint8_t *ptr, uint32_t value )
+{
+    for (int i = 0; i < 4; ++i, value >>= 8)
+        *ptr++ = (uint8_t) value;
+    return ptr;
+}
+
+static inline uint8_t *writeFixed64( uint8_t *ptr, uint64_t value )
+{
+    for (int i = 0; i < 8; ++i, value >>= 8)
+        *ptr++ = (uint8_t) value;
+    return ptr;
+}
+
+static inline const uint8_t *readVarint( const uint8_t *ptr, const uint8_t *end, uint64_t &value )
+{
+    // fast path for single byte values
+    if (ptr < end && *ptr < 0x80)
+    {
+        value = *ptr;
+        return ptr + 1;
+    }
+    value = 0;
+    for (int shift = 0; shift < 64 && ptr < end; shift += 7)
+    {
+        uint64_t byte = *ptr++;
+        value |= (byte & 0x7F) << shift;
+        if (byte < 0x80) return ptr;
+    }
+    throw exception("Malformed varint");
+}
+
+static inline uint32_t readFixed32( const uint8_t *ptr )
+{
+    return (uint32_t) ptr[0] | ((uint32_t) ptr[1] << 8) | ((uint32_t) ptr[2] << 16) | ((uint32_t) ptr[3] << 24);
+}
+
+static inline uint64_t readFixed64( const uint8_t *ptr )
+{
+    return (uint64_t) readFixed32(ptr) | ((uint64_t) readFixed32(ptr + 4) << 32);
+}
+
+static inline uint64_t encodeZigZag( const FieldCodec &fc, uint64_t value )
+{
+    if (fc.type == TYPE_SINT32)
+    {
+        int32_t temp = (int32_t) value;
+        return (uint32_t) (((uint32_t) temp << 1) ^ (uint32_t) (temp >> 31));
+    }
+    int64_t temp = (int64_t) value;
+    return ((uint64_t) temp << 1) ^ (uint64_t) (temp >> 63);
+}
+
+// convert a raw varint into the representation used by 'DynamicField'
+static inline uint64_t fromVarint( const FieldCodec &fc, uint64_t value )
+{
+    switch (fc.type)
+    {
+        case TYPE_INT32:
+        case TYPE_COMPLEX:
+            return (uint64_t) (int64_t) (int32_t) value;
+        case TYPE_UINT32:
+            return (uint32_t) value;
+        case TYPE_SINT32:
+            return (uint64_t) (int64_t) (int32_t) ((uint32_t) (value >> 1) ^ (uint32_t) -(int32_t) (value & 1));
+        case TYPE_SINT64:
+            return (value >> 1) ^ (uint64_t) -(int64_t) (value & 1);
+        case TYPE_BOOL:
+            return value != 0;
+        default:
+            return value;
+    }
+}
+
+// convert a raw fixed 32-bit value into the representation used by 'DynamicField'
+static inline uint64_t fromFixed32( const FieldCodec &fc, uint32_t value )
+{
+    if (fc.type == TYPE_SFIXED32)
+        return (uint64_t) (int64_t) (int32_t) value;
+    return value;
+}
+
+static inline size_t valueSize( const FieldCodec &fc, uint64_t value )
+{
+    if (fc.wire == WIRE_FIXED32) return 4;
+    if (fc.wire == WIRE_FIXED64) return 8;
+    if (fc.type == TYPE_SINT32 || fc.type == TYPE_SINT64)
+        return varintSize(encodeZigZag(fc, value));
+    return varintSize(value);
+}
+
+static inline uint8_t *writeValue( uint8_t *ptr, const FieldCodec &fc, uint64_t value )
+{
+    if (fc.wire == WIRE_FIXED32) return writeFixed32(ptr, (uint32_t) value);
+    if (fc.wire == WIRE_FIXED64) return writeFixed64(ptr, value);
+    if (fc.type == TYPE_SINT32 || fc.type == TYPE_SINT64)
+        return writeVarint(ptr, encodeZigZag(fc, value));
+    return writeVarint(ptr, value);
+}
+
+} // protop
+
+#endif // PROTOP_WIRE
@@ -0,0 +1,286 @@
+/*
+ * Copyright 2020-2022 Bruno Ribeiro <https://github.com/brunexgeek>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <protop/writer.hh>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <cstdio>
+#include <new>
+#include <vector>
+#include <algorithm>
+#include <utility>
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#include <sys/uio.h>
+#include <limits.h>
+#endif
+#include <fcntl.h>
+
+namespace protop {
+
+#define INITIAL_CAPACITY 4096
+
+#if !defined(_WIN32) && !defined(IOV_MAX)
+#define IOV_MAX 1024
+#endif
+
+static const char DIGITS[] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+CodeWriter::CodeWriter( const std::string &indentation ) : data_(nullptr), size_(0), capacity_(0),
+    indentation_(indentation), level_(0), lineStart_(true)
+{
+}
+
+CodeWriter::CodeWriter( CodeWriter &&that ) : data_(that.data_), size_(that.size_),
+    capacity_(that.capacity_), indentation_(std::move(that.indentation_)), level_(that.level_),
+    lineStart_(that.lineStart_)
+{
+    that.data_ = nullptr;
+    that.size_ = that.capacity_ = 0;
+}
+
+CodeWriter::~CodeWriter()
+{
+    free(data_);
+}
+
+CodeWriter &CodeWriter::operator=( CodeWriter &&that )
+{
+    CodeWriter temp(std::move(that));
+    swap(temp);
+    return *this;
+}
+
+void CodeWriter::swap( CodeWriter &that )
+{
+    std::swap(data_, that.data_);
+    std::swap(size_, that.size_);
+    std::swap(capacity_, that.capacity_);
+    std::swap(indentation_, that.indentation_);
+    std::swap(level_, that.level_);
+    std::swap(lineStart_, that.lineStart_);
+}
+
+void CodeWriter::clear()
+{
+    size_ = 0;
+    lineStart_ = true;
+}
+
+void CodeWriter::reserve( size_t size )
+{
+    if (size <= capacity_) return;
+    size_t capacity = (capacity_ == 0) ? INITIAL_CAPACITY : capacity_;
+    while (capacity < size) capacity *= 2;
+    char *data = (char*) realloc(data_, capacity);
+    if (data == nullptr) throw std::bad_alloc();
+    data_ = data;
+    capacity_ = capacity;
+}
+
+void CodeWriter::append( const char *data, size_t size )
+{
+    if (size == 0) return;
+    reserve(size_ + size);
+    memcpy(data_ + size_, data, size);
+    size_ += size;
+}
+
+void CodeWriter::write( const char *data, size_t size )
+{
+    if (level_ == 0)
+    {
+        append(data, size);
+        if (size > 0) lineStart_ = data[size - 1] == '\n';
+        return;
+    }
+
+    const char *end = data + size;
+    while (data < end)
+    {
+        const char *next = (const char*) memchr(data, '\n', (size_t) (end - data));
+        next = (next == nullptr) ? end : next + 1;
+        // empty lines are not indented
+        if (lineStart_ && *data != '\n')
+            for (int i = 0; i < level_; ++i) append(indentation_.data(), indentation_.size());
+        append(data, (size_t) (next - data));
+        lineStart_ = next[-1] == '\n';
+        data = next;
+    }
+}
+
+CodeWriter &CodeWriter::operator<<( const std::string &value )
+{
+    write(value.data(), value.size());
+    return *this;
+}
+
+CodeWriter &CodeWriter::operator<<( const char *value )
+{
+    write(value, strlen(value));
+    return *this;
+}
+
+CodeWriter &CodeWriter::operator<<( char value )
+{
+    write(&value, 1);
+    return *this;
+}
+
+void CodeWriter::writeUnsigned( uint64_t value, bool negative )
+{
+    char buffer[24];
+    char *ptr = buffer + sizeof(buffer);
+    while (value >= 100)
+    {
+        size_t index = (size_t) (value % 100) * 2;
+        value /= 100;
+        *--ptr = DIGITS[index + 1];
+        *--ptr = DIGITS[index];
+    }
+    if (value >= 10)
+    {
+        *--ptr = DIGITS[value * 2 + 1];
+        *--ptr = DIGITS[value * 2];
+    }
+    else
+        *--ptr = (char) ('0' + value);
+    if (negative) *--ptr = '-';
+    write(ptr, (size_t) (buffer + sizeof(buffer) - ptr));
+}
+
+CodeWriter &CodeWriter::operator<<( int value )
+{
+    return *this << (long long) value;
+}
+
+CodeWriter &CodeWriter::operator<<( long value )
+{
+    return *this << (long long) value;
+}
+
+CodeWriter &CodeWriter::operator<<( long long value )
+{
+    if (value < 0)
+        writeUnsigned(0 - (uint64_t) value, true);
+    else
+        writeUnsigned((uint64_t) value, false);
+    return *this;
+}
+
+CodeWriter &CodeWriter::operator<<( unsigned value )
+{
+    writeUnsigned(value, false);
+    return *this;
+}
+
+CodeWriter &CodeWriter::operator<<( unsigned long value )
+{
+    writeUnsigned(value, false);
+    return *this;
+}
+
+CodeWriter &CodeWriter::operator<<( unsigned long long value )
+{
+    writeUnsigned(value, false);
+    return *this;
+}
+
+bool CodeWriter::writeTo( int fd ) const
+{
+    const CodeWriter *self = this;
+    return writeTo(fd, &self, 1);
+}
+
+bool CodeWriter::writeTo( int fd, const CodeWriter *const *writers, size_t count )
+{
+#ifdef _WIN32
+    for (size_t i = 0; i < count; ++i)
+    {
+        const char *ptr = writers[i]->data_;
+        size_t left = writers[i]->size_;
+        while (left > 0)
+        {
+            int result = _write(fd, ptr, (unsigned) left);
+            if (result < 0 && errno == EINTR) continue;
+            if (result <= 0) return false;
+            ptr += result;
+            left -= (size_t) result;
+        }
+    }
+    return true;
+#else
+    std::vector<struct iovec> vector;
+    for (size_t i = 0; i < count; ++i)
+    {
+        if (writers[i]->size_ == 0) continue;
+        struct iovec item;
+        item.iov_base = writers[i]->data_;
+        item.iov_len = writers[i]->size_;
+        vector.push_back(item);
+    }
+    // retry after partial writes and interrupted calls
+    size_t index = 0;
+    while (index < vector.size())
+    {
+        int items = (int) std::min(vector.size() - index, (size_t) IOV_MAX);
+        ssize_t result = ::writev(fd, vector.data() + index, items);
+        if (result < 0 && errno == EINTR) continue;
+        if (result < 0) return false;
+        size_t written = (size_t) result;
+        while (index < vector.size() && written >= vector[index].iov_len)
+            written -= vector[index++].iov_len;
+        if (written > 0)
+        {
+            vector[index].iov_base = (char*) vector[index].iov_base + written;
+            vector[index].iov_len -= written;
+        }
+    }
+    return true;
+#endif
+}
+
+bool CodeWriter::writeFile( const std::string &path ) const
+{
+#ifdef _WIN32
+    int fd = _open(path.c_str(), _O_WRONLY | _O_CREAT | _O_TRUNC | _O_BINARY, 0644);
+#else
+    int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+#endif
+    if (fd < 0) return false;
+    bool result = writeTo(fd);
+#ifdef _WIN32
+    if (_close(fd) != 0) result = false;
+#else
+    if (::close(fd) != 0) result = false;
+#endif
+    return result;
+}
+
+} // protop
@@ -0,0 +1,146 @@
+/*
+ * Copyright 2020-2022 Bruno Ribeiro <https://github.com/brunexgeek>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <protop/codec.hh>
+#include <iostream>
+#include <sstream>
+
+// checks that messages survive an encode/decode round trip, that repeated scalars are
+// accepted both packed and unpacked and that unknown fields are kept verbatim
+
+static int failures = 0;
+
+#define CHECK(x) \
+    do { if (!(x)) { std::cerr << __FILE__ << ":" << __LINE__ << ": check failed: " #x "\n"; ++failures; } } while (0)
+
+static const char *SCHEMA =
+    "syntax = \"proto3\";\n"
+    "package p;\n"
+    "message Inner { string s = 1; }\n"
+    "message Outer {\n"
+    "    int32 i = 1;\n"
+    "    sint64 z = 2;\n"
+    "    repeated int32 r = 3;\n"
+    "    repeated string names = 4;\n"
+    "    Inner inner = 5;\n"
+    "    double d = 6;\n"
+    "    bytes b = 7;\n"
+    "    fixed32 f = 8;\n"
+    "}\n";
+
+static void round_trip( const protop::MessageCodec &mc )
+{
+    protop::DynamicMessage message(mc);
+    message.field("i")->addInt(-1);
+    message.field("z")->addInt(-300);
+    for (int i = 0; i < 5; ++i) message.field("r")->addInt(i * 1000);
+    message.field("names")->strings.push_back("first");
+    message.field("names")->strings.push_back("");
+    message.addMessage(*mc.find("inner")).field("s")->strings.push_back("nested");
+    message.field("d")->addDouble(2.5);
+    message.field("b")->strings.push_back(std::string("\0\xff", 2));
+    message.field("f")->addUInt(0xDEADBEEF);
+
+    std::string data;
+    message.encode(data);
+    CHECK(data.size() == message.byteSize());
+
+    protop::DynamicMessage decoded(mc);
+    decoded.decode(data);
+    CHECK(decoded.field("i")->getInt() == -1);
+    CHECK(decoded.field("z")->getInt() == -300);
+    CHECK(decoded.field("r")->values.size() == 5);
+    CHECK(decoded.field("r")->values.size() == 5 && decoded.field("r")->getInt(4) == 4000);
+    CHECK(decoded.field("names")->strings.size() == 2);
+    CHECK(decoded.field("inner")->messages.size() == 1);
+    CHECK(decoded.field("inner")->messages.size() == 1 &&
+        decoded.field("inner")->messages[0]->field("s")->strings[0] == "nested");
+    CHECK(decoded.field("d")->getDouble() == 2.5);
+    CHECK(decoded.field("b")->strings[0] == std::string("\0\xff", 2));
+    CHECK(decoded.field("f")->getUInt() == 0xDEADBEEF);
+
+    std::string again;
+    decoded.encode(again);
+    CHECK(again == data);
+}
+
+static void packed_and_unpacked( const protop::MessageCodec &mc )
+{
+    // field 3 as two unpacked values followed by a packed block with two more
+    static const uint8_t DATA[] = { 0x18, 0x01, 0x18, 0x02, 0x1A, 0x03, 0x03, 0xAC, 0x02 };
+    protop::DynamicMessage message(mc);
+    message.decode(DATA, sizeof(DATA));
+    auto r = message.field("r");
+    CHECK(r->values.size() == 4);
+    if (r->values.size() == 4)
+    {
+        CHECK(r->getInt(0) == 1);
+        CHECK(r->getInt(1) == 2);
+        CHECK(r->getInt(2) == 3);
+        CHECK(r->getInt(3) == 300);
+    }
+
+    // re-encoded as a single packed block
+    std::string data;
+    message.encode(data);
+    CHECK(data == std::string("\x1A\x05\x01\x02\x03\xAC\x02", 7));
+}
+
+static void unknown_fields( const protop::MessageCodec &mc )
+{
+    // field 99 (varint) and field 100 (length) are not in the schema
+    static const uint8_t DATA[] = { 0x08, 0x05, 0x98, 0x06, 0x07, 0xA2, 0x06, 0x02, 'h', 'i' };
+    protop::DynamicMessage message(mc);
+    message.decode(DATA, sizeof(DATA));
+    CHECK(message.field("i")->getInt() == 5);
+    CHECK(message.unknown == std::string("\x98\x06\x07\xA2\x06\x02hi", 8));
+
+    std::string data;
+    message.encode(data);
+    CHECK(data == std::string((const char *) DATA, sizeof(DATA)));
+}
+
+static void truncated( const protop::MessageCodec &mc )
+{
+    static const uint8_t DATA[] = { 0x2A, 0x05, 0x0A, 0x01 };
+    protop::DynamicMessage message(mc);
+    bool thrown = false;
+    try
+    {
+        message.decode(DATA, sizeof(DATA));
+    } catch (std::exception &)
+    {
+        thrown = true;
+    }
+    CHECK(thrown);
+}
+
+int main()
+{
+    std::stringstream input(SCHEMA);
+    protop::Proto proto;
+    protop::Proto::parse(proto, input, "roundtrip.proto");
+    protop::Codec codec(proto);
+    auto mc = codec.find("p.Outer");
+    CHECK(mc != nullptr);
+    if (mc == nullptr) return 1;
+
+    round_trip(*mc);
+    packed_and_unpacked(*mc);
+    unknown_fields(*mc);
+    truncated(*mc);
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,86 @@
+/*
+ * Copyright 2020-2022 Bruno Ribeiro <https://github.com/brunexgeek>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <protop/diff.hh>
+#include <iostream>
+#include <sstream>
+
+// checks the structural changes reported between two versions of a file
+
+static int failures = 0;
+
+#define CHECK(x) \
+    do { if (!(x)) { std::cerr << __FILE__ << ":" << __LINE__ << ": check failed: " #x "\n"; ++failures; } } while (0)
+
+static void parse( protop::Proto &proto, const std::string &content )
+{
+    std::stringstream input(content);
+    protop::Proto::parse(proto, input, "changes.proto");
+}
+
+static bool has( const std::vector<protop::Change> &changes, protop::ChangeType type,
+    const std::string &entity, const std::string &member )
+{
+    for (auto &change : changes)
+        if (change.type == type && change.entity == entity && change.member == member) return true;
+    return false;
+}
+
+int main()
+{
+    protop::Proto before;
+    parse(before,
+        "syntax = \"proto3\"; package p;\n"
+        "enum E { A = 0; B = 1; }\n"
+        "message M { int32 x = 1; string y = 2; E e = 3; }\n"
+        "message Old { }\n"
+        "service S { rpc Call (M) returns (M); }\n");
+
+    // same structure in a different order and format
+    protop::Proto reordered;
+    parse(reordered,
+        "syntax = \"proto3\"; package p;\n"
+        "service S { rpc Call (M) returns (M); }\n"
+        "message Old { }\n"
+        "// comment\n"
+        "message M { E e = 3; string y = 2; int32 x = 1; }\n"
+        "enum E { B = 1; A = 0; }\n");
+    CHECK(protop::diff(before, reordered).empty());
+    CHECK(before.fingerprint == reordered.fingerprint);
+
+    protop::Proto after;
+    parse(after,
+        "syntax = \"proto3\"; package p;\n"
+        "enum E { A = 0; B = 2; C = 3; }\n"
+        "message M { int32 x = 4; bytes y = 2; E e = 3; bool z = 5; }\n"
+        "message New { }\n"
+        "service S { rpc Call (M) returns (New); }\n");
+    auto changes = protop::diff(before, after);
+    CHECK(has(changes, protop::ChangeType::FIELD_RENUMBERED, "p.M", "x"));
+    CHECK(has(changes, protop::ChangeType::FIELD_RETYPED, "p.M", "y"));
+    CHECK(has(changes, protop::ChangeType::FIELD_ADDED, "p.M", "z"));
+    CHECK(!has(changes, protop::ChangeType::FIELD_RETYPED, "p.M", "e"));
+    CHECK(has(changes, protop::ChangeType::CONSTANT_CHANGED, "p.E", "B"));
+    CHECK(has(changes, protop::ChangeType::CONSTANT_ADDED, "p.E", "C"));
+    CHECK(has(changes, protop::ChangeType::MESSAGE_REMOVED, "p.Old", ""));
+    CHECK(has(changes, protop::ChangeType::MESSAGE_ADDED, "p.New", ""));
+    CHECK(has(changes, protop::ChangeType::PROCEDURE_CHANGED, "p.S", "Call"));
+    CHECK(before.fingerprint != after.fingerprint);
+
+    for (auto &change : changes)
+        CHECK(protop::changeName(change.type) != nullptr);
+    return failures == 0 ? 0 : 1;
+}
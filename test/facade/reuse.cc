@@ -0,0 +1,93 @@
+/*
+ * Copyright 2020-2022 Bruno Ribeiro <https://github.com/brunexgeek>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "facade.hh"
+#include <iostream>
+#include <cstdlib>
+#include <new>
+
+// checks that parsing into a message that already has the same shape does not allocate
+
+static int failures = 0;
+static bool counting = false;
+static size_t allocations = 0;
+
+#define CHECK(x) \
+    do { if (!(x)) { std::cerr << __FILE__ << ":" << __LINE__ << ": check failed: " #x "\n"; ++failures; } } while (0)
+
+void *operator new( size_t size )
+{
+    if (counting) ++allocations;
+    void *ptr = std::malloc(size > 0 ? size : 1);
+    if (ptr == nullptr) throw std::bad_alloc();
+    return ptr;
+}
+
+void operator delete( void *ptr ) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete( void *ptr, size_t ) noexcept
+{
+    std::free(ptr);
+}
+
+static void fill( facade::test::Customer &customer, int seed )
+{
+    customer.set_id(seed);
+    customer.set_name(std::string(40, 'n'));
+    customer.mutable_address()->set_street(std::string(40, 's'));
+    for (int i = 0; i < 5; ++i)
+    {
+        customer.add_others()->set_street(std::string(40 + i, 'o'));
+        customer.add_tags(std::string(40 + i, 't'));
+        customer.add_codes(i);
+    }
+}
+
+int main()
+{
+    facade::test::Request message;
+    fill(*message.mutable_customer(), 1);
+    for (int i = 0; i < 3; ++i) fill(*message.add_batch(), i);
+    std::string bytes = message.SerializeAsString();
+
+    facade::test_::Request request;
+    CHECK(request.parse(bytes.data(), bytes.size()));
+    counting = true;
+    bool parsed = request.parse(bytes.data(), bytes.size());
+    counting = false;
+    CHECK(parsed);
+    CHECK(allocations == 0);
+    CHECK(request == facade::test_::Request(message));
+
+    // 'clear' keeps the buffers, but the message is equal to a new one
+    size_t capacity = request.batch.capacity();
+    request.clear();
+    CHECK(request == facade::test_::Request());
+    CHECK(request.batch.empty() && request.batch.capacity() == capacity);
+
+    // items not present in the input are removed
+    CHECK(request.parse(bytes.data(), bytes.size()));
+    facade::test::Request smaller;
+    fill(*smaller.add_batch(), 7);
+    std::string other = smaller.SerializeAsString();
+    CHECK(request.parse(other.data(), other.size()));
+    CHECK(request == facade::test_::Request(smaller));
+
+    return failures == 0 ? 0 : 1;
+}
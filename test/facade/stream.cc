@@ -0,0 +1,61 @@
+/*
+ * Copyright 2020-2022 Bruno Ribeiro <https://github.com/brunexgeek>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "facade.hh"
+#include <iostream>
+#include <vector>
+
+// checks that the batching writer keeps the messages it could not write
+
+static int failures = 0;
+
+#define CHECK(x) \
+    do { if (!(x)) { std::cerr << __FILE__ << ":" << __LINE__ << ": check failed: " #x "\n"; ++failures; } } while (0)
+
+// accepts 'limit' writes, then fails
+struct Stream
+{
+    size_t limit;
+    std::vector<int64_t> written;
+
+    bool Write( const facade::test::Customer &value )
+    {
+        if (written.size() >= limit) return false;
+        written.push_back(value.id());
+        return true;
+    }
+};
+
+int main()
+{
+    facade::test_::RegistryUploadRequestWriter writer(8);
+    for (int i = 0; i < 5; ++i) writer.add().id = i;
+
+    Stream stream{2, {}};
+    CHECK(!writer.flush(stream));
+    CHECK(stream.written.size() == 2);
+    CHECK(writer.size() == 3);
+    for (size_t i = 0; i < writer.size(); ++i) CHECK(writer[i].id == (int64_t) i + 2);
+
+    // the pending messages are written first and new ones go after them
+    writer.add().id = 5;
+    stream.limit = 100;
+    CHECK(writer.flush(stream));
+    CHECK(writer.size() == 0);
+    CHECK((stream.written == std::vector<int64_t>{0, 1, 2, 3, 4, 5}));
+
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,69 @@
+/*
+ * Copyright 2020-2022 Bruno Ribeiro <https://github.com/brunexgeek>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "facade.hh"
+#include <iostream>
+
+// checks that the facade serializer produces the same bytes as libprotobuf
+
+static int failures = 0;
+
+#define CHECK(x) \
+    do { if (!(x)) { std::cerr << __FILE__ << ":" << __LINE__ << ": check failed: " #x "\n"; ++failures; } } while (0)
+
+static void fill( facade::test::Customer &customer, int seed )
+{
+    customer.set_id(1000 + seed);
+    customer.set_name("customer " + std::to_string(seed));
+    customer.mutable_address()->set_street("main street");
+    customer.mutable_address()->set_number(seed);
+    for (int i = 0; i < seed; ++i)
+    {
+        customer.add_others()->set_number(i + 1);
+        customer.add_tags("tag " + std::to_string(i));
+        customer.add_codes(-i);
+    }
+    customer.set_kind(facade::test::KIND_WHOLESALE);
+    customer.set_balance(seed * 1.5);
+}
+
+int main()
+{
+    // messages without fields set are not written at all
+    facade::test_::Request empty;
+    std::string bytes;
+    empty.serialize(bytes);
+    CHECK(bytes.empty());
+    CHECK(bytes == facade::test::Request().SerializeAsString());
+
+    facade::test_::Customer customer;
+    customer.id = 1;
+    customer.serialize(bytes);
+    CHECK(bytes == std::string("\x08\x01", 2));
+
+    facade::test::Request message;
+    fill(*message.mutable_customer(), 3);
+    for (int i = 0; i < 4; ++i) fill(*message.add_batch(), i);
+    facade::test_::Request request(message);
+    request.serialize(bytes);
+    CHECK(bytes == message.SerializeAsString());
+
+    facade::test_::Request parsed;
+    CHECK(parsed.parse(bytes.data(), bytes.size()));
+    CHECK(parsed == request);
+
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,127 @@
+/*
+ * Copyright 2020-2022 Bruno Ribeiro <https://github.com/brunexgeek>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <protop/index.hh>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <unistd.h>
+#include <sys/stat.h>
+
+// checks that rebuilding an index only parses the files that changed and that
+// invalid index files are rejected
+
+static int failures = 0;
+
+#define CHECK(x) \
+    do { if (!(x)) { std::cerr << __FILE__ << ":" << __LINE__ << ": check failed: " #x "\n"; ++failures; } } while (0)
+
+static void write_file( const std::string &path, const std::string &content )
+{
+    std::ofstream output(path, std::ios::binary | std::ios::trunc);
+    output << content;
+}
+
+static bool opens( const std::string &path )
+{
+    try
+    {
+        protop::RepositoryIndex index(path);
+        return true;
+    } catch (std::exception &)
+    {
+        return false;
+    }
+}
+
+int main()
+{
+    char temp[] = "/tmp/protop-index-XXXXXX";
+    if (mkdtemp(temp) == nullptr) return 1;
+    std::string dir = temp;
+    std::string root = dir + "/src";
+    std::string path = dir + "/index";
+    mkdir(root.c_str(), 0700);
+
+    write_file(root + "/a.proto", "syntax = \"proto3\"; package p; message A { int32 x = 1; }");
+    write_file(root + "/b.proto", "syntax = \"proto3\"; package p; message B { A a = 1; }");
+
+    auto stats = protop::RepositoryIndex::build(root, path);
+    CHECK(stats.files == 2);
+    CHECK(stats.parsed == 2);
+    CHECK(stats.failed == 0);
+    CHECK(stats.symbols == 2);
+    CHECK(stats.references == 1);
+    {
+        protop::RepositoryIndex index(path);
+        protop::IndexedSymbol symbol;
+        CHECK(index.find("p.A", symbol) && symbol.file == "a.proto");
+        auto refs = index.references("p.A");
+        CHECK(refs.size() == 1 && refs[0].name == "p.B");
+    }
+
+    // nothing changed
+    stats = protop::RepositoryIndex::build(root, path);
+    CHECK(stats.files == 2);
+    CHECK(stats.parsed == 0);
+
+    // only the changed file is parsed, but references are resolved again
+    write_file(root + "/a.proto", "syntax = \"proto3\"; package p; message A { int32 x = 1; } message C { B b = 1; }");
+    stats = protop::RepositoryIndex::build(root, path);
+    CHECK(stats.parsed == 1);
+    CHECK(stats.symbols == 3);
+    CHECK(stats.references == 2);
+    {
+        protop::RepositoryIndex index(path);
+        CHECK(index.declarations("a.proto").size() == 2);
+        auto deps = index.dependencies("p.C");
+        CHECK(deps.size() == 1 && deps[0].name == "p.B");
+    }
+
+    // files that cannot be parsed are kept without declarations
+    write_file(root + "/c.proto", "message {");
+    stats = protop::RepositoryIndex::build(root, path);
+    CHECK(stats.files == 3);
+    CHECK(stats.parsed == 1);
+    CHECK(stats.failed == 1);
+    CHECK(opens(path));
+
+    // corrupt, truncated and missing files
+    std::string corrupt = dir + "/corrupt";
+    write_file(corrupt, std::string(64, '\x5A'));
+    CHECK(!opens(corrupt));
+    std::string content;
+    {
+        std::ifstream input(path, std::ios::binary);
+        content.assign(std::istreambuf_iterator<char>(input), std::istreambuf_iterator<char>());
+    }
+    write_file(corrupt, content.substr(0, content.size() / 2));
+    CHECK(!opens(corrupt));
+    write_file(corrupt, "");
+    CHECK(!opens(corrupt));
+    CHECK(!opens(dir + "/missing"));
+
+    std::remove(corrupt.c_str());
+    std::remove(path.c_str());
+    std::remove((root + "/a.proto").c_str());
+    std::remove((root + "/b.proto").c_str());
+    std::remove((root + "/c.proto").c_str());
+    rmdir(root.c_str());
+    rmdir(dir.c_str());
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,175 @@
+/*
+ * Copyright 2020-2022 Bruno Ribeiro <https://github.com/brunexgeek>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <protop/json.hh>
+#include <iostream>
+#include <sstream>
+#include <cstring>
+
+// checks the JSON transcoder with 64-bit integers, base64, enumeration aliases, deep
+// nesting and integers out of range
+
+static int failures = 0;
+
+#define CHECK(x) \
+    do { if (!(x)) { std::cerr << __FILE__ << ":" << __LINE__ << ": check failed: " #x "\n"; ++failures; } } while (0)
+
+static const char *SCHEMA =
+    "syntax = \"proto3\";\n"
+    "package p;\n"
+    "enum Color { option allow_alias = true; RED = 0; BLUE = 1; AZURE = 1; }\n"
+    "message Node {\n"
+    "    int64 big = 2;\n"
+    "    uint64 ubig = 3;\n"
+    "    bytes data = 4;\n"
+    "    Color color = 5;\n"
+    "    int32 small = 6;\n"
+    "    repeated Node children = 7;\n"
+    "}\n";
+
+static bool to_binary( const protop::JsonTranscoder &js, const protop::MessageCodec &mc,
+    const std::string &json, std::string &out )
+{
+    try
+    {
+        uint8_t buffer[256];
+        size_t size = js.toBinary(mc, json.data(), json.size(), buffer, sizeof(buffer));
+        if (size > sizeof(buffer)) return false;
+        out.assign((const char *) buffer, size);
+        return true;
+    } catch (std::exception &)
+    {
+        return false;
+    }
+}
+
+static std::string to_json( const protop::JsonTranscoder &js, const protop::MessageCodec &mc,
+    const std::string &data )
+{
+    char buffer[256];
+    size_t size = js.toJson(mc, (const uint8_t *) data.data(), data.size(), buffer, sizeof(buffer));
+    if (size > sizeof(buffer)) return "";
+    return std::string(buffer, size);
+}
+
+static void integers( const protop::JsonTranscoder &js, const protop::MessageCodec &mc )
+{
+    std::string data;
+    // 64-bit integers are written as strings and accepted as strings or numbers
+    CHECK(to_binary(js, mc, "{\"big\":\"-9223372036854775808\",\"ubig\":\"18446744073709551615\"}", data));
+    CHECK(to_json(js, mc, data) == "{\"big\":\"-9223372036854775808\",\"ubig\":\"18446744073709551615\"}");
+    CHECK(to_binary(js, mc, "{\"big\":-5,\"ubig\":7}", data));
+    CHECK(to_json(js, mc, data) == "{\"big\":\"-5\",\"ubig\":\"7\"}");
+    CHECK(to_binary(js, mc, "{\"small\":1e3}", data));
+    CHECK(to_json(js, mc, data) == "{\"small\":1000}");
+
+    CHECK(!to_binary(js, mc, "{\"big\":\"9223372036854775808\"}", data));
+    CHECK(!to_binary(js, mc, "{\"big\":1e19}", data));
+    CHECK(!to_binary(js, mc, "{\"big\":9.3e18}", data));
+    CHECK(!to_binary(js, mc, "{\"ubig\":1.9e19}", data));
+    CHECK(!to_binary(js, mc, "{\"ubig\":-1}", data));
+    CHECK(!to_binary(js, mc, "{\"small\":2147483648}", data));
+    CHECK(!to_binary(js, mc, "{\"small\":1.5}", data));
+    CHECK(to_binary(js, mc, "{\"big\":-9.2e18}", data));
+}
+
+static void base64( const protop::JsonTranscoder &js, const protop::MessageCodec &mc )
+{
+    std::string data;
+    CHECK(to_binary(js, mc, "{\"data\":\"AP8=\"}", data));
+    CHECK(data == std::string("\x22\x02\x00\xff", 4));
+    CHECK(to_json(js, mc, data) == "{\"data\":\"AP8=\"}");
+    // padding is optional and the URL-safe alphabet is accepted
+    CHECK(to_binary(js, mc, "{\"data\":\"-_8\"}", data));
+    CHECK(data == std::string("\x22\x02\xfb\xff", 4));
+    CHECK(!to_binary(js, mc, "{\"data\":\"A\"}", data));
+    CHECK(!to_binary(js, mc, "{\"data\":\"A*==\"}", data));
+}
+
+static void enumerations( const protop::JsonTranscoder &js, const protop::MessageCodec &mc )
+{
+    std::string data;
+    // aliases are accepted and printed as the first name declared
+    CHECK(to_binary(js, mc, "{\"color\":\"AZURE\"}", data));
+    CHECK(data == "\x28\x01");
+    CHECK(to_json(js, mc, data) == "{\"color\":\"BLUE\"}");
+    CHECK(to_binary(js, mc, "{\"color\":\"BLUE\"}", data));
+    CHECK(data == "\x28\x01");
+    CHECK(to_binary(js, mc, "{\"color\":1}", data));
+    CHECK(data == "\x28\x01");
+    CHECK(!to_binary(js, mc, "{\"color\":\"GREEN\"}", data));
+}
+
+static void depth( const protop::JsonTranscoder &js, const protop::MessageCodec &mc )
+{
+    std::string data;
+    std::string json;
+    for (int i = 0; i < 50; ++i) json += "{\"children\":[";
+    json += "{}";
+    for (int i = 0; i < 50; ++i) json += "]}";
+    CHECK(to_binary(js, mc, json, data));
+
+    json.clear();
+    for (int i = 0; i < 200; ++i) json += "{\"children\":[";
+    for (int i = 0; i < 200; ++i) json += "]}";
+    CHECK(!to_binary(js, mc, json, data));
+
+    // skipped values are limited too
+    json = "{\"unknown\":";
+    for (int i = 0; i < 200; ++i) json += "[";
+    for (int i = 0; i < 200; ++i) json += "]";
+    json += "}";
+    CHECK(!to_binary(js, mc, json, data));
+
+    // wire format nested deeper than the limit
+    data.clear();
+    for (int i = 0; i < 200; ++i)
+    {
+        std::string key = "\x3A";
+        size_t size = data.size();
+        for (; size >= 0x80; size >>= 7) key += (char) (0x80 | (size & 0x7F));
+        key += (char) size;
+        data = key + data;
+    }
+    bool thrown = false;
+    try
+    {
+        char buffer[4096];
+        js.toJson(mc, (const uint8_t *) data.data(), data.size(), buffer, sizeof(buffer));
+    } catch (std::exception &)
+    {
+        thrown = true;
+    }
+    CHECK(thrown);
+}
+
+int main()
+{
+    std::stringstream input(SCHEMA);
+    protop::Proto proto;
+    protop::Proto::parse(proto, input, "edge.proto");
+    protop::Codec codec(proto);
+    protop::JsonTranscoder js(codec);
+    auto mc = codec.find("p.Node");
+    CHECK(mc != nullptr);
+    if (mc == nullptr) return 1;
+
+    integers(js, *mc);
+    base64(js, *mc);
+    enumerations(js, *mc);
+    depth(js, *mc);
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,112 @@
+/*
+ * Copyright 2020-2022 Bruno Ribeiro <https://github.com/brunexgeek>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <protop/pool.hh>
+#include <algorithm>
+#include <iostream>
+#include <sstream>
+
+// checks that replacing and removing files re-links the dependent files and that
+// snapshots taken before a change are not affected by it
+
+static int failures = 0;
+
+#define CHECK(x) \
+    do { if (!(x)) { std::cerr << __FILE__ << ":" << __LINE__ << ": check failed: " #x "\n"; ++failures; } } while (0)
+
+static std::vector<std::string> add( protop::SchemaPool &pool, const std::string &name, const std::string &content )
+{
+    std::stringstream input(content);
+    return pool.add(name, input);
+}
+
+static bool contains( const std::vector<std::string> &items, const std::string &value )
+{
+    return std::find(items.begin(), items.end(), value) != items.end();
+}
+
+static std::shared_ptr<protop::Field> field( std::shared_ptr<const protop::Message> message, const std::string &name )
+{
+    if (message == nullptr) return nullptr;
+    for (auto &fd : message->fields)
+        if (fd->name == name) return fd;
+    return nullptr;
+}
+
+int main()
+{
+    protop::SchemaPool pool;
+    add(pool, "a.proto", "syntax = \"proto3\"; package p; message A { int32 x = 1; }");
+    add(pool, "b.proto", "syntax = \"proto3\"; package p; message B { A a = 1; Missing m = 2; }");
+
+    auto first = pool.snapshot();
+    CHECK(first->files().size() == 2);
+    CHECK(first->declaringFile("p.B") == "b.proto");
+    CHECK(contains(first->unresolved("b.proto"), "Missing"));
+    auto a = field(first->message("p.B"), "a");
+    CHECK(a != nullptr && a->type.mref == first->message("p.A"));
+
+    // replacing 'a.proto' re-links 'b.proto', including the name it now declares
+    auto relinked = add(pool, "a.proto",
+        "syntax = \"proto3\"; package p; message A { string x = 1; } message Missing { }");
+    CHECK(contains(relinked, "b.proto"));
+    auto second = pool.snapshot();
+    CHECK(second->version() > first->version());
+    CHECK(second->unresolved("b.proto").empty());
+    a = field(second->message("p.B"), "a");
+    CHECK(a != nullptr && a->type.mref == second->message("p.A"));
+    CHECK(a != nullptr && a->type.mref != nullptr && a->type.mref->fields.front()->type.id == protop::TYPE_STRING);
+    CHECK(second->declaringFile("p.Missing") == "a.proto");
+
+    // the first snapshot still sees the old files
+    CHECK(first->message("p.Missing") == nullptr);
+    CHECK(contains(first->unresolved("b.proto"), "Missing"));
+    a = field(first->message("p.B"), "a");
+    CHECK(a != nullptr && a->type.mref == first->message("p.A"));
+    CHECK(a != nullptr && a->type.mref != nullptr && a->type.mref->fields.front()->type.id == protop::TYPE_INT32);
+
+    // a file declaring a symbol of another file is rejected without changing the pool
+    bool thrown = false;
+    try
+    {
+        add(pool, "c.proto", "syntax = \"proto3\"; package p; message B { }");
+    } catch (std::exception &)
+    {
+        thrown = true;
+    }
+    CHECK(thrown);
+    CHECK(pool.snapshot()->version() == second->version());
+    CHECK(pool.snapshot()->file("c.proto") == nullptr);
+
+    // removing 'a.proto' leaves the references of 'b.proto' unresolved
+    relinked = pool.remove("a.proto");
+    CHECK(contains(relinked, "b.proto"));
+    auto third = pool.snapshot();
+    CHECK(third->files().size() == 1);
+    CHECK(third->message("p.A") == nullptr);
+    CHECK(third->declaringFile("p.A").empty());
+    CHECK(contains(third->unresolved("b.proto"), "A"));
+    CHECK(contains(third->unresolved("b.proto"), "Missing"));
+    a = field(third->message("p.B"), "a");
+    CHECK(a != nullptr && a->type.mref == nullptr);
+
+    // the second snapshot is not affected by the removal
+    CHECK(second->files().size() == 2);
+    a = field(second->message("p.B"), "a");
+    CHECK(a != nullptr && a->type.mref != nullptr && a->type.mref == second->message("p.A"));
+
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,144 @@
+/*
+ * Copyright 2020-2022 Bruno Ribeiro <https://github.com/brunexgeek>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <protop/text.hh>
+#include <iostream>
+#include <sstream>
+#include <cstring>
+
+// checks the text format with negative numbers, string escapes and lists
+
+static int failures = 0;
+
+#define CHECK(x) \
+    do { if (!(x)) { std::cerr << __FILE__ << ":" << __LINE__ << ": check failed: " #x "\n"; ++failures; } } while (0)
+
+static const char *SCHEMA =
+    "syntax = \"proto3\";\n"
+    "package p;\n"
+    "enum Kind { NONE = 0; SOME = 1; }\n"
+    "message Item { string label = 1; }\n"
+    "message Record {\n"
+    "    int32 i = 1;\n"
+    "    sint64 s = 2;\n"
+    "    double d = 3;\n"
+    "    string text = 4;\n"
+    "    repeated int32 values = 5;\n"
+    "    repeated Item items = 6;\n"
+    "    Kind kind = 7;\n"
+    "    uint32 u = 8;\n"
+    "    bytes raw = 9;\n"
+    "    Item item = 10;\n"
+    "    repeated Record children = 11;\n"
+    "}\n";
+
+static bool parse( protop::DynamicMessage &message, const char *text )
+{
+    message.clear();
+    try
+    {
+        protop::TextFormat::parse(message, text, std::strlen(text));
+        return true;
+    } catch (std::exception &)
+    {
+        return false;
+    }
+}
+
+static void negatives( const protop::MessageCodec &mc )
+{
+    protop::DynamicMessage message(mc);
+    CHECK(parse(message, "i: -5 s: - 7 d: -2.5 values: [-1, 2]"));
+    CHECK(message.field("i")->getInt() == -5);
+    CHECK(message.field("s")->getInt() == -7);
+    CHECK(message.field("d")->getDouble() == -2.5);
+    CHECK(message.field("values")->values.size() == 2 && message.field("values")->getInt(0) == -1);
+    CHECK(parse(message, "d: -inf"));
+    CHECK(message.field("d")->getDouble() < -1e308);
+    CHECK(parse(message, "i: -2147483648"));
+    CHECK(message.field("i")->getInt() == -2147483648LL);
+
+    CHECK(!parse(message, "i: -2147483649"));
+    CHECK(!parse(message, "u: -1"));
+    CHECK(!parse(message, "kind: -SOME"));
+    CHECK(!parse(message, "i: -"));
+}
+
+static void escapes( const protop::MessageCodec &mc )
+{
+    protop::DynamicMessage message(mc);
+    CHECK(parse(message, "text: \"a\\\"b\\\\c\\n\\t\\x41\\101\" 'd'"));
+    CHECK(message.field("text")->strings[0] == "a\"b\\c\n\tAAd");
+    CHECK(parse(message, "raw: \"\\000\\377\""));
+    CHECK(message.field("raw")->strings[0] == std::string("\0\xff", 2));
+
+    // printed output is parsed back to the same value
+    std::string out;
+    protop::TextFormat::print(message, out);
+    CHECK(out.find("\\x00\\xff") != std::string::npos);
+    protop::DynamicMessage copy(mc);
+    CHECK(parse(copy, out.c_str()));
+    CHECK(copy.field("raw")->strings[0] == std::string("\0\xff", 2));
+
+    CHECK(!parse(message, "text: \"unterminated"));
+}
+
+static void lists( const protop::MessageCodec &mc )
+{
+    protop::DynamicMessage message(mc);
+    CHECK(parse(message, "values: [1, 2] values: 3 values: [] items: [{ label: \"a\" }, < label: \"b\" >]"));
+    auto values = message.field("values");
+    CHECK(values->values.size() == 3 && values->getInt(2) == 3);
+    auto items = message.field("items");
+    CHECK(items->messages.size() == 2 && items->messages[1]->field("label")->strings[0] == "b");
+    // singular messages are merged
+    CHECK(parse(message, "item { label: \"a\" } item { }"));
+    CHECK(message.field("item")->messages.size() == 1);
+
+    CHECK(!parse(message, "i: [1, 2]"));
+    CHECK(!parse(message, "values: [1 2]"));
+    CHECK(!parse(message, "values: [1,"));
+}
+
+static void depth( const protop::MessageCodec &mc )
+{
+    protop::DynamicMessage message(mc);
+    std::string text;
+    for (int i = 0; i < 50; ++i) text += "children { ";
+    for (int i = 0; i < 50; ++i) text += "} ";
+    CHECK(parse(message, text.c_str()));
+
+    text.clear();
+    for (int i = 0; i < 200; ++i) text += "children < ";
+    CHECK(!parse(message, text.c_str()));
+}
+
+int main()
+{
+    std::stringstream input(SCHEMA);
+    protop::Proto proto;
+    protop::Proto::parse(proto, input, "format.proto");
+    protop::Codec codec(proto);
+    auto mc = codec.find("p.Record");
+    CHECK(mc != nullptr);
+    if (mc == nullptr) return 1;
+
+    negatives(*mc);
+    escapes(*mc);
+    lists(*mc);
+    depth(*mc);
+    return failures == 0 ? 0 : 1;
+}
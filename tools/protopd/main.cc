@@ -0,0 +1,466 @@
+/*
+ * Copyright 2020-2022 Bruno Ribeiro <https://github.com/brunexgeek>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Resident schema daemon. Keeps a set of proto files linked in a 'SchemaPool'
+ * (so types are resolved across files), reparses a file when inotify reports it
+ * changed and answers queries over a Unix domain socket.
+ *
+ * Queries are single lines and each response starts with "OK <lines>" or
+ * "ERROR <message>" followed by the given number of lines:
+ *
+ *   list                all messages, enumerations and services
+ *   lookup <qname>      kind and file of a declaration
+ *   describe <qname>    declaration in proto syntax
+ *   files               loaded files, content hashes, unresolved types and
+ *                       parse errors
+ *
+ * Readers work on immutable snapshots. A reparse updates the pool, which only
+ * re-links the declarations depending on the changed file, and publishes a new
+ * snapshot (sharing the unchanged nodes) with an atomic store, so queries never
+ * wait for the parser. A file that fails to parse keeps its last version that
+ * parsed successfully, or no declarations at all.
+ */
+
+#include <protop/protop.hh>
+#include <protop/pool.hh>
+#include <protop/writer.hh>
+#include <fstream>
+#include <sstream>
+#include <iterator>
+#include <stdexcept>
+#include <map>
+#include <set>
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <cstring>
+#include <cstdio>
+#include <cerrno>
+#include <csignal>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+using namespace protop;
+
+// time (ms) between checks of the termination flag
+#define POLL_INTERVAL    500
+#define MAX_CLIENTS      64
+#define MAX_REQUEST      4096
+
+struct FileEntry
+{
+    // hash of the content parsed successfully (zero if none)
+    uint64_t hash = 0;
+    // error of the last parse (the pool keeps the last version parsed successfully)
+    std::string error;
+};
+
+struct Symbol
+{
+    const char *kind;
+    std::string file;
+    std::shared_ptr<const Message> message;
+    std::shared_ptr<const Enum> entity;
+    std::shared_ptr<const Service> service;
+};
+
+struct Snapshot
+{
+    std::shared_ptr<const SchemaSnapshot> schema;
+    std::map<std::string, FileEntry> files;
+    std::map<std::string, Symbol> symbols;
+    uint64_t version = 0;
+};
+
+static std::shared_ptr<const Snapshot> current;
+static volatile sig_atomic_t running = 1;
+// only used by the thread loading files (the main thread, then the watcher)
+static SchemaPool pool;
+
+static std::shared_ptr<const Snapshot> snapshot()
+{
+    return std::atomic_load(&current);
+}
+
+static void on_signal( int )
+{
+    running = 0;
+}
+
+static uint64_t content_hash( const std::string &content )
+{
+    uint64_t hash = 14695981039346656037ULL;
+    for (char c : content)
+    {
+        hash ^= (uint8_t) c;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+/*
+ * Parses a file into the pool. The pool is not changed if the file cannot be
+ * parsed, so the entry only records the error.
+ */
+static void load( const std::string &path, FileEntry &entry )
+{
+    try
+    {
+        std::ifstream input(path, std::ios::binary);
+        if (!input.good()) throw std::runtime_error("Unable to open file");
+        std::string content((std::istreambuf_iterator<char>(input)), std::istreambuf_iterator<char>());
+        std::istringstream stream(content);
+        for (auto &it : pool.add(path, stream))
+            std::cerr << "Re-linked " << it << '\n';
+        entry.hash = content_hash(content);
+        entry.error.clear();
+    } catch (std::exception &ex)
+    {
+        entry.error = ex.what();
+        std::cerr << path << ": " << ex.what() << '\n';
+    }
+}
+
+// build and publish a snapshot with the current content of the pool
+static void publish( std::map<std::string, FileEntry> files )
+{
+    auto previous = snapshot();
+    auto next = std::make_shared<Snapshot>();
+    next->version = (previous == nullptr) ? 1 : previous->version + 1;
+    next->schema = pool.snapshot();
+    next->files.swap(files);
+    for (auto &name : next->schema->files())
+    {
+        auto tree = next->schema->file(name);
+        for (auto message : tree->messages)
+            next->symbols[message->qname] = Symbol{"message", name, message, nullptr, nullptr};
+        for (auto entity : tree->enums)
+            next->symbols[entity->qname] = Symbol{"enum", name, nullptr, entity, nullptr};
+        for (auto service : tree->services)
+            next->symbols[service->qname] = Symbol{"service", name, nullptr, nullptr, service};
+    }
+    std::atomic_store(&current, std::shared_ptr<const Snapshot>(next));
+}
+
+static std::string dir_name( const std::string &path )
+{
+    auto pos = path.rfind('/');
+    if (pos == std::string::npos) return ".";
+    if (pos == 0) return "/";
+    return path.substr(0, pos);
+}
+
+static std::string base_name( const std::string &path )
+{
+    auto pos = path.rfind('/');
+    return (pos == std::string::npos) ? path : path.substr(pos + 1);
+}
+
+/*
+ * Watches the directories of the files (editors usually replace files instead
+ * of writing them in place) and reparses the files that changed.
+ */
+static void watch( const std::set<std::string> &paths )
+{
+    int fd = inotify_init1(IN_CLOEXEC);
+    if (fd < 0)
+    {
+        perror("inotify_init1");
+        return;
+    }
+    std::map<int, std::string> directories;
+    for (auto &path : paths)
+    {
+        std::string dir = dir_name(path);
+        int wd = inotify_add_watch(fd, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_DELETE);
+        if (wd < 0)
+            perror(dir.c_str());
+        else
+            directories[wd] = dir;
+    }
+
+    alignas(struct inotify_event) char buffer[16 * 1024];
+    while (running)
+    {
+        struct pollfd pfd = { fd, POLLIN, 0 };
+        if (poll(&pfd, 1, POLL_INTERVAL) <= 0) continue;
+        ssize_t size = read(fd, buffer, sizeof(buffer));
+        if (size <= 0) continue;
+
+        // collect the changed files (one reparse for several events)
+        std::set<std::string> changed;
+        for (char *ptr = buffer; ptr < buffer + size; )
+        {
+            auto event = (struct inotify_event*) ptr;
+            ptr += sizeof(struct inotify_event) + event->len;
+            if (event->len == 0) continue;
+            auto dir = directories.find(event->wd);
+            if (dir == directories.end()) continue;
+            std::string path = dir->second + '/' + event->name;
+            if (paths.count(path) != 0) changed.insert(path);
+        }
+        if (changed.empty()) continue;
+
+        auto files = snapshot()->files;
+        for (auto &path : changed)
+        {
+            load(path, files[path]);
+            std::cerr << "Reloaded " << path << '\n';
+        }
+        publish(files);
+    }
+    close(fd);
+}
+
+static std::string type_name( const TypeInfo &type )
+{
+    static const char *TYPES[] =
+    {
+        "double", "float", "int32", "int64", "uint32", "uint64", "sint32", "sint64",
+        "fixed32", "fixed64", "sfixed32", "sfixed64", "bool", "string", "bytes",
+    };
+    if (type.id >= TYPE_DOUBLE && type.id <= TYPE_BYTES) return TYPES[type.id - TYPE_DOUBLE];
+    if (type.mref != nullptr) return type.mref->qname;
+    if (type.eref != nullptr) return type.eref->qname;
+    return type.name;
+}
+
+static void describe( CodeWriter &out, const Symbol &symbol )
+{
+    if (symbol.message != nullptr)
+    {
+        out << "message " << symbol.message->name << "\n{\n";
+        out.indent();
+        for (auto it : symbol.message->fields)
+        {
+            if (it->type.repeated) out << "repeated ";
+            out << type_name(it->type) << ' ' << it->name << " = " << it->index << ";\n";
+        }
+        out.dedent();
+        out << "}\n";
+    }
+    else
+    if (symbol.entity != nullptr)
+    {
+        out << "enum " << symbol.entity->name << "\n{\n";
+        out.indent();
+        for (auto it : symbol.entity->constants)
+            out << it->name << " = " << it->value << ";\n";
+        out.dedent();
+        out << "}\n";
+    }
+    else
+    {
+        out << "service " << symbol.service->name << "\n{\n";
+        out.indent();
+        for (auto it : symbol.service->procs)
+            out << "rpc " << it->name << "(" << (it->requestStream ? "stream " : "") << type_name(it->request)
+                << ") returns (" << (it->responseStream ? "stream " : "") << type_name(it->response) << ");\n";
+        out.dedent();
+        out << "}\n";
+    }
+}
+
+static size_t count_lines( const CodeWriter &out )
+{
+    size_t count = 0;
+    for (size_t i = 0; i < out.size(); ++i)
+        if (out.data()[i] == '\n') ++count;
+    return count;
+}
+
+static void answer( CodeWriter &response, const std::string &request )
+{
+    auto pos = request.find(' ');
+    std::string command = request.substr(0, pos);
+    std::string argument = (pos == std::string::npos) ? "" : request.substr(pos + 1);
+    // the snapshot stays valid until the end of the query, even if replaced
+    auto state = snapshot();
+    CodeWriter body;
+
+    if (command == "list")
+    {
+        for (auto &it : state->symbols)
+            body << it.second.kind << ' ' << it.first << '\n';
+    }
+    else
+    if (command == "files")
+    {
+        char buffer[32];
+        for (auto &it : state->files)
+        {
+            snprintf(buffer, sizeof(buffer), "%016llx", (unsigned long long) it.second.hash);
+            body << it.first << ' ' << buffer;
+            auto unresolved = state->schema->unresolved(it.first);
+            for (size_t i = 0; i < unresolved.size(); ++i)
+                body << (i == 0 ? " unresolved: " : ", ") << unresolved[i];
+            if (!it.second.error.empty()) body << " error: " << it.second.error;
+            body << '\n';
+        }
+    }
+    else
+    if (command == "lookup" || command == "describe")
+    {
+        auto it = state->symbols.find(argument);
+        if (it == state->symbols.end())
+        {
+            response << "ERROR Unknown symbol '" << argument << "'\n";
+            return;
+        }
+        if (command == "lookup")
+            body << it->second.kind << ' ' << it->first << ' ' << it->second.file << '\n';
+        else
+            describe(body, it->second);
+    }
+    else
+    {
+        response << "ERROR Unknown command '" << command << "'\n";
+        return;
+    }
+    response << "OK " << count_lines(body) << '\n';
+    response.write(body.data(), body.size());
+}
+
+static bool send_all( int fd, const CodeWriter &data )
+{
+    size_t offset = 0;
+    while (offset < data.size())
+    {
+        ssize_t result = send(fd, data.data() + offset, data.size() - offset, MSG_NOSIGNAL);
+        if (result < 0 && errno == EINTR) continue;
+        if (result <= 0) return false;
+        offset += (size_t) result;
+    }
+    return true;
+}
+
+static int listen_on( const std::string &path )
+{
+    struct sockaddr_un address;
+    if (path.size() >= sizeof(address.sun_path))
+    {
+        std::cerr << "Socket path is too long\n";
+        return -1;
+    }
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, path.c_str());
+    unlink(path.c_str());
+    if (bind(fd, (struct sockaddr*) &address, sizeof(address)) != 0 || listen(fd, 16) != 0)
+    {
+        perror(path.c_str());
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static void serve( int server )
+{
+    std::vector<struct pollfd> fds;
+    std::vector<std::string> buffers;
+    fds.push_back(pollfd{server, POLLIN, 0});
+    buffers.emplace_back();
+
+    while (running)
+    {
+        if (poll(fds.data(), fds.size(), POLL_INTERVAL) <= 0) continue;
+        for (size_t i = fds.size(); i-- > 1; )
+        {
+            if (fds[i].revents == 0) continue;
+            char data[1024];
+            ssize_t size = recv(fds[i].fd, data, sizeof(data), 0);
+            bool keep = size > 0;
+            if (keep)
+            {
+                std::string &buffer = buffers[i];
+                buffer.append(data, (size_t) size);
+                size_t pos;
+                CodeWriter response;
+                while ((pos = buffer.find('\n')) != std::string::npos)
+                {
+                    std::string request = buffer.substr(0, pos);
+                    buffer.erase(0, pos + 1);
+                    if (!request.empty() && request.back() == '\r') request.pop_back();
+                    if (!request.empty()) answer(response, request);
+                }
+                keep = buffer.size() <= MAX_REQUEST && send_all(fds[i].fd, response);
+            }
+            if (!keep)
+            {
+                close(fds[i].fd);
+                fds.erase(fds.begin() + (long) i);
+                buffers.erase(buffers.begin() + (long) i);
+            }
+        }
+        if (fds[0].revents & POLLIN)
+        {
+            int client = accept4(server, nullptr, nullptr, SOCK_CLOEXEC);
+            if (client >= 0 && fds.size() > MAX_CLIENTS)
+                close(client);
+            else
+            if (client >= 0)
+            {
+                fds.push_back(pollfd{client, POLLIN, 0});
+                buffers.emplace_back();
+            }
+        }
+    }
+    for (size_t i = 1; i < fds.size(); ++i) close(fds[i].fd);
+}
+
+int main( int argc, char **argv )
+{
+    if (argc < 3)
+    {
+        std::cerr << "Usage: protopd <socket path> <proto file>...\n";
+        return 1;
+    }
+
+    std::set<std::string> paths;
+    std::map<std::string, FileEntry> files;
+    for (int i = 2; i < argc; ++i)
+    {
+        // same form used to match inotify events
+        std::string path = dir_name(argv[i]) + '/' + base_name(argv[i]);
+        paths.insert(path);
+        load(path, files[path]);
+    }
+    publish(files);
+
+    int server = listen_on(argv[1]);
+    if (server < 0) return 1;
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = on_signal;
+    sigaction(SIGINT, &action, nullptr);
+    sigaction(SIGTERM, &action, nullptr);
+
+    std::thread watcher(watch, paths);
+    serve(server);
+    watcher.join();
+
+    close(server);
+    unlink(argv[1]);
+    return 0;
+}
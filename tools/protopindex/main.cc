@@ -0,0 +1,112 @@
+/*
+ * Copyright 2020-2022 Bruno Ribeiro <https://github.com/brunexgeek>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Builds and queries a repository-wide symbol index (see 'RepositoryIndex').
+ *
+ *   build <directory> <index>   create or update the index of a directory tree
+ *   find <index> <qname>        kind and file of a declaration
+ *   search <index> <prefix>     declarations whose names start with the prefix
+ *   refs <index> <qname>        declarations referencing the given one
+ *   deps <index> <qname>        declarations referenced by the given one
+ *   file <index> <path>         declarations of a file
+ */
+
+#include <protop/index.hh>
+#include <protop/writer.hh>
+#include <chrono>
+#include <iostream>
+#include <unistd.h>
+
+using namespace protop;
+
+static const char *kind_name( SymbolKind kind )
+{
+    switch (kind)
+    {
+        case SymbolKind::MESSAGE: return "message";
+        case SymbolKind::ENUM:    return "enum";
+        case SymbolKind::SERVICE: return "service";
+    }
+    return "unknown";
+}
+
+static void print( CodeWriter &out, const IndexedSymbol &symbol )
+{
+    out << kind_name(symbol.kind) << ' ' << symbol.name << ' ' << symbol.file << '\n';
+}
+
+int main( int argc, char **argv )
+{
+    if (argc != 4)
+    {
+        std::cerr << "Usage: protopindex build <directory> <index>\n"
+            << "       protopindex find|search|refs|deps|file <index> <argument>\n";
+        return 1;
+    }
+    std::string command = argv[1];
+
+    try
+    {
+        if (command == "build")
+        {
+            auto start = std::chrono::steady_clock::now();
+            IndexStats stats = RepositoryIndex::build(argv[2], argv[3]);
+            double elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            std::cout << "Files: " << stats.files << " (" << stats.parsed << " parsed, " << stats.failed << " failed)\n"
+                << "Symbols: " << stats.symbols << "\nReferences: " << stats.references << "\nTime: " << elapsed << " ms\n";
+            return 0;
+        }
+
+        RepositoryIndex index(argv[2]);
+        std::string argument = argv[3];
+        std::vector<IndexedSymbol> symbols;
+        auto start = std::chrono::steady_clock::now();
+        if (command == "find")
+        {
+            IndexedSymbol symbol;
+            if (index.find(argument, symbol)) symbols.push_back(symbol);
+        }
+        else
+        if (command == "search")
+            symbols = index.search(argument);
+        else
+        if (command == "refs")
+            symbols = index.references(argument);
+        else
+        if (command == "deps")
+            symbols = index.dependencies(argument);
+        else
+        if (command == "file")
+            symbols = index.declarations(argument);
+        else
+        {
+            std::cerr << "Unknown command '" << command << "'\n";
+            return 1;
+        }
+        double elapsed = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+
+        CodeWriter out;
+        for (auto &it : symbols) print(out, it);
+        out.writeTo(STDOUT_FILENO);
+        std::cerr << symbols.size() << " results in " << elapsed << " us\n";
+        return symbols.empty() ? 2 : 0;
+    } catch (std::exception &ex)
+    {
+        std::cerr << ex.what() << '\n';
+        return 1;
+    }
+}